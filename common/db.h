@@ -4,15 +4,27 @@
 #include <cstdio>
 #include <cstring>
 #include <string>
+#include <vector>
 
 enum Status : unsigned char {
   Ok,
   NotFound,
   IOError,
-  OutOfMemory
+  OutOfMemory,
+  // a conditional write found another version of its key
+  VersionMismatch
 
 };
 
+enum Durability : unsigned char {
+  // plain cached store, durable only once evicted from the cpu caches
+  kVolatile,
+  // cached store flushed by a background thread within FLUSH_INTERVAL_US
+  kFlushAsync,
+  // persisted before Set returns
+  kPersist
+};
+
 class Slice {
  public:
   Slice() : _data(nullptr), _size(0) {}
@@ -45,6 +57,49 @@ class Slice {
   uint64_t _size;
 };
 
+// Operation of the asynchronous api, see AsyncQueue.
+struct AsyncOp {
+  enum Type : unsigned char { kGet, kSet };
+
+  Type type;
+  // of a set
+  Durability durability;
+  Slice key;
+  // the value of a set
+  Slice value;
+  // receives the value of a get
+  std::string* result;
+  // handed back with the completion
+  void* user_data;
+};
+
+struct AsyncCompletion {
+  void* user_data;
+  Status status;
+};
+
+// Submission/completion queue of the asynchronous api. The operations are
+// run by a few engine workers, each owning a group of shards. A queue must
+// be used by one thread at a time.
+class AsyncQueue {
+ public:
+  /*
+   *  Post ops for execution and return how many of them have been accepted,
+   *  less than num_ops once the queue is at its depth. Keys, values and
+   *  results must stay valid until the completion has been polled.
+   */
+  virtual uint32_t Submit(const AsyncOp* ops, uint32_t num_ops) = 0;
+
+  /*
+   *  Move up to max_completions finished operations to completions, without
+   *  blocking, and return their number.
+   */
+  virtual uint32_t Poll(AsyncCompletion* completions,
+                        uint32_t max_completions) = 0;
+
+  virtual ~AsyncQueue() {}
+};
+
 class DB {
  public:
   /*
@@ -57,18 +112,105 @@ class DB {
   static Status CreateOrOpen(const std::string& name, DB** dbptr,
                              FILE* log_file = nullptr);
 
+  /*
+   *  Same as CreateOrOpen, with the engine tuned for one of the workload
+   *  profiles it has been built with, such as "contest" or "small", see
+   *  engine/profiles.h. NotFound is returned for any other profile.
+   */
+  static Status CreateOrOpen(const std::string& name,
+                             const std::string& profile, DB** dbptr,
+                             FILE* log_file = nullptr);
+
   /*
    *  Get the value of key.
    *  If the key does not exist the NotFound is returned.
    */
   virtual Status Get(const Slice& key, std::string* value) = 0;
 
+  /*
+   *  Same as Get, version receives the version of the value, which changes
+   *  with every write of key and is 0 if the key does not exist.
+   */
+  virtual Status Get(const Slice& key, std::string* value,
+                     uint64_t* version) = 0;
+
+  /*
+   *  Copy up to len bytes of the value of key, starting at offset, to buf.
+   *  read_len receives the number of bytes copied, which is less than len
+   *  only at the end of the value. Large values can be streamed this way.
+   */
+  virtual Status Read(const Slice& key, uint64_t offset, char* buf,
+                      uint64_t len, uint64_t* read_len) = 0;
+
   /*
    *  Set key to hold the string value.
    *  If key already holds a value, it is overwritten.
    */
   virtual Status Set(const Slice& key, const Slice& value) = 0;
 
+  /*
+   *  Same as Set, but the write is made durable according to durability
+   *  instead of the default level of the db.
+   */
+  virtual Status Set(const Slice& key, const Slice& value,
+                     Durability durability) = 0;
+
+  /*
+   *  Same as Set, but the value expires ttl_ms milliseconds from now, after
+   *  which key is not found anymore and its space is reclaimed in the
+   *  background. A ttl_ms of 0 never expires, like the other Sets, which
+   *  also clear the expiry of the previous value.
+   */
+  virtual Status Set(const Slice& key, const Slice& value,
+                     Durability durability, uint64_t ttl_ms) = 0;
+
+  /*
+   *  Set key to value only if its version is still expected_version, 0 if
+   *  the key must not exist, or return VersionMismatch. version receives
+   *  the version of key: the new one, or the current one on a mismatch.
+   *  Like Set, it clears the expiry of the previous value. Moving a value
+   *  between the tiers of the db also changes its version.
+   */
+  virtual Status CompareAndSet(const Slice& key, uint64_t expected_version,
+                               const Slice& value, uint64_t* version) = 0;
+
+  /*
+   *  Add delta to the decimal integer held by key, 0 if it does not exist,
+   *  atomically, and return the sum in result. IOError is returned if the
+   *  value is not an integer or the sum overflows.
+   */
+  virtual Status Increment(const Slice& key, int64_t delta,
+                           int64_t* result) = 0;
+
+  /*
+   *  Append suffix to the value of key atomically, the key is created if it
+   *  does not exist. Like Increment, it keeps the expiry of the value.
+   */
+  virtual Status Append(const Slice& key, const Slice& suffix) = 0;
+
+  /*
+   *  Set keys[i] to values[i] for the num_keys keys at once: after a crash
+   *  either all of them or none have their new values. A key given more
+   *  than once gets its last value. Up to 15 keys can be set together, with
+   *  IOError returned for more. There is no isolation: a concurrent reader
+   *  may see some of the keys set before the others, and a concurrent Set
+   *  of one of the keys may be ordered before or after the transaction.
+   */
+  virtual Status MultiSet(const Slice* keys, const Slice* values,
+                          uint32_t num_keys) = 0;
+
+  /*
+   *  Create a queue of the asynchronous api with up to depth operations in
+   *  flight. Queues must be deleted before the db.
+   */
+  virtual AsyncQueue* NewAsyncQueue(uint32_t depth) = 0;
+
+  /*
+   *  Fill keys with up to max_keys of the most accessed keys, hottest first,
+   *  as estimated from a sample of the recent gets and sets.
+   */
+  virtual void HotKeys(uint32_t max_keys, std::vector<std::string>* keys) = 0;
+
   /*
    * Close the db on exit.
    */
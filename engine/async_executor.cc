@@ -0,0 +1,375 @@
+#include "async_executor.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "utils.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+namespace {
+#ifdef USE_SHARD_OWNER
+std::atomic<uint64_t> num_executors(0);
+#endif
+}  // namespace
+
+AsyncExecutor::AsyncExecutor(SubEngine* engines, HotKeyTracker* hot_keys,
+                             Logger* logger)
+    : engines_(engines), hot_keys_(hot_keys), logger_(logger) {
+#ifdef USE_SHARD_OWNER
+  // one owner per cpu
+  num_workers_ = std::max(1u, std::thread::hardware_concurrency());
+  num_workers_ = std::min(num_workers_, NUM_SHARDS);
+  id_ = num_executors.fetch_add(1, RE) + 1;
+  for (uint32_t i = 0; i < OWNER_MAX_CLIENTS; i++) {
+    clients_[i].store(nullptr, RE);
+  }
+  num_clients_.store(0, RE);
+#else
+  num_workers_ = ASYNC_NUM_WORKERS;
+#endif
+  workers_.reset(new Worker[num_workers_]);
+  stopped_.store(false, RE);
+  for (uint32_t i = 0; i < num_workers_; i++) {
+    workers_[i].thread = std::thread(&AsyncExecutor::Work, this, i);
+  }
+  logger_->LogWithTime("%u async workers have been started", num_workers_);
+}
+
+AsyncQueue* AsyncExecutor::NewQueue(uint32_t depth) {
+  return new Queue(this, depth);
+}
+
+AsyncExecutor::~AsyncExecutor() {
+  stopped_.store(true, std::memory_order_release);
+  for (uint32_t i = 0; i < num_workers_; i++) {
+    workers_[i].thread.join();
+  }
+#ifdef USE_SHARD_OWNER
+  for (uint32_t i = 0; i < OWNER_MAX_CLIENTS; i++) {
+    delete clients_[i].load(RE);
+  }
+#endif
+}
+
+#ifdef USE_SHARD_OWNER
+AsyncExecutor::Client::Client(uint32_t num_workers) {
+  // a client has at most one call in flight
+  for (uint32_t i = 0; i < num_workers; i++) {
+    inboxes.emplace_back(new SpscQueue<Call*>(1));
+  }
+}
+
+AsyncExecutor::Client* AsyncExecutor::ThisClient() {
+  static thread_local uint64_t executor_id = 0;
+  static thread_local Client* client = nullptr;
+  if (executor_id == id_) return client;
+
+  // the slot of a thread is kept until the db is closed
+  executor_id = id_;
+  client = nullptr;
+  uint32_t slot = num_clients_.fetch_add(1, RE);
+  if (slot < OWNER_MAX_CLIENTS) {
+    client = new Client(num_workers_);
+    clients_[slot].store(client, std::memory_order_release);
+  }
+  return client;
+}
+
+Status AsyncExecutor::Forward(Call* call) {
+  uint32_t shard = KeyHash::Shard(KeyHash::Hash(*call->key));
+  uint32_t owner = shard % num_workers_;
+  call->done.store(false, RE);
+
+  auto client = ThisClient();
+  if (client != nullptr) {
+    while (!client->inboxes[owner]->TryPush(call)) {
+      std::this_thread::yield();
+    }
+  } else {
+    Request req;
+    req.queue = nullptr;
+    req.call = call;
+    while (!workers_[owner].submissions.TryPush(req)) {
+      std::this_thread::yield();
+    }
+  }
+
+  while (!call->done.load(std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+  return call->status;
+}
+
+Status AsyncExecutor::Get(const Slice& key, std::string* value,
+                          uint64_t* expiry, uint64_t* version) {
+  Call call;
+  call.type = Call::kGet;
+  call.key = &key;
+  call.result = value;
+  call.version = version;
+  Status status = Forward(&call);
+  *expiry = call.expiry;
+  return status;
+}
+
+Status AsyncExecutor::Read(const Slice& key, uint64_t offset, char* buf,
+                           uint64_t len, uint64_t* read_len) {
+  Call call;
+  call.type = Call::kRead;
+  call.key = &key;
+  call.offset = offset;
+  call.buf = buf;
+  call.len = len;
+  call.read_len = read_len;
+  return Forward(&call);
+}
+
+Status AsyncExecutor::Set(const Slice& key, const Slice& value,
+                          Durability durability, uint64_t expiry) {
+  Call call;
+  call.type = Call::kSet;
+  call.key = &key;
+  call.value = &value;
+  call.durability = durability;
+  call.expiry = expiry;
+  return Forward(&call);
+}
+
+Status AsyncExecutor::CompareAndSet(const Slice& key, const Slice& value,
+                                    Durability durability,
+                                    uint64_t* version) {
+  Call call;
+  call.type = Call::kCompareAndSet;
+  call.key = &key;
+  call.value = &value;
+  call.durability = durability;
+  call.version = version;
+  return Forward(&call);
+}
+
+Status AsyncExecutor::Increment(const Slice& key, int64_t delta,
+                                Durability durability, int64_t* result) {
+  Call call;
+  call.type = Call::kIncrement;
+  call.key = &key;
+  call.delta = delta;
+  call.durability = durability;
+  call.number = result;
+  return Forward(&call);
+}
+
+Status AsyncExecutor::Append(const Slice& key, const Slice& suffix,
+                             Durability durability) {
+  Call call;
+  call.type = Call::kAppend;
+  call.key = &key;
+  call.value = &suffix;
+  call.durability = durability;
+  return Forward(&call);
+}
+
+Status AsyncExecutor::PrepareTxn(const Slice& key, const Slice& value,
+                                 uint64_t txid, TxnLog::Entry* entry) {
+  Call call;
+  call.type = Call::kPrepareTxn;
+  call.key = &key;
+  call.value = &value;
+  call.txid = txid;
+  call.entry = entry;
+  return Forward(&call);
+}
+
+void AsyncExecutor::PublishTxn(const Slice& key, const Slice& value,
+                               const TxnLog::Entry& entry, bool committed) {
+  Call call;
+  call.type = Call::kPublishTxn;
+  call.key = &key;
+  call.value = &value;
+  call.entry = (TxnLog::Entry*)&entry;
+  call.committed = committed;
+  Forward(&call);
+}
+#endif
+
+void AsyncExecutor::Execute(Call* call) {
+  auto engine = engines_ + KeyHash::Shard(KeyHash::Hash(*call->key));
+  switch (call->type) {
+    case Call::kGet: {
+      call->status = engine->Get(*call->key, call->result, &call->expiry,
+                                 call->version);
+      break;
+    }
+    case Call::kRead: {
+      call->status = engine->Read(*call->key, call->offset, call->buf,
+                                  call->len, call->read_len);
+      break;
+    }
+    case Call::kCompareAndSet: {
+      call->status = engine->CompareAndSet(*call->key, *call->value,
+                                           call->durability, 0, call->version);
+      break;
+    }
+    case Call::kIncrement: {
+      call->status = engine->Increment(*call->key, call->delta,
+                                       call->durability, call->number);
+      break;
+    }
+    case Call::kAppend: {
+      call->status =
+          engine->Append(*call->key, *call->value, call->durability);
+      break;
+    }
+    case Call::kPrepareTxn: {
+      call->status = engine->PrepareTxn(*call->key, *call->value, call->txid,
+                                        call->entry);
+      break;
+    }
+    case Call::kPublishTxn: {
+      engine->PublishTxn(*call->key, *call->value, *call->entry,
+                         call->committed);
+      call->status = Ok;
+      break;
+    }
+    default:
+    case Call::kSet: {
+      call->status = engine->Set(*call->key, *call->value, call->durability,
+                                 call->expiry);
+      break;
+    }
+  }
+  // the call is gone as soon as it is marked as done
+  call->done.store(true, std::memory_order_release);
+}
+
+void AsyncExecutor::Work(uint32_t id) {
+  uint32_t num_cpus = std::thread::hardware_concurrency();
+  if (num_cpus > 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(id % num_cpus, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+
+  auto& submissions = workers_[id].submissions;
+  Request req;
+  uint32_t num_idle_rounds = 0;
+#ifdef USE_SHARD_OWNER
+  auto last_demote = std::chrono::steady_clock::now();
+  auto last_expire = last_demote;
+  uint32_t num_rounds = 0;
+#endif
+  while (1) {
+    bool busy = false;
+#ifdef USE_SHARD_OWNER
+    uint32_t num_clients =
+        std::min(num_clients_.load(RE), OWNER_MAX_CLIENTS);
+    for (uint32_t i = 0; i < num_clients; i++) {
+      auto client = clients_[i].load(std::memory_order_acquire);
+      Call* call;
+      if (client != nullptr && client->inboxes[id]->TryPop(&call)) {
+        Execute(call);
+        busy = true;
+      }
+    }
+#endif
+
+    if (submissions.TryPop(&req)) {
+      busy = true;
+      if (req.call != nullptr) {
+        Execute(req.call);
+      } else {
+        auto& op = req.op;
+        auto engine = engines_ + KeyHash::Shard(KeyHash::Hash(op.key));
+        Status status;
+        switch (op.type) {
+          case AsyncOp::kGet: {
+            status = engine->Get(op.key, op.result);
+            break;
+          }
+          default:
+          case AsyncOp::kSet: {
+            status = engine->Set(op.key, op.value, op.durability, 0);
+#ifdef USE_HOT_REPLICAS
+            hot_keys_->Invalidate(op.key);
+#endif
+            break;
+          }
+        }
+
+        // cannot fail, a queue never has more operations in flight than
+        // slots
+        AsyncCompletion completion = {op.user_data, status};
+        while (!req.queue->completions_.TryPush(completion)) {
+          std::this_thread::yield();
+        }
+      }
+    }
+
+#ifdef USE_SHARD_OWNER
+    // the demoter and the sweeper must not touch the shards of other
+    // owners, every owner demotes and expires its own
+    if (!busy || ++num_rounds % ASYNC_SPIN_COUNT == 0) {
+      auto now = std::chrono::steady_clock::now();
+#ifdef USE_TIERING
+      if (now - last_demote >= std::chrono::microseconds(TIER_INTERVAL_US)) {
+        for (uint32_t i = id; i < NUM_SHARDS; i += num_workers_) {
+          engines_[i].Demote();
+        }
+        last_demote = now;
+      }
+#endif
+      if (now - last_expire >= std::chrono::microseconds(EXPIRY_INTERVAL_US)) {
+        uint64_t wall_now = WallClockMs();
+        for (uint32_t i = id; i < NUM_SHARDS; i += num_workers_) {
+          engines_[i].Expire(wall_now);
+        }
+        last_expire = now;
+      }
+    }
+#endif
+
+    if (busy) {
+      num_idle_rounds = 0;
+      continue;
+    }
+    if (stopped_.load(std::memory_order_acquire)) break;
+    // spin for a while, then back off not to burn the cpu of an idle db
+    if (++num_idle_rounds < ASYNC_SPIN_COUNT) {
+      std::this_thread::yield();
+    } else {
+      usleep(ASYNC_IDLE_US);
+    }
+  }
+}
+
+AsyncExecutor::Queue::Queue(AsyncExecutor* executor, uint32_t depth)
+    : executor_(executor),
+      depth_(depth),
+      num_in_flight_(0),
+      completions_(depth) {}
+
+uint32_t AsyncExecutor::Queue::Submit(const AsyncOp* ops, uint32_t num_ops) {
+  uint32_t i = 0;
+  for (; i < num_ops && num_in_flight_ < depth_; i++) {
+    uint32_t shard = KeyHash::Shard(KeyHash::Hash(ops[i].key));
+    auto& worker = executor_->workers_[shard % executor_->num_workers_];
+    if (!worker.submissions.TryPush({ops[i], this, nullptr})) break;
+    num_in_flight_++;
+  }
+  return i;
+}
+
+uint32_t AsyncExecutor::Queue::Poll(AsyncCompletion* completions,
+                                    uint32_t max_completions) {
+  uint32_t i = 0;
+  for (; i < max_completions && completions_.TryPop(completions + i); i++)
+    ;
+  num_in_flight_ -= i;
+  return i;
+}
+
+PROFILE_NAMESPACE_END
@@ -0,0 +1,166 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_ASYNC_EXECUTOR_H_
+#define TAIR_CONTEST_KV_CONTEST_ASYNC_EXECUTOR_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "common/db.h"
+#include "config.h"
+#include "hot_keys.h"
+#include "key_hash.h"
+#include "logger.h"
+#include "mpmc_queue.h"
+#include "spsc_queue.h"
+#include "subengine.h"
+#include "txn_log.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Runs the operations of the asynchronous api. Shard i belongs to worker
+// i % num_workers(), so the operations of a shard are executed by a single
+// thread, pinned to its own cpu.
+//
+// In shard-owner mode the workers run every operation of the db, one per
+// cpu. A client thread forwards its calls through a queue of its own to
+// every worker and waits for them, so the shards are never shared.
+class AsyncExecutor {
+ public:
+  // async sets invalidate the replicas of hot_keys
+  AsyncExecutor(SubEngine* engines, HotKeyTracker* hot_keys, Logger* logger);
+
+  AsyncQueue* NewQueue(uint32_t depth);
+
+  inline uint32_t num_workers() { return num_workers_; }
+
+#ifdef USE_SHARD_OWNER
+  // version, unless it is nullptr, see SubEngine::Get
+  Status Get(const Slice& key, std::string* value, uint64_t* expiry,
+             uint64_t* version);
+
+  Status Read(const Slice& key, uint64_t offset, char* buf, uint64_t len,
+              uint64_t* read_len);
+
+  Status Set(const Slice& key, const Slice& value, Durability durability,
+             uint64_t expiry);
+
+  Status CompareAndSet(const Slice& key, const Slice& value,
+                       Durability durability, uint64_t* version);
+
+  Status Increment(const Slice& key, int64_t delta, Durability durability,
+                   int64_t* result);
+
+  Status Append(const Slice& key, const Slice& suffix, Durability durability);
+
+  Status PrepareTxn(const Slice& key, const Slice& value, uint64_t txid,
+                    TxnLog::Entry* entry);
+
+  void PublishTxn(const Slice& key, const Slice& value,
+                  const TxnLog::Entry& entry, bool committed);
+#endif
+
+  // completes the operations submitted so far
+  ~AsyncExecutor();
+
+ private:
+  class Queue : public AsyncQueue {
+   public:
+    Queue(AsyncExecutor* executor, uint32_t depth);
+
+    uint32_t Submit(const AsyncOp* ops, uint32_t num_ops);
+
+    uint32_t Poll(AsyncCompletion* completions, uint32_t max_completions);
+
+   private:
+    friend class AsyncExecutor;
+
+    AsyncExecutor* executor_;
+    uint32_t depth_;
+    // only touched by the owner of the queue
+    uint32_t num_in_flight_;
+    MpmcQueue<AsyncCompletion> completions_;
+  };
+
+  // a synchronous operation, the caller waits for done
+  struct Call {
+    enum Type : uint8_t {
+      kGet,
+      kRead,
+      kSet,
+      kCompareAndSet,
+      kIncrement,
+      kAppend,
+      kPrepareTxn,
+      kPublishTxn,
+    };
+
+    Type type;
+    Durability durability;
+    const Slice* key;
+    const Slice* value;
+    std::string* result;
+    // of the value set, or of the value got
+    uint64_t expiry;
+    // of the value got, or expected and set
+    uint64_t* version;
+    int64_t delta;
+    int64_t* number;
+    uint64_t txid;
+    TxnLog::Entry* entry;
+    bool committed;
+    uint64_t offset;
+    char* buf;
+    uint64_t len;
+    uint64_t* read_len;
+    Status status;
+    std::atomic<bool> done;
+  };
+
+  struct Request {
+    AsyncOp op;
+    Queue* queue;
+    // set instead of queue for the calls of threads without a client slot
+    Call* call;
+  };
+
+  struct Worker {
+    Worker() : submissions(ASYNC_SUBMIT_QUEUE_SIZE) {}
+
+    MpmcQueue<Request> submissions;
+    std::thread thread;
+  };
+
+  SubEngine* engines_;
+  HotKeyTracker* hot_keys_;
+  Logger* logger_;
+  uint32_t num_workers_;
+  std::unique_ptr<Worker[]> workers_;
+  std::atomic<bool> stopped_;
+
+#ifdef USE_SHARD_OWNER
+  // a client thread, with a queue to every worker
+  struct Client {
+    explicit Client(uint32_t num_workers);
+
+    std::vector<std::unique_ptr<SpscQueue<Call*>>> inboxes;
+  };
+
+  // tells apart the executors of the dbs a thread has used
+  uint64_t id_;
+  std::atomic<Client*> clients_[OWNER_MAX_CLIENTS];
+  std::atomic<uint32_t> num_clients_;
+
+  Client* ThisClient();
+  Status Forward(Call* call);
+#endif
+
+  void Work(uint32_t id);
+  void Execute(Call* call);
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
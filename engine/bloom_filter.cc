@@ -0,0 +1,12 @@
+#include "bloom_filter.h"
+
+#include <algorithm>
+
+PROFILE_NAMESPACE_BEGIN
+
+BloomFilter::BloomFilter() {
+  auto words = (uint64_t*)blocks_;
+  std::fill(words, words + NUM_BLOCKS * 8, 0);
+}
+
+PROFILE_NAMESPACE_END
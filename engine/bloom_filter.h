@@ -0,0 +1,73 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_BLOOM_FILTER_H_
+#define TAIR_CONTEST_KV_CONTEST_BLOOM_FILTER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "common/db.h"
+#include "config.h"
+#include "shard_atomic.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Blocked Bloom filter of the keys of a shard. All the probes of a key fall
+// in one cache line, so a definite miss costs a single DRAM access and never
+// touches the index or pmem. Keys are never removed from the index, so the
+// filter does not support deletion.
+class BloomFilter {
+ public:
+  BloomFilter();
+
+  inline void Add(const Slice& key) {
+    uint64_t bits;
+    Block& block = Locate(key, &bits);
+    for (uint32_t i = 0; i < BLOOM_NUM_PROBES; i++, bits >>= 9) {
+      auto& word = block.words[(bits >> 6) & 7];
+      uint64_t bit = 1ull << (bits & 63);
+      // plain load first, the bits of a recovered key are often set already
+      if (!(word.load(RE) & bit)) ShardFetchOr(&word, bit);
+    }
+  }
+
+  // false if key has definitely never been added
+  inline bool MayContain(const Slice& key) {
+    uint64_t bits;
+    Block& block = Locate(key, &bits);
+    for (uint32_t i = 0; i < BLOOM_NUM_PROBES; i++, bits >>= 9) {
+      uint64_t bit = 1ull << (bits & 63);
+      if (!(block.words[(bits >> 6) & 7].load(RE) & bit)) return false;
+    }
+    return true;
+  }
+
+ private:
+  struct alignas(64) Block {
+    std::atomic<uint64_t> words[8];
+  };
+
+  static const uint64_t NUM_BLOCKS =
+      (UNIQUE_KEYS_PER_SHARD * BLOOM_BITS_PER_KEY + 511) / 512;
+  static_assert(BLOOM_NUM_PROBES * 9 <= 64, "too many probes for one hash");
+
+  Block blocks_[NUM_BLOCKS];
+
+  static inline uint64_t Mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+  // the block of key, bits receives 9 bits per probe: a word of the block
+  // and a bit of the word
+  inline Block& Locate(const Slice& key, uint64_t* bits) {
+    auto arr = (const uint64_t*)key.data();
+    uint64_t h = Mix(arr[0] ^ Mix(arr[1]));
+    *bits = Mix(h);
+    return blocks_[(uint64_t)(((__uint128_t)h * NUM_BLOCKS) >> 64)];
+  }
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
@@ -0,0 +1,47 @@
+#include "cold_tier.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+ColdTier::ColdTier() : fd_(-1) { size_.store(0, RE); }
+
+bool ColdTier::Open(const std::string& path) {
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd_ < 0) return false;
+
+  struct stat buffer;
+  if (fstat(fd_, &buffer) != 0) return false;
+  // the tail of an interrupted batch is unreferenced, just skip it
+  size_.store(Align<ADDRESS_ALIGN_BITS>(buffer.st_size), RE);
+  return true;
+}
+
+bool ColdTier::Append(const char* data, uint32_t len, uint64_t* offset) {
+  *offset = size_.fetch_add(len, RE);
+  for (uint32_t written = 0; written < len;) {
+    ssize_t ret = pwrite(fd_, data + written, len - written, *offset + written);
+    if (ret <= 0) return false;
+    written += ret;
+  }
+  return fdatasync(fd_) == 0;
+}
+
+bool ColdTier::Read(uint64_t offset, char* buf, uint32_t len) {
+  for (uint32_t read = 0; read < len;) {
+    ssize_t ret = pread(fd_, buf + read, len - read, offset + read);
+    if (ret <= 0) return false;
+    read += ret;
+  }
+  return true;
+}
+
+ColdTier::~ColdTier() {
+  if (fd_ >= 0) close(fd_);
+}
+
+PROFILE_NAMESPACE_END
@@ -0,0 +1,38 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_COLD_TIER_H_
+#define TAIR_CONTEST_KV_CONTEST_COLD_TIER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#include "config.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Append-only file on an ordinary filesystem below the pmem pool. Cold
+// records are demoted to it in batches and stay reachable through stub
+// records in pmem, so the file itself needs no recovery.
+class ColdTier {
+ public:
+  ColdTier();
+
+  bool Open(const std::string& path);
+
+  // writes data durably at the end of the file
+  bool Append(const char* data, uint32_t len, uint64_t* offset);
+
+  bool Read(uint64_t offset, char* buf, uint32_t len);
+
+  inline uint64_t size() { return size_.load(RE); }
+
+  ~ColdTier();
+
+ private:
+  int fd_;
+  std::atomic<uint64_t> size_;
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
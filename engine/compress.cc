@@ -0,0 +1,180 @@
+#include "compress.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "config.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+namespace {
+const uint32_t MIN_MATCH = 4;
+// the last match must start at least 12 bytes before the end of the block
+const uint32_t MF_LIMIT = 12;
+// and the last 5 bytes are always literals
+const uint32_t LAST_LITERALS = 5;
+const uint32_t HASH_BITS = 10;
+const uint32_t MAX_OFFSET = (1 << 16) - 1;
+
+inline uint32_t Read32(const uint8_t* p) {
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+inline uint32_t Hash(uint32_t seq) {
+  return (seq * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// writes the extra length bytes of len, returns false if out of space
+inline bool WriteLength(uint32_t len, uint8_t*& op, const uint8_t* oend) {
+  for (; len >= 255; len -= 255) {
+    if (op >= oend) return false;
+    *op++ = 255;
+  }
+  if (op >= oend) return false;
+  *op++ = len;
+  return true;
+}
+
+inline bool ReadLength(uint32_t& len, const uint8_t*& ip, const uint8_t* iend) {
+  uint8_t b;
+  do {
+    if (ip >= iend) return false;
+    b = *ip++;
+    len += b;
+  } while (b == 255);
+  return true;
+}
+
+bool WriteSequence(const uint8_t* anchor, uint32_t lit_len, uint32_t offset,
+                   uint32_t match_len, uint8_t*& op, const uint8_t* oend) {
+  if (op >= oend) return false;
+  uint8_t* token = op++;
+  *token = std::min(lit_len, 15u) << 4;
+  if (lit_len >= 15 && !WriteLength(lit_len - 15, op, oend)) return false;
+  if (op + lit_len > oend) return false;
+  memcpy(op, anchor, lit_len);
+  op += lit_len;
+
+  // literals only, the last sequence of the block
+  if (match_len == 0) return true;
+
+  if (op + 2 > oend) return false;
+  *op++ = offset & 0xff;
+  *op++ = offset >> 8;
+  match_len -= MIN_MATCH;
+  *token |= std::min(match_len, 15u);
+  if (match_len >= 15 && !WriteLength(match_len - 15, op, oend)) return false;
+  return true;
+}
+}  // namespace
+
+uint32_t LZ4Compress(const char* src, uint32_t src_len, char* dst,
+                     uint32_t dst_cap) {
+  auto base = (const uint8_t*)src;
+  auto ip = base, anchor = base, iend = base + src_len;
+  auto op = (uint8_t*)dst;
+  auto oend = op + dst_cap;
+
+  if (src_len > MF_LIMIT) {
+    uint32_t table[1 << HASH_BITS];
+    std::fill(table, table + (1 << HASH_BITS), ~0u);
+
+    auto mf_limit = iend - MF_LIMIT;
+    auto match_limit = iend - LAST_LITERALS;
+    while (ip < mf_limit) {
+      uint32_t seq = Read32(ip);
+      uint32_t h = Hash(seq);
+      uint32_t ref = table[h];
+      table[h] = ip - base;
+
+      if (ref == ~0u || ip - (base + ref) > MAX_OFFSET ||
+          Read32(base + ref) != seq) {
+        ip++;
+        continue;
+      }
+
+      auto match = base + ref + MIN_MATCH;
+      auto p = ip + MIN_MATCH;
+      while (p < match_limit && *p == *match) p++, match++;
+
+      if (!WriteSequence(anchor, ip - anchor, ip - (base + ref), p - ip, op,
+                         oend)) {
+        return 0;
+      }
+      ip = anchor = p;
+    }
+  }
+
+  if (!WriteSequence(anchor, iend - anchor, 0, 0, op, oend)) return 0;
+  return op - (uint8_t*)dst;
+}
+
+bool LZ4Decompress(const char* src, uint32_t src_len, char* dst,
+                   uint32_t dst_len) {
+  auto ip = (const uint8_t*)src, iend = ip + src_len;
+  auto base = (uint8_t*)dst;
+  auto op = base, oend = base + dst_len;
+
+  while (1) {
+    if (ip >= iend) return false;
+    uint8_t token = *ip++;
+
+    uint32_t lit_len = token >> 4;
+    if (lit_len == 15 && !ReadLength(lit_len, ip, iend)) return false;
+    if (ip + lit_len > iend || op + lit_len > oend) return false;
+    memcpy(op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+    if (op == oend) return true;
+
+    if (ip + 2 > iend) return false;
+    uint32_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (uint32_t)(op - base)) return false;
+
+    uint32_t match_len = token & 15;
+    if (match_len == 15 && !ReadLength(match_len, ip, iend)) return false;
+    match_len += MIN_MATCH;
+    if (op + match_len > oend) return false;
+    // the match may overlap the output, copy byte by byte
+    for (auto match = op - offset; match_len > 0; match_len--) {
+      *op++ = *match++;
+    }
+  }
+}
+
+bool CompressValue(const Slice& value, uint32_t min_len, char* buf,
+                   uint32_t buf_cap, uint32_t* stored_len) {
+  uint32_t raw_len = value.size();
+  if (raw_len < ADDRESS_ALIGN_NUM + sizeof(uint32_t)) return false;
+  uint32_t cap = std::min<uint32_t>(buf_cap, raw_len - ADDRESS_ALIGN_NUM);
+
+  uint32_t len = LZ4Compress(value.data(), raw_len, buf + sizeof(uint32_t),
+                             cap - sizeof(uint32_t));
+  if (len == 0) return false;
+  memcpy(buf, &raw_len, sizeof(uint32_t));
+  len += sizeof(uint32_t);
+
+  if (len < min_len) {
+    memset(buf + len, 0, min_len - len);
+    len = min_len;
+  }
+  if (len + ADDRESS_ALIGN_NUM > raw_len) return false;
+
+  *stored_len = len;
+  return true;
+}
+
+bool DecompressValue(const char* stored, uint32_t stored_len,
+                     std::string* value) {
+  if (stored_len < sizeof(uint32_t)) return false;
+  uint32_t raw_len;
+  memcpy(&raw_len, stored, sizeof(uint32_t));
+  value->resize(raw_len);
+  return LZ4Decompress(stored + sizeof(uint32_t), stored_len - sizeof(uint32_t),
+                       &(*value)[0], raw_len);
+}
+
+PROFILE_NAMESPACE_END
@@ -0,0 +1,35 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_COMPRESS_H_
+#define TAIR_CONTEST_KV_CONTEST_COMPRESS_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "common/db.h"
+#include "config.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Self-contained implementation of the LZ4 block format.
+
+// returns the compressed size, or 0 if it does not fit in dst_cap
+uint32_t LZ4Compress(const char* src, uint32_t src_len, char* dst,
+                     uint32_t dst_cap);
+
+// returns false if src is not a valid block of exactly dst_len bytes
+bool LZ4Decompress(const char* src, uint32_t src_len, char* dst,
+                   uint32_t dst_len);
+
+// Stored layout of a compressed value: the raw length as uint32_t followed by
+// the LZ4 block, zero padded to at least min_len bytes. Returns false (and
+// leaves the value to be stored raw) unless compression saves at least one
+// pmem allocation unit.
+bool CompressValue(const Slice& value, uint32_t min_len, char* buf,
+                   uint32_t buf_cap, uint32_t* stored_len);
+
+bool DecompressValue(const char* stored, uint32_t stored_len,
+                     std::string* value);
+
+PROFILE_NAMESPACE_END
+
+#endif
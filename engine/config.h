@@ -5,46 +5,168 @@
 
 #include <atomic>
 
+#include "common/db.h"
+#include "profiles.h"
+
 #define USE_LOG
+#define USE_GROUP_COMMIT
+#define USE_INLINE_VALUES
+#define USE_TIERING
+#define USE_HUGE_PAGES
+#define USE_PREFAULT
+#define USE_BLOOM_FILTER
+#define USE_XPLINE_PLACEMENT
+#define USE_HOT_REPLICAS
+
+// the build sets USE_SHARD_OWNER, see AsyncExecutor, and USE_EVICTION, with
+// which a full shard evicts records as a cache instead of failing sets with
+// OutOfMemory, see engine/BUILD
+
+// the CLOCK reference bits of the index, for the demoter and the evictor
+#if defined(USE_TIERING) || defined(USE_EVICTION)
+#define USE_REFERENCE_BITS
+#endif
+
+#ifndef ENGINE_PROFILE
+#define ENGINE_PROFILE DEFAULT_ENGINE_PROFILE
+#endif
+
+// everything compiled with this config is part of the namespace of its
+// profile, so that the engines of all profiles can be linked together
+#define PROFILE_NAMESPACE_BEGIN \
+  inline namespace PROFILE_NAMESPACE_NAME(ENGINE_PROFILE) {
+#define PROFILE_NAMESPACE_END }
+
+PROFILE_NAMESPACE_BEGIN
+
+typedef EngineTraits<Profile::ENGINE_PROFILE> Traits;
 
 constexpr std::memory_order RE = std::memory_order_relaxed;
 
-const uint64_t NUM_THREADS = 16;
-const uint64_t KEY_SIZE = 16;
-const uint64_t HASH_P = 199;
+const uint64_t NUM_THREADS = Traits::NUM_THREADS;
+const uint64_t KEY_SIZE = Traits::KEY_SIZE;
 const uint64_t TAG_MASK = (1 << 8) - 1;
 
-const uint32_t NUM_SHARDS = 64;
+const uint32_t NUM_SHARDS = Traits::NUM_SHARDS;
 const uint8_t SHARD_HASH_MASK = NUM_SHARDS - 1;
 static_assert((NUM_SHARDS & (-NUM_SHARDS)) == NUM_SHARDS,
               "NUM_SHARDS should be 2^n");
 
-#ifdef LOCAL_DEBUG
-const uint64_t PMEM_SIZE = 16 * (1 << 20);
-const uint64_t NUM_KEYS = NUM_THREADS * 1000;
-const uint64_t LOG_FREQ = 1;
-#else
-const uint64_t PMEM_SIZE = 64ull * (1ull << 30);
-const uint64_t NUM_KEYS = NUM_THREADS * 24 * (1 << 20);
-const uint64_t LOG_FREQ = 1 << 20;
-#endif
+const uint64_t PMEM_SIZE = Traits::PMEM_SIZE;
+const uint64_t NUM_KEYS = Traits::NUM_KEYS;
+const uint64_t LOG_FREQ = Traits::LOG_FREQ;
+const uint64_t INLINE_SLAB_SIZE_PER_SHARD = Traits::INLINE_SLAB_SIZE_PER_SHARD;
+const uint32_t TIER_BATCH_SIZE = Traits::TIER_BATCH_SIZE;
+// the pool is zeroed lazily, in chunks of 1 << POOL_CHUNK_BITS bytes
+const uint32_t POOL_CHUNK_BITS = Traits::POOL_CHUNK_BITS;
 
-const double UNIQUE_KEYS_RATIO = 0.6;
+const double UNIQUE_KEYS_RATIO = Traits::UNIQUE_KEYS_RATIO;
 
 const uint64_t KEYS_PER_SHARD = NUM_KEYS / NUM_SHARDS;
 const uint64_t UNIQUE_KEYS_PER_SHARD = KEYS_PER_SHARD * UNIQUE_KEYS_RATIO;
-const uint64_t PMEM_SIZE_PER_SHARD = PMEM_SIZE / NUM_SHARDS;
 
 const uint64_t GC_POOL_SIZE_PER_SHARD = UNIQUE_KEYS_PER_SHARD;
 const uint64_t NUM_BUCKETS_PER_SHARD = KEYS_PER_SHARD;
 
+const uint32_t INLINE_VALUE_MAX_LEN = 128;
+// about 3% of false positives with 8 bits and 6 probes per key
+const uint32_t BLOOM_BITS_PER_KEY = 8;
+const uint32_t BLOOM_NUM_PROBES = 6;
+const uint32_t NUM_COMBINERS_PER_SHARD = 64;
+// the chain lengths logged at close are those of the first buckets of every
+// shard, chains of INDEX_STATS_MAX_CHAIN keys or more are counted together
+const uint32_t INDEX_STATS_SAMPLE_BUCKETS = 1 << 16;
+const uint32_t INDEX_STATS_MAX_CHAIN = 8;
+// about one in HOT_SAMPLE_PERIOD gets and sets is counted by the hot-key
+// sketch of its thread, which is merged into the shared one every
+// HOT_MERGE_SAMPLES samples. The shared counts are halved every
+// HOT_WINDOW_SAMPLES samples
+const uint32_t HOT_SAMPLE_PERIOD = 16;
+const uint32_t HOT_MERGE_SAMPLES = 256;
+const uint64_t HOT_WINDOW_SAMPLES = 1 << 14;
+// counters of a Space-Saving sketch
+const uint32_t HOT_SKETCH_SIZE = 64;
+// a key is hot once it makes 1 / HOT_MIN_SHARE of the samples
+const uint32_t HOT_MIN_SHARE = 64;
+// hot keys with read replicas, and the longest value replicated
+const uint32_t HOT_TABLE_SIZE = 16;
+const uint32_t HOT_REPLICA_MAX_LEN = 1 << 10;
+
 const uint32_t ADDRESS_ALIGN_BITS = 6;
 const uint32_t ADDRESS_ALIGN_NUM = (1 << ADDRESS_ALIGN_BITS);
 
-const uint64_t SHRINK_CKPT = 220200960 / NUM_SHARDS;
+const uint32_t MAX_VALUE_LEN = 1 << 16;
+// values of at least LARGE_VALUE_MIN_LEN bytes are stored in extents
+const uint32_t LARGE_VALUE_MIN_LEN = 4 * (1 << 10);
+const uint32_t MAX_LARGE_VALUE_LEN = 1 << 20;
+const uint32_t LARGE_BLOCK_BITS = 12;
+const uint32_t MAX_EXTENT_SIZE = 64 * (1 << 10);
+// how far above the requested size shrink mode looks for a free range
+const uint32_t SHRINK_SEARCH_RANGE = 1 << 10;
+// the end of the records of a shard kept for the tombstones and stubs that
+// make room in a full shard, see PmemAllocator::Allocate
+const uint32_t PMEM_RESERVE_SIZE = 8 * (1 << 10);
+
+const uint64_t SHRINK_CKPT = Traits::SHRINK_CKPT / NUM_SHARDS;
 const uint64_t RW_HYBRID_CKPT = NUM_KEYS / NUM_SHARDS;
 
-const uint8_t PMEM_RECORD_HEAD = 1;
+const Durability DEFAULT_DURABILITY = kPersist;
+const uint64_t FLUSH_INTERVAL_US = 100;
+const uint64_t FLUSH_QUEUE_SIZE = 1 << 16;
+
+const uint32_t COMPRESS_MIN_VALUE_LEN = 129;
+
+// cold records are demoted while less than this ratio of a shard is free
+const double TIER_MIN_FREE_RATIO = 0.25;
+const uint64_t TIER_INTERVAL_US = 1000;
+// #entries the clock hand visits per round
+const uint32_t TIER_SCAN_LEN = 1 << 12;
+
+// the expiry wheel of a shard turns a slot every EXPIRY_TICK_MS, see
+// ExpiryWheel. Every EXPIRY_INTERVAL_US the sweeper reclaims up to
+// EXPIRY_BATCH_SIZE expired records per shard
+const uint64_t EXPIRY_TICK_MS = 100;
+const uint32_t EXPIRY_WHEEL_SLOTS = 512;
+const uint64_t EXPIRY_INTERVAL_US = 1000;
+const uint32_t EXPIRY_BATCH_SIZE = 256;
+
+// a round of eviction takes up to EVICTION_BATCH_SIZE records from a full
+// shard, fewer once they free EVICTION_ROUND_SIZE bytes. A set gives up with
+// OutOfMemory after EVICTION_MAX_ROUNDS rounds
+const uint32_t EVICTION_BATCH_SIZE = 64;
+const uint32_t EVICTION_ROUND_SIZE = 16 * (1 << 10);
+const uint32_t EVICTION_MAX_ROUNDS = 8;
+
+const uint32_t ASYNC_NUM_WORKERS = 4;
+const uint64_t ASYNC_SUBMIT_QUEUE_SIZE = 1 << 12;
+// an idle worker yields ASYNC_SPIN_COUNT times before it starts sleeping
+const uint32_t ASYNC_SPIN_COUNT = 1 << 10;
+const uint64_t ASYNC_IDLE_US = 20;
+// client threads with queues of their own in shard-owner mode, the others
+// share the submission queues of the workers
+const uint32_t OWNER_MAX_CLIENTS = 256;
+
+// 21 for pages of 2 MiB, 30 for pages of 1 GiB
+const uint32_t HUGE_PAGE_BITS = 21;
+const uint64_t HUGE_PAGE_SIZE = 1ull << HUGE_PAGE_BITS;
+
+const uint32_t POOL_FORMAT_VERSION = 7;
+const uint64_t POOL_HEADER_SIZE = 2 * (1 << 20);
+// the commit log of the transactions, see TxnLog, lies in the pool header
+// at TXN_LOG_OFFSET, with a slot per transaction in flight. A transaction
+// sets up to TXN_MAX_KEYS keys, whose records are TXN_TIMESTAMP_GAP newer
+// than those they replace, so that they are rarely outrun by the sets of
+// their keys racing with the transaction
+const uint64_t TXN_LOG_OFFSET = 1 << 20;
+const uint32_t TXN_LOG_SLOTS = 256;
+const uint32_t TXN_MAX_KEYS = 15;
+const uint64_t TXN_TIMESTAMP_GAP = 16;
+
+const uint8_t PMEM_RECORD_V1_HEAD = 1;
+const uint8_t PMEM_RECORD_V1_COMPRESSED_HEAD = 2;
+const uint8_t PMEM_RECORD_HEAD = 3;
 const uint32_t RECOVER_MAX_BLANK_SIZE = 4 * (1 << 10);
 
+PROFILE_NAMESPACE_END
+
 #endif
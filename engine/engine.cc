@@ -1,36 +1,135 @@
 #include "engine.h"
 
-#include <libpmem.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include <chrono>
 #include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <mutex>
+#include <new>
 #include <tuple>
+#include <unordered_map>
+#include <vector>
 
+#include "compress.h"
 #include "config.h"
+#include "persist.h"
+#include "utils.h"
 
-Status DB::CreateOrOpen(const std::string& name, DB** dbptr, FILE* log_file) {
-  return Engine::CreateOrOpen(name, dbptr, log_file);
+PROFILE_NAMESPACE_BEGIN
+
+namespace {
+// how the last engine has been placed, logged once it has a logger
+PageKind engine_page_kind = kSmallPages;
+double engine_prefault_seconds = 0;
+
+double SecondsSince(const std::chrono::steady_clock::time_point& from) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - from)
+             .count() /
+         1e6;
 }
+}  // namespace
 
-DB::~DB() {}
+Status OpenEngine(const std::string& name, DB** dbptr, FILE* log_file) {
+  return Engine::CreateOrOpen(name, dbptr, log_file);
+}
 
 Status Engine::CreateOrOpen(const std::string& name, DB** dbptr,
                             FILE* log_file) {
-  *dbptr = new Engine(name, log_file);
+  auto engine = new Engine(log_file);
+  Status status = engine->Open(name);
+  if (status != Ok) {
+    delete engine;
+    return status;
+  }
+  *dbptr = engine;
   return Ok;
 }
 
-Engine::Engine(const std::string& name, FILE* log_file) {
+void* Engine::operator new(size_t size) {
+  void* ptr;
+#ifdef USE_HUGE_PAGES
+  ptr = MapHugeDram(size, &engine_page_kind);
+  if (ptr == nullptr) throw std::bad_alloc();
+#else
+  engine_page_kind = kSmallPages;
+  if (posix_memalign(&ptr, alignof(Engine), size) != 0) throw std::bad_alloc();
+#endif
+
+#ifdef USE_PREFAULT
+  auto start = std::chrono::steady_clock::now();
+  Prefault((char*)ptr, size, NUM_THREADS, true);
+  engine_prefault_seconds = SecondsSince(start);
+#endif
+  return ptr;
+}
+
+void Engine::operator delete(void* ptr, size_t size) {
+#ifdef USE_HUGE_PAGES
+  UnmapHugeDram(ptr, size);
+#else
+  free(ptr);
+#endif
+}
+
+Engine::Engine(FILE* log_file) : pmem_base_(nullptr) {
   logger_.reset(new Logger(log_file));
   logger_->LogWithTime("Engine::Engine()");
+  logger_->Log("profile %s, %u shards", Traits::Name(), NUM_SHARDS);
+  logger_->Log("%.1lfM of index on %s, prefaulted in %.3lf seconds",
+               1.0 * sizeof(Engine) / (1 << 20),
+               PageKindName(engine_page_kind), engine_prefault_seconds);
+  closed_.store(false, RE);
+}
+
+Status Engine::Open(const std::string& name) {
   pmem_base_ = InitializeDB(name);
+  if (pmem_base_ == nullptr) {
+    logger_->LogWithTime("failed to map db file at \"%s\"", name.c_str());
+    return IOError;
+  }
   logger_->LogWithTime("db file at \"%s\" has been opened", name.c_str());
 
-  for (uint32_t i = 0; i < NUM_SHARDS; i++) {
-    engines_[i].Init(i, pmem_base_ + PMEM_SIZE_PER_SHARD * i, logger_.get());
+  // stub records may point to the cold tier even if tiering is disabled
+  if (!cold_tier_.Open(name + ".cold")) {
+    logger_->LogWithTime("failed to open the cold tier of \"%s\"",
+                         name.c_str());
+    return IOError;
   }
 
+  switch (((PoolHeader*)pmem_base_)->format()) {
+    case PoolHeader::kCurrent: {
+      InitShards();
+      break;
+    }
+    case PoolHeader::kLegacy: {
+      Status status = MigrateFromV1(name);
+      if (status != Ok) return status;
+      break;
+    }
+    default:
+    case PoolHeader::kUnknown: {
+      logger_->LogWithTime("db file at \"%s\" has an unknown format",
+                           name.c_str());
+      return IOError;
+    }
+  }
+
+  flusher_thread_ = std::thread(&Engine::FlushPeriodically, this);
+#ifdef USE_SHARD_OWNER
+  // the owners serve every operation, and demote and expire their own
+  // shards
+  StartExecutor();
+#else
+#ifdef USE_TIERING
+  tier_thread_ = std::thread(&Engine::DemotePeriodically, this);
+#endif
+  expiry_thread_ = std::thread(&Engine::ExpirePeriodically, this);
+#endif
+
   logger_->Log("sizeof(PmemRecord) = %d", sizeof(PmemRecord));
   logger_->Log("sizeof(MemRecord) = %d", sizeof(MemRecord));
   logger_->Log("is_pmem = %s", is_pmem_ ? "true" : "false");
@@ -39,39 +138,447 @@ Engine::Engine(const std::string& name, FILE* log_file) {
   logger_->Log("pmem_has_hw_drain = %s",
                pmem_has_hw_drain() ? "true" : "false");
   logger_->Flush();
+  return Ok;
+}
+
+void Engine::InitShards() {
+  auto header = (PoolHeader*)pmem_base_;
+  logger_->Log("pool_size = %llu, shard_size = %llu", header->pool_size,
+               header->shard_size);
+  // the shards discard the records of the transactions that have not
+  // committed
+  txn_log_.Recover(pmem_base_ + TXN_LOG_OFFSET, header);
+  for (uint32_t i = 0; i < NUM_SHARDS; i++) {
+    engines_[i].Init(i, header->shard_base(i), header->shard_size,
+                     header->large_region_sizes + i,
+                     header->high_water_marks + i, logger_.get(), &flusher_,
+                     &cold_tier_, &txn_log_);
+  }
 }
 
 Status Engine::Get(const Slice& key, std::string* value) {
-  uint32_t idx = key.data()[0] & SHARD_HASH_MASK;
-  return engines_[idx].Get(key, value);
+  hot_keys_.Sample(key);
+#ifdef USE_HOT_REPLICAS
+  uint64_t version;
+  if (hot_keys_.ReadReplica(key, value, &version)) return Ok;
+#endif
+  uint64_t expiry;
+#ifdef USE_SHARD_OWNER
+  Status status = executor_->Get(key, value, &expiry, nullptr);
+#else
+  uint32_t idx = KeyHash::Shard(KeyHash::Hash(key));
+  Status status = engines_[idx].Get(key, value, &expiry);
+#endif
+#ifdef USE_HOT_REPLICAS
+  if (status == Ok && version != 0) {
+    hot_keys_.WriteReplica(key, *value, expiry, version);
+  }
+#endif
+  return status;
+}
+
+Status Engine::Get(const Slice& key, std::string* value, uint64_t* version) {
+  hot_keys_.Sample(key);
+  // never served by a replica, which does not tell its version
+  uint64_t expiry;
+#ifdef USE_SHARD_OWNER
+  return executor_->Get(key, value, &expiry, version);
+#else
+  uint32_t idx = KeyHash::Shard(KeyHash::Hash(key));
+  return engines_[idx].Get(key, value, &expiry, version);
+#endif
+}
+
+Status Engine::Read(const Slice& key, uint64_t offset, char* buf,
+                    uint64_t len, uint64_t* read_len) {
+#ifdef USE_SHARD_OWNER
+  return executor_->Read(key, offset, buf, len, read_len);
+#else
+  uint32_t idx = KeyHash::Shard(KeyHash::Hash(key));
+  return engines_[idx].Read(key, offset, buf, len, read_len);
+#endif
 }
 
 Status Engine::Set(const Slice& key, const Slice& value) {
-  uint32_t idx = key.data()[0] & SHARD_HASH_MASK;
-  return engines_[idx].Set(key, value);
+  return Set(key, value, DEFAULT_DURABILITY);
+}
+
+Status Engine::Set(const Slice& key, const Slice& value,
+                   Durability durability) {
+  return Set(key, value, durability, 0);
+}
+
+Status Engine::Set(const Slice& key, const Slice& value,
+                   Durability durability, uint64_t ttl_ms) {
+  uint64_t expiry = ttl_ms == 0 ? 0 : WallClockMs() + ttl_ms;
+  hot_keys_.Sample(key);
+#ifdef USE_SHARD_OWNER
+  Status status = executor_->Set(key, value, durability, expiry);
+#else
+  uint32_t idx = KeyHash::Shard(KeyHash::Hash(key));
+  Status status = engines_[idx].Set(key, value, durability, expiry);
+#endif
+#ifdef USE_HOT_REPLICAS
+  hot_keys_.Invalidate(key);
+#endif
+  return status;
+}
+
+Status Engine::CompareAndSet(const Slice& key, uint64_t expected_version,
+                             const Slice& value, uint64_t* version) {
+  hot_keys_.Sample(key);
+  *version = expected_version;
+#ifdef USE_SHARD_OWNER
+  Status status = executor_->CompareAndSet(key, value, DEFAULT_DURABILITY,
+                                           version);
+#else
+  uint32_t idx = KeyHash::Shard(KeyHash::Hash(key));
+  Status status =
+      engines_[idx].CompareAndSet(key, value, DEFAULT_DURABILITY, 0, version);
+#endif
+#ifdef USE_HOT_REPLICAS
+  hot_keys_.Invalidate(key);
+#endif
+  return status;
+}
+
+Status Engine::Increment(const Slice& key, int64_t delta, int64_t* result) {
+  hot_keys_.Sample(key);
+#ifdef USE_SHARD_OWNER
+  Status status =
+      executor_->Increment(key, delta, DEFAULT_DURABILITY, result);
+#else
+  uint32_t idx = KeyHash::Shard(KeyHash::Hash(key));
+  Status status =
+      engines_[idx].Increment(key, delta, DEFAULT_DURABILITY, result);
+#endif
+#ifdef USE_HOT_REPLICAS
+  hot_keys_.Invalidate(key);
+#endif
+  return status;
+}
+
+Status Engine::Append(const Slice& key, const Slice& suffix) {
+  hot_keys_.Sample(key);
+#ifdef USE_SHARD_OWNER
+  Status status = executor_->Append(key, suffix, DEFAULT_DURABILITY);
+#else
+  uint32_t idx = KeyHash::Shard(KeyHash::Hash(key));
+  Status status = engines_[idx].Append(key, suffix, DEFAULT_DURABILITY);
+#endif
+#ifdef USE_HOT_REPLICAS
+  hot_keys_.Invalidate(key);
+#endif
+  return status;
+}
+
+Status Engine::MultiSet(const Slice* keys, const Slice* values,
+                        uint32_t num_keys) {
+  if (num_keys > TXN_MAX_KEYS) {
+    return IOError;
+  }
+  // a key given more than once is set to its last value
+  uint32_t order[TXN_MAX_KEYS];
+  uint32_t num_unique = 0;
+  for (uint32_t i = 0; i < num_keys; i++) {
+    bool repeated = false;
+    for (uint32_t j = i + 1; j < num_keys && !repeated; j++) {
+      repeated = keys[i].size() == keys[j].size() &&
+                 memcmp(keys[i].data(), keys[j].data(), keys[i].size()) == 0;
+    }
+    if (!repeated) order[num_unique++] = i;
+  }
+
+  uint64_t txid = txn_log_.Begin();
+  TxnLog::Entry entries[TXN_MAX_KEYS];
+  uint32_t num_prepared = 0;
+  Status status = Ok;
+  for (; num_prepared < num_unique; num_prepared++) {
+    auto& key = keys[order[num_prepared]];
+    auto& value = values[order[num_prepared]];
+    hot_keys_.Sample(key);
+#ifdef USE_SHARD_OWNER
+    status = executor_->PrepareTxn(key, value, txid, entries + num_prepared);
+#else
+    uint32_t idx = KeyHash::Shard(KeyHash::Hash(key));
+    status = engines_[idx].PrepareTxn(key, value, txid, entries + num_prepared);
+#endif
+    if (status != Ok) break;
+  }
+  bool committed = status == Ok;
+  if (committed) {
+    txn_log_.Commit(txid, entries, num_prepared);
+  }
+
+  // the keys are published one by one, a reader may see some of them set
+  // before the others
+  for (uint32_t i = 0; i < num_prepared; i++) {
+    auto& key = keys[order[i]];
+    auto& value = values[order[i]];
+#ifdef USE_SHARD_OWNER
+    executor_->PublishTxn(key, value, entries[i], committed);
+#else
+    engines_[entries[i].shard].PublishTxn(key, value, entries[i], committed);
+#endif
+#ifdef USE_HOT_REPLICAS
+    hot_keys_.Invalidate(key);
+#endif
+  }
+  if (!committed) {
+    txn_log_.Abort(txid);
+  }
+  return status;
+}
+
+AsyncQueue* Engine::NewAsyncQueue(uint32_t depth) {
+  StartExecutor();
+  return executor_->NewQueue(depth);
 }
 
-Engine::~Engine() { pmem_unmap(pmem_base_, mapped_len_); }
+void Engine::HotKeys(uint32_t max_keys, std::vector<std::string>* keys) {
+  hot_keys_.Top(max_keys, keys);
+}
+
+void Engine::StartExecutor() {
+  std::call_once(executor_flag_, [this]() {
+    executor_.reset(
+        new AsyncExecutor(engines_, &hot_keys_, logger_.get()));
+  });
+}
+
+Engine::~Engine() {
+  executor_.reset();
+  closed_.store(true, RE);
+#ifdef USE_TIERING
+  if (tier_thread_.joinable()) {
+    tier_thread_.join();
+  }
+#endif
+  if (expiry_thread_.joinable()) {
+    expiry_thread_.join();
+  }
+  if (flusher_thread_.joinable()) {
+    flusher_thread_.join();
+  }
+  if (pmem_base_ != nullptr) {
+    flusher_.Flush();
+    PmemUnmap(pmem_base_, mapped_len_);
+
+    uint64_t num_get_misses = 0;
+    uint64_t num_false_positives = 0;
+    uint64_t num_expired = 0;
+    uint64_t num_evicted = 0;
+    uint64_t num_out_of_memory = 0;
+    for (uint32_t i = 0; i < NUM_SHARDS; i++) {
+      num_get_misses += engines_[i].num_get_misses();
+      num_false_positives += engines_[i].num_filter_false_positives();
+      num_expired += engines_[i].num_expired();
+      num_evicted += engines_[i].num_evicted();
+      num_out_of_memory += engines_[i].num_out_of_memory();
+    }
+    logger_->Log(
+        "#get_misses = %llu, #filter_false_positives = %llu, #expired = %llu, "
+        "#evicted = %llu, #out_of_memory = %llu",
+        num_get_misses, num_false_positives, num_expired, num_evicted,
+        num_out_of_memory);
+    LogIndexDistribution();
+    logger_->Log("%u hot keys replicated, #replica_hits = %llu",
+                 hot_keys_.num_hot_slots(), hot_keys_.num_replica_hits());
+    // the media writes whole XPLines, however little of them is flushed
+    uint64_t bytes_flushed = flusher_.bytes_flushed();
+    uint64_t media_bytes = flusher_.xplines_flushed() * XPLINE_SIZE;
+    logger_->Log(
+        "flushed %llu bytes of records in %llu bytes of XPLines, write "
+        "amplification = %.2lf",
+        bytes_flushed, media_bytes,
+        bytes_flushed == 0 ? 0.0 : 1.0 * media_bytes / bytes_flushed);
+  }
+}
+
+void Engine::LogIndexDistribution() {
+  std::vector<uint64_t> chains(INDEX_STATS_MAX_CHAIN + 1, 0);
+  uint64_t min_keys = UINT64_MAX, max_keys = 0, num_keys = 0;
+  for (uint32_t i = 0; i < NUM_SHARDS; i++) {
+    engines_[i].hash_index()->CountChainLengths(INDEX_STATS_SAMPLE_BUCKETS,
+                                                &chains);
+    uint64_t n = engines_[i].hash_index()->num_unique_keys();
+    min_keys = std::min(min_keys, n);
+    max_keys = std::max(max_keys, n);
+    num_keys += n;
+  }
+  std::string line;
+  char buf[32];
+  for (uint32_t len = 0; len <= INDEX_STATS_MAX_CHAIN; len++) {
+    snprintf(buf, sizeof(buf), " %u%s: %llu", len,
+             len == INDEX_STATS_MAX_CHAIN ? "+" : "",
+             (unsigned long long)chains[len]);
+    line += buf;
+  }
+  logger_->Log("chain lengths of sampled buckets:%s", line.c_str());
+
+  // keys per shard, in tenths of the mean
+  if (num_keys == 0) return;
+  double mean = 1.0 * num_keys / NUM_SHARDS;
+  std::vector<uint32_t> loads(21, 0);
+  for (uint32_t i = 0; i < NUM_SHARDS; i++) {
+    double ratio = engines_[i].hash_index()->num_unique_keys() / mean;
+    loads[std::min<uint32_t>(ratio * 10 + 0.5, loads.size() - 1)]++;
+  }
+  line.clear();
+  for (uint32_t i = 0; i < loads.size(); i++) {
+    if (loads[i] == 0) continue;
+    snprintf(buf, sizeof(buf), " %.1lf%s: %u", i / 10.0,
+             i + 1 == loads.size() ? "+" : "", loads[i]);
+    line += buf;
+  }
+  logger_->Log("keys per shard: min = %llu, mean = %.1lf, max = %llu, "
+               "shards by load relative to the mean:%s",
+               min_keys, mean, max_keys, line.c_str());
+}
+
+void Engine::FlushPeriodically() {
+  while (!closed_.load(RE)) {
+    usleep(FLUSH_INTERVAL_US);
+    flusher_.Flush();
+  }
+}
+
+#ifdef USE_TIERING
+void Engine::DemotePeriodically() {
+  while (!closed_.load(RE)) {
+    usleep(TIER_INTERVAL_US);
+    for (uint32_t i = 0; i < NUM_SHARDS && !closed_.load(RE); i++) {
+      engines_[i].Demote();
+    }
+  }
+}
+#endif
+
+void Engine::ExpirePeriodically() {
+  while (!closed_.load(RE)) {
+    usleep(EXPIRY_INTERVAL_US);
+    uint64_t now = WallClockMs();
+    for (uint32_t i = 0; i < NUM_SHARDS && !closed_.load(RE); i++) {
+      engines_[i].Expire(now);
+    }
+  }
+}
 
 char* Engine::InitializeDB(const std::string& path) {
   struct stat buffer;
   bool exist = stat(path.c_str(), &buffer) == 0;
 
-  auto ptr = (char*)pmem_map_file(path.c_str(), PMEM_SIZE, PMEM_FILE_CREATE,
-                                  0666, &mapped_len_, &is_pmem_);
-  if (exist) return ptr;
+  // pmem_map_file aligns DAX mappings for huge pages already, the advice
+  // is for pools on page-cache backed files
+  if (exist) {
+    auto ptr = PmemMapFile(path.c_str(), 0, 0, 0, &mapped_len_, &is_pmem_);
+    if (ptr == nullptr) return nullptr;
+#ifdef USE_HUGE_PAGES
+    AdviseHugePages(ptr, mapped_len_);
+#endif
+#ifdef USE_PREFAULT
+    // recovery and the first operations would fault the pool in one by one
+    auto start = std::chrono::steady_clock::now();
+    Prefault(ptr, mapped_len_, NUM_THREADS, false);
+    logger_->LogWithTime("the pool has been prefaulted in %.3lf seconds",
+                         SecondsSince(start));
+#endif
+    return ptr;
+  }
+
+  // a new pool starts with an empty cold tier
+  remove((path + ".cold").c_str());
 
-  // initialize as 0
-  uint64_t size_per_thread = PMEM_SIZE / NUM_THREADS;
-  static_assert(PMEM_SIZE % NUM_THREADS == 0,
-                "workload should be evenly distributed");
-  for (uint32_t i = 0; i < NUM_THREADS; i++) {
-    threads_[i] = std::thread(
-        [](char* ptr, uint64_t size) { pmem_memset_persist(ptr, 0, size); },
-        ptr + size_per_thread * i, size_per_thread);
+  auto ptr = PmemMapFile(path.c_str(), PMEM_SIZE, PMEM_FILE_CREATE, 0666,
+                         &mapped_len_, &is_pmem_);
+  if (ptr == nullptr) return nullptr;
+#ifdef USE_HUGE_PAGES
+  AdviseHugePages(ptr, mapped_len_);
+#endif
+
+  // the shards are zeroed lazily, up to their high-water marks
+  PoolHeader::Create(ptr, mapped_len_);
+  return ptr;
+}
+
+Status Engine::MigrateFromV1(const std::string& name) {
+  logger_->LogWithTime("migrating v1 db file at \"%s\"", name.c_str());
+
+  char* legacy_base = pmem_base_;
+  uint64_t legacy_len = mapped_len_;
+
+  // the v1 file is only replaced once the new one is complete
+  std::string path = name + ".migrating";
+  remove(path.c_str());
+  pmem_base_ = InitializeDB(path);
+  if (pmem_base_ == nullptr) {
+    PmemUnmap(legacy_base, legacy_len);
+    return IOError;
   }
-  for (uint32_t i = 0; i < NUM_THREADS; i++) {
-    threads_[i].join();
+  InitShards();
+
+  uint64_t legacy_shard_size = legacy_len / NUM_SHARDS;
+  uint64_t num_records = 0;
+  for (uint32_t i = 0; i < NUM_SHARDS; i++) {
+    num_records += MigrateShardFromV1(legacy_base + legacy_shard_size * i,
+                                      legacy_shard_size);
   }
-  return ptr;
-}
\ No newline at end of file
+  flusher_.Flush();
+  PmemUnmap(legacy_base, legacy_len);
+
+  if (rename(path.c_str(), name.c_str()) != 0) {
+    return IOError;
+  }
+  logger_->LogWithTime("%llu records have been migrated", num_records);
+  return Ok;
+}
+
+uint64_t Engine::MigrateShardFromV1(char* pmem_base, uint64_t pmem_size) {
+  // the latest record of every key, resolved as the v1 recovery did
+  std::unordered_map<std::string, PmemRecordV1*> latest;
+
+  int64_t last_zero_ptr = -1;
+  for (uint64_t ptr = 0; ptr < pmem_size; ptr++) {
+    if (pmem_base[ptr] == 0 && last_zero_ptr < 0) {
+      last_zero_ptr = ptr;
+    } else if (pmem_base[ptr] != 0) {
+      last_zero_ptr = -1;
+    }
+    if (last_zero_ptr >= 0 &&
+        ptr > (uint64_t)last_zero_ptr + RECOVER_MAX_BLANK_SIZE) {
+      break;
+    }
+
+    auto pmem_record = (PmemRecordV1*)(pmem_base + ptr);
+    if (ptr + pmem_record->record_size() <= pmem_size &&
+        pmem_record->Intact()) {
+      std::string key(pmem_record->key, KEY_SIZE);
+      auto it = latest.find(key);
+      if (it == latest.end()) {
+        latest[key] = pmem_record;
+      } else if (it->second->timestamp < pmem_record->timestamp) {
+        it->second = pmem_record;
+      }
+    }
+  }
+
+  std::string value;
+  for (auto& kv : latest) {
+    auto pmem_record = kv.second;
+    if (pmem_record->compressed()) {
+      if (!DecompressValue(pmem_record->value, pmem_record->value_len(),
+                           &value)) {
+        continue;
+      }
+    } else {
+      value.assign(pmem_record->value, pmem_record->value_len());
+    }
+    // the shards are written directly, no owner is running yet
+    Slice key((char*)kv.first.data(), KEY_SIZE);
+    engines_[KeyHash::Shard(KeyHash::Hash(key))].Set(
+        key, Slice((char*)value.data(), value.size()), kFlushAsync, 0);
+  }
+  return latest.size();
+}
+
+PROFILE_NAMESPACE_END
@@ -5,37 +5,110 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <thread>
 
+#include "async_executor.h"
+#include "cold_tier.h"
+#include "flusher.h"
 #include "hash_index.h"
+#include "hot_keys.h"
+#include "huge_pages.h"
+#include "key_hash.h"
 #include "logger.h"
 #include "pmem_allocator.h"
+#include "pool_header.h"
 #include "subengine.h"
+#include "txn_log.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// entry point of the engine of this profile, see DB::CreateOrOpen
+Status OpenEngine(const std::string& name, DB** dbptr, FILE* log_file);
 
 class Engine : DB {
  public:
   static Status CreateOrOpen(const std::string& name, DB** dbptr,
                              FILE* log_file);
 
-  Engine(const std::string& name, FILE* log_file);
+  explicit Engine(FILE* log_file);
+
+  Status Open(const std::string& name);
 
   Status Get(const Slice& key, std::string* value);
 
+  Status Get(const Slice& key, std::string* value, uint64_t* version);
+
+  Status Read(const Slice& key, uint64_t offset, char* buf, uint64_t len,
+              uint64_t* read_len);
+
   Status Set(const Slice& key, const Slice& value);
 
+  Status Set(const Slice& key, const Slice& value, Durability durability);
+
+  Status Set(const Slice& key, const Slice& value, Durability durability,
+             uint64_t ttl_ms);
+
+  Status CompareAndSet(const Slice& key, uint64_t expected_version,
+                       const Slice& value, uint64_t* version);
+
+  Status Increment(const Slice& key, int64_t delta, int64_t* result);
+
+  Status Append(const Slice& key, const Slice& suffix);
+
+  Status MultiSet(const Slice* keys, const Slice* values, uint32_t num_keys);
+
+  AsyncQueue* NewAsyncQueue(uint32_t depth);
+
+  void HotKeys(uint32_t max_keys, std::vector<std::string>* keys);
+
   ~Engine();
 
+  // the index of every shard is part of the engine, which is placed on huge
+  // pages and prefaulted, see USE_HUGE_PAGES and USE_PREFAULT
+  static void* operator new(size_t size);
+
+  static void operator delete(void* ptr, size_t size);
+
  private:
   std::unique_ptr<Logger> logger_;
   char* pmem_base_;
   uint64_t mapped_len_;
   int is_pmem_;
   PmemRecord* pmem_records_;
-  std::thread threads_[NUM_THREADS];
+
+  Flusher flusher_;
+  std::thread flusher_thread_;
+  std::atomic<bool> closed_;
+
+  ColdTier cold_tier_;
+#ifdef USE_TIERING
+  std::thread tier_thread_;
+#endif
+  std::thread expiry_thread_;
 
   SubEngine engines_[NUM_SHARDS];
+  TxnLog txn_log_;
+  HotKeyTracker hot_keys_;
+
+  // started with the first async queue, or by Open in shard-owner mode
+  std::unique_ptr<AsyncExecutor> executor_;
+  std::once_flag executor_flag_;
 
   char* InitializeDB(const std::string& path);
+  void InitShards();
+  // histograms of the chain lengths and of the keys per shard
+  void LogIndexDistribution();
+  Status MigrateFromV1(const std::string& name);
+  uint64_t MigrateShardFromV1(char* pmem_base, uint64_t pmem_size);
+  void StartExecutor();
+  void FlushPeriodically();
+#ifdef USE_TIERING
+  void DemotePeriodically();
+#endif
+  void ExpirePeriodically();
 };
 
+PROFILE_NAMESPACE_END
+
 #endif
@@ -0,0 +1,54 @@
+#include "expiry_wheel.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include "utils.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+ExpiryWheel::ExpiryWheel() : cursor_(WallClockMs() / EXPIRY_TICK_MS) {}
+
+void ExpiryWheel::Add(uint32_t idx, uint64_t expiry) {
+  // an entry due before the cursor is swept with the next slot
+  uint64_t tick = std::max(expiry / EXPIRY_TICK_MS, cursor_.load(RE));
+  auto& slot = slots_[tick % EXPIRY_WHEEL_SLOTS];
+  std::lock_guard<SpinMutex> lock(slot.mtx);
+  slot.entries.push_back({idx, expiry});
+}
+
+void ExpiryWheel::Advance(uint64_t now, uint32_t max_entries,
+                          std::vector<Entry>* due) {
+  uint64_t last = now / EXPIRY_TICK_MS;
+  uint64_t tick = cursor_.load(RE);
+  if (tick > last) return;
+  // after a long pause one turn visits every slot
+  if (last - tick >= EXPIRY_WHEEL_SLOTS) tick = last - EXPIRY_WHEEL_SLOTS + 1;
+
+  for (;; tick++) {
+    auto& slot = slots_[tick % EXPIRY_WHEEL_SLOTS];
+    bool full = false;
+    {
+      std::lock_guard<SpinMutex> lock(slot.mtx);
+      auto& entries = slot.entries;
+      for (size_t i = 0; i < entries.size();) {
+        if (entries[i].expiry > now) {
+          i++;
+          continue;
+        }
+        if (due->size() >= max_entries) {
+          full = true;
+          break;
+        }
+        due->push_back(entries[i]);
+        entries[i] = entries.back();
+        entries.pop_back();
+      }
+    }
+    // the slot of now keeps getting entries until the next tick
+    if (full || tick == last) break;
+  }
+  cursor_.store(tick, RE);
+}
+
+PROFILE_NAMESPACE_END
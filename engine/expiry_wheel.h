@@ -0,0 +1,52 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_EXPIRY_WHEEL_H_
+#define TAIR_CONTEST_KV_CONTEST_EXPIRY_WHEEL_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include "config.h"
+#include "sync.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Timing wheel of the expiring records of a shard, so that they are
+// reclaimed without scanning the index.
+//
+// The wheel turns one slot every EXPIRY_TICK_MS. An entry lands in the slot
+// of the tick it expires in, entries due more than a turn ahead share the
+// slot with nearer ones and are left there until their turn comes. Entries
+// are hints: the record of an index entry may have been replaced since, the
+// sweeper checks the record itself.
+class ExpiryWheel {
+ public:
+  struct Entry {
+    uint32_t idx;
+    // in ms since the unix epoch
+    uint64_t expiry;
+  };
+
+  ExpiryWheel();
+
+  // thread-safe
+  void Add(uint32_t idx, uint64_t expiry);
+
+  // moves up to max_entries entries that expire by now to due. Only one
+  // thread may sweep the wheel
+  void Advance(uint64_t now, uint32_t max_entries, std::vector<Entry>* due);
+
+ private:
+  struct Slot {
+    SpinMutex mtx;
+    std::vector<Entry> entries;
+  };
+
+  Slot slots_[EXPIRY_WHEEL_SLOTS];
+  // the first tick that has not been swept whole
+  std::atomic<uint64_t> cursor_;
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
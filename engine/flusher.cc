@@ -0,0 +1,91 @@
+#include "flusher.h"
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+#include "persist.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+Flusher::Flusher() {
+  for (uint64_t i = 0; i < FLUSH_QUEUE_SIZE; i++) {
+    ranges_[i].seq.store(0, RE);
+  }
+  front_.store(0, RE);
+  rear_.store(0, RE);
+  bytes_flushed_.store(0, RE);
+  xplines_flushed_.store(0, RE);
+}
+
+uint64_t Flusher::Enqueue(const char* addr, uint32_t len) {
+  uint64_t ticket = rear_.fetch_add(1, RE);
+  // the queue is full, help the background thread instead of overwriting
+  while (ticket >= front_.load(std::memory_order_acquire) + FLUSH_QUEUE_SIZE) {
+    Flush();
+  }
+
+  auto range = ranges_ + ticket % FLUSH_QUEUE_SIZE;
+  range->addr = addr;
+  range->len = len;
+  range->seq.store(ticket + 1, std::memory_order_release);
+  return ticket;
+}
+
+void Flusher::Flush() {
+  std::lock_guard<SpinMutex> lock(mtx_);
+  FlushLocked();
+}
+
+void Flusher::Sync(uint64_t ticket) {
+  while (front_.load(std::memory_order_acquire) <= ticket) {
+    if (mtx_.try_lock()) {
+      FlushLocked();
+      mtx_.unlock();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void Flusher::FlushLocked() {
+  uint64_t front = front_.load(RE);
+  // tickets beyond front + FLUSH_QUEUE_SIZE may be waiting for this flush
+  uint64_t rear =
+      std::min(rear_.load(std::memory_order_acquire), front + FLUSH_QUEUE_SIZE);
+  if (front == rear) return;
+
+  uint64_t n = rear - front;
+  uint64_t num_bytes = 0;
+  for (uint64_t ticket = front; ticket < rear; ticket++) {
+    auto range = ranges_ + ticket % FLUSH_QUEUE_SIZE;
+    while (range->seq.load(std::memory_order_acquire) != ticket + 1)
+      ;
+    batch_[ticket - front] = {range->addr, range->len};
+    num_bytes += range->len;
+  }
+  std::sort(batch_, batch_ + n);
+
+  uint64_t num_xplines = 0;
+  uint64_t last_xpline = UINT64_MAX;
+  for (uint64_t i = 0; i < n;) {
+    uint64_t from = (uint64_t)batch_[i].first;
+    uint64_t to = from + batch_[i].second;
+    for (i++; i < n && (uint64_t)batch_[i].first <= to; i++) {
+      to = std::max(to, (uint64_t)batch_[i].first + batch_[i].second);
+    }
+    PmemFlush((const char*)from, to - from);
+    uint64_t first_xpline = std::max(from / XPLINE_SIZE, last_xpline + 1);
+    last_xpline = (to - 1) / XPLINE_SIZE;
+    if (last_xpline + 1 > first_xpline) {
+      num_xplines += last_xpline + 1 - first_xpline;
+    }
+  }
+  PmemDrain();
+  bytes_flushed_.fetch_add(num_bytes, RE);
+  xplines_flushed_.fetch_add(num_xplines, RE);
+
+  front_.store(rear, std::memory_order_release);
+}
+
+PROFILE_NAMESPACE_END
@@ -0,0 +1,66 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_FLUSHER_H_
+#define TAIR_CONTEST_KV_CONTEST_FLUSHER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <utility>
+
+#include "config.h"
+#include "sync.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Collects pmem ranges written with cached stores and makes them durable in
+// batches: every Flush() writes back all ranges enqueued so far and issues a
+// single drain for all of them.
+//
+// Sync() is the group commit path: writers wait on the shared front_ epoch and
+// whoever grabs the lock flushes and drains for every waiting writer. The
+// write-backs are issued by the leader, which is why the ranges must be
+// written with cached stores, non-temporal stores of other cores are not
+// ordered by the leader's fence.
+//
+// The ranges of a batch are flushed in address order, adjacent ones merged,
+// so that small records appended next to each other by different writers
+// reach the media as whole XPLines.
+class Flusher {
+ public:
+  Flusher();
+
+  // returns the ticket of the range
+  uint64_t Enqueue(const char* addr, uint32_t len);
+
+  void Flush();
+
+  // blocks until the range of ticket is durable
+  void Sync(uint64_t ticket);
+
+  // bytes enqueued so far
+  inline uint64_t bytes_flushed() { return bytes_flushed_.load(RE); }
+
+  // XPLines touched by the flushes so far, each written whole by the media
+  inline uint64_t xplines_flushed() { return xplines_flushed_.load(RE); }
+
+ private:
+  struct Range {
+    // ticket + 1 once addr and len are filled
+    std::atomic<uint64_t> seq;
+    const char* addr;
+    uint32_t len;
+  };
+
+  Range ranges_[FLUSH_QUEUE_SIZE];
+  std::atomic<uint64_t> front_, rear_;
+  SpinMutex mtx_;
+  // the batch being flushed, by address, guarded by mtx_
+  std::pair<const char*, uint32_t> batch_[FLUSH_QUEUE_SIZE];
+  std::atomic<uint64_t> bytes_flushed_;
+  std::atomic<uint64_t> xplines_flushed_;
+
+  void FlushLocked();
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
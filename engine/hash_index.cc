@@ -2,9 +2,24 @@
 
 #include <algorithm>
 
+#include "persist.h"
+#include "shard_atomic.h"
+
+PROFILE_NAMESPACE_BEGIN
+
 HashIndex::HashIndex() {
+  num_unique_keys_.store(0, RE);
   auto buckets_ptr = (int32_t*)buckets_;
   std::fill(buckets_ptr, buckets_ptr + NUM_BUCKETS_PER_SHARD, -1);
+#ifdef USE_INLINE_VALUES
+  auto inline_slots_ptr = (int32_t*)inline_slots_;
+  std::fill(inline_slots_ptr, inline_slots_ptr + UNIQUE_KEYS_PER_SHARD, -1);
+#endif
+#ifdef USE_REFERENCE_BITS
+  auto referenced_ptr = (uint64_t*)referenced_;
+  std::fill(referenced_ptr,
+            referenced_ptr + sizeof(referenced_) / sizeof(uint64_t), 0);
+#endif
 }
 
 void HashIndex::TryRecover(uint64_t ptr) {
@@ -17,33 +32,34 @@ void HashIndex::TryRecover(uint64_t ptr) {
   } else {
     PmemRecord* previous_pmem_record = FetchPmemRecord(idx);
     if (previous_pmem_record->timestamp < pmem_record->timestamp) {
-      mem_records_[idx].ptr.store(ptr, RE);
+      mem_records_[idx].ptr.store(MemRecord::EncodePtr(ptr), RE);
     }
   }
 }
 
-uint64_t HashIndex::Reconstruct(char* pmem_base) {
+uint64_t HashIndex::Reconstruct(char* pmem_base, uint64_t pmem_size,
+                                TxnLog* txn_log) {
   pmem_base_ = pmem_base;
 
   uint64_t pmem_frontier = 0;
 
-  int64_t last_zero_ptr = -1;
-  for (uint64_t ptr = 0; ptr < PMEM_SIZE_PER_SHARD; ptr++) {
-    if (pmem_base_[ptr] == 0 && last_zero_ptr < 0) {
-      last_zero_ptr = ptr;
-    } else if (pmem_base_[ptr] != 0) {
-      last_zero_ptr = -1;
-    }
-    if (last_zero_ptr >= 0 &&
-        ptr > (uint64_t)last_zero_ptr + RECOVER_MAX_BLANK_SIZE) {
-      break;
-    }
-
+  // records are aligned, so only aligned addresses have to be probed
+  for (uint64_t ptr = 0; ptr + ADDRESS_ALIGN_NUM <= pmem_size;
+       ptr += ADDRESS_ALIGN_NUM) {
     auto pmem_record = (PmemRecord*)(pmem_base_ + ptr);
-    if (ptr + pmem_record->record_size() <= PMEM_SIZE_PER_SHARD &&
+    if (ptr + pmem_record->record_size() <= pmem_size &&
         pmem_record->Intact()) {
+      if (pmem_record->transactional() &&
+          !txn_log->Committed(pmem_record->txid())) {
+        // a later transaction of its slot may reuse the txid
+        PmemMemsetPersist(pmem_record, 0, sizeof(PmemRecord::head));
+        continue;
+      }
       TryRecover(ptr);
-      pmem_frontier = ptr + pmem_record->record_size();
+      // the range of an older record may have been split for newer records
+      // whose headers are durable before its own, so the probing goes on
+      // inside of it
+      pmem_frontier = std::max(pmem_frontier, ptr + pmem_record->cap());
     }
   }
 
@@ -51,19 +67,22 @@ uint64_t HashIndex::Reconstruct(char* pmem_base) {
 }
 
 int32_t HashIndex::Find(const Slice& key) {
-  uint64_t hash_value;
-  uint8_t tag;
-  std::tie(hash_value, tag) = hash_func_(key);
-  uint32_t bucket_idx = hash_value % NUM_BUCKETS_PER_SHARD;
+#ifdef USE_BLOOM_FILTER
+  if (!filter_.MayContain(key)) {
+    return -1;
+  }
+#endif
+
+  uint64_t hash_value = KeyHash::Hash(key);
+  uint8_t tag = KeyHash::Tag(hash_value);
+  uint32_t bucket_idx = KeyHash::Bucket(hash_value);
 
   for (int32_t node = buckets_[bucket_idx].load(RE); node >= 0;
        node = mem_records_[node].next) {
     if (tag != tags_[node]) {
       continue;
     }
-    auto pmem_record = FetchPmemRecord(node);
-
-    if (memcmp(pmem_record->key, key.data(), KEY_SIZE) == 0) {
+    if (KeyEquals(node, key)) {
       return node;
     }
   }
@@ -72,44 +91,152 @@ int32_t HashIndex::Find(const Slice& key) {
 }
 
 int32_t HashIndex::Insert(const Slice& key, uint64_t ptr) {
-  uint32_t node = num_unique_keys_.fetch_add(1, RE);
+  uint32_t node = num_unique_keys_.load(RE);
+  do {
+    if (node >= UNIQUE_KEYS_PER_SHARD) {
+      int32_t existing = Find(key);
+      if (existing >= 0) return existing;
+      return FULL;
+    }
+  } while (!ShardCompareExchange(&num_unique_keys_, &node, node + 1));
 
-  uint64_t hash_value;
-  uint8_t tag;
-  std::tie(hash_value, tag) = hash_func_(key);
-  uint32_t bucket_idx = hash_value % NUM_BUCKETS_PER_SHARD;
+  uint64_t hash_value = KeyHash::Hash(key);
+  uint8_t tag = KeyHash::Tag(hash_value);
+  uint32_t bucket_idx = KeyHash::Bucket(hash_value);
 
   tags_[node] = tag;
-  mem_records_[node].ptr = ptr;
+  mem_records_[node].ptr = MemRecord::EncodePtr(ptr);
+#ifdef USE_BLOOM_FILTER
+  // before the node is published, a key that can be found is in the filter
+  filter_.Add(key);
+#endif
 
   int32_t head = buckets_[bucket_idx].load(RE);
   int32_t tail = -1;
   while (1) {
     for (int32_t i = head; i != tail; i = mem_records_[i].next) {
-      if (tags_[i] == tag) {
-        if (0 == memcpy(FetchPmemRecord(i)->key, key.data(), KEY_SIZE)) {
-          return i;
-        }
+      if (tags_[i] == tag && KeyEquals(i, key)) {
+        // the record at ptr goes to i or is freed, see Live
+        mem_records_[node].ptr.store(MemRecord::DEAD, RE);
+        return i;
       }
     }
 
     mem_records_[node].next = head;
     tail = head;
 
-    if (buckets_[bucket_idx].compare_exchange_strong(head, node, RE, RE)) {
+    if (ShardCompareExchange(buckets_ + bucket_idx, &head, (int32_t)node)) {
       break;
     }
   }
 
+#ifdef USE_REFERENCE_BITS
+  // new keys get a full turn of the clock hand before they can be demoted
+  // or evicted
+  Reference(node);
+#endif
+
   return -1;
 }
 
+void HashIndex::CountChainLengths(uint32_t num_buckets,
+                                  std::vector<uint64_t>* histogram) {
+  num_buckets = std::min<uint64_t>(num_buckets, NUM_BUCKETS_PER_SHARD);
+  for (uint32_t i = 0; i < num_buckets; i++) {
+    uint64_t len = 0;
+    for (int32_t node = buckets_[i].load(RE); node >= 0;
+         node = mem_records_[node].next) {
+      len++;
+    }
+    (*histogram)[std::min<uint64_t>(len, histogram->size() - 1)]++;
+  }
+}
+
 PmemRecord* HashIndex::Update(uint32_t idx, uint64_t prev_ptr, uint64_t ptr) {
-  uint32_t prev_ptr_32b = prev_ptr;
-  mem_records_[idx].ptr.compare_exchange_strong(prev_ptr_32b, ptr, RE, RE);
-  return (PmemRecord*)(prev_ptr_32b + pmem_base_);
+  uint32_t prev_ptr_32b = MemRecord::EncodePtr(prev_ptr);
+  ShardCompareExchange(&mem_records_[idx].ptr, &prev_ptr_32b,
+                       MemRecord::EncodePtr(ptr));
+  return (PmemRecord*)(MemRecord::DecodePtr(prev_ptr_32b) + pmem_base_);
+}
+
+bool HashIndex::Live(uint32_t idx) {
+  uint32_t ptr = mem_records_[idx].ptr.load(RE);
+  if (ptr == MemRecord::DEAD) {
+    return false;
+  }
+  // a node is only abandoned before it is linked, so once it can be found
+  // it stays the node of its key
+  auto pmem_record = (PmemRecord*)(MemRecord::DecodePtr(ptr) + pmem_base_);
+  char key[KEY_SIZE];
+  memcpy(key, pmem_record->key, KEY_SIZE);
+  return Find(Slice(key, KEY_SIZE)) == (int32_t)idx;
 }
 
 PmemRecord* HashIndex::FetchPmemRecord(uint32_t idx) {
-  return (PmemRecord*)(mem_records_[idx].ptr.load(RE) + pmem_base_);
-}
\ No newline at end of file
+  return (PmemRecord*)(MemRecord::DecodePtr(mem_records_[idx].ptr.load(RE)) +
+                       pmem_base_);
+}
+
+bool HashIndex::KeyEquals(int32_t node, const Slice& key) {
+  const char* node_key;
+#ifdef USE_INLINE_VALUES
+  int32_t slot = inline_slots_[node].load(std::memory_order_acquire);
+  if (slot >= 0) {
+    node_key = inline_slab_.key(slot);
+  } else {
+    node_key = FetchPmemRecord(node)->key;
+    PmemRead(node_key, KEY_SIZE);
+  }
+#else
+  node_key = FetchPmemRecord(node)->key;
+  PmemRead(node_key, KEY_SIZE);
+#endif
+  return memcmp(node_key, key.data(), KEY_SIZE) == 0;
+}
+
+#ifdef USE_INLINE_VALUES
+bool HashIndex::FetchInlineValue(uint32_t idx, std::string* value,
+                                 uint64_t* expiry) {
+  int32_t slot = inline_slots_[idx].load(std::memory_order_acquire);
+  if (slot < 0) return false;
+  return inline_slab_.Read(slot, mem_records_[idx].ptr, value, expiry);
+}
+
+void HashIndex::MirrorValue(uint32_t idx, uint64_t ptr, const char* value,
+                            uint32_t value_len, uint64_t expiry,
+                            bool allocate) {
+  int32_t slot = inline_slots_[idx].load(std::memory_order_acquire);
+  if (slot < 0) {
+    if (!allocate || value_len > INLINE_VALUE_MAX_LEN) return;
+    int32_t new_slot = inline_slab_.Allocate(FetchPmemRecord(idx)->key);
+    if (new_slot < 0) return;
+    // on failure the new slot is wasted, slot holds the winner
+    if (inline_slots_[idx].compare_exchange_strong(
+            slot, new_slot, std::memory_order_release,
+            std::memory_order_acquire)) {
+      slot = new_slot;
+    }
+  }
+  // a reader may have read a record replaced and reused since
+  inline_slab_.Write(slot, mem_records_[idx].ptr, MemRecord::EncodePtr(ptr),
+                     value, value_len, expiry, !allocate);
+}
+#endif
+#ifdef USE_REFERENCE_BITS
+bool HashIndex::Reference(uint32_t idx) {
+  auto& word = referenced_[idx / 64];
+  uint64_t bit = 1ull << (idx % 64);
+  // plain load first, the bit of a hot key is almost always set already
+  if (word.load(RE) & bit) return true;
+  return ShardFetchOr(&word, bit) & bit;
+}
+
+bool HashIndex::Unreference(uint32_t idx) {
+  auto& word = referenced_[idx / 64];
+  uint64_t bit = 1ull << (idx % 64);
+  if (!(word.load(RE) & bit)) return false;
+  return ShardFetchAnd(&word, ~bit) & bit;
+}
+#endif
+
+PROFILE_NAMESPACE_END
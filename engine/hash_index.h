@@ -2,26 +2,19 @@
 #define TAIR_CONTEST_KV_CONTEST_HASH_INDEX_H_
 
 #include <atomic>
-#include <functional>
 #include <utility>
+#include <vector>
 
+#include "bloom_filter.h"
 #include "common/db.h"
 #include "config.h"
+#include "inline_slab.h"
+#include "key_hash.h"
 #include "record.h"
 #include "tair_assert.h"
+#include "txn_log.h"
 
-namespace std {
-template <>
-struct hash<Slice> {
-  inline std::pair<uint64_t, uint8_t> operator()(
-      const Slice& key) const noexcept {
-    ASSERT(key.size() == KEY_SIZE);
-    auto arr = (__uint64_t*)(key.data());
-    uint64_t hash_value = arr[1] * HASH_P + arr[0];
-    return {hash_value >> 8, hash_value & TAG_MASK};
-  }
-};
-}  // namespace std
+PROFILE_NAMESPACE_BEGIN
 
 class HashIndex {
  private:
@@ -30,26 +23,83 @@ class HashIndex {
   std::atomic<uint32_t> num_unique_keys_;
 
   std::atomic<int32_t> buckets_[NUM_BUCKETS_PER_SHARD];
-  std::hash<Slice> hash_func_;
+
+#ifdef USE_BLOOM_FILTER
+  // answers most misses without walking a chain
+  BloomFilter filter_;
+#endif
+
+#ifdef USE_INLINE_VALUES
+  std::atomic<int32_t> inline_slots_[UNIQUE_KEYS_PER_SHARD];
+  InlineSlab inline_slab_;
+#endif
+
+#ifdef USE_REFERENCE_BITS
+  // CLOCK reference bits, set on every access and cleared by the demoter
+  // and the evictor
+  std::atomic<uint64_t> referenced_[(UNIQUE_KEYS_PER_SHARD + 63) / 64];
+#endif
 
   char* pmem_base_;
 
   void TryRecover(uint64_t ptr);
+  bool KeyEquals(int32_t node, const Slice& key);
 
  public:
   HashIndex();
 
-  uint64_t Reconstruct(char* pmem_base);
+  // returns the end of the last record. The records of the transactions
+  // txn_log has not committed are discarded
+  uint64_t Reconstruct(char* pmem_base, uint64_t pmem_size, TxnLog* txn_log);
 
   int32_t Find(const Slice& key);
 
+  static constexpr int32_t FULL = -2;
+
+  // returns -1 once key is inserted, the node of key if it is there
+  // already, or FULL if there is no room for another key
   int32_t Insert(const Slice& key, uint64_t ptr);
 
   PmemRecord* Update(uint32_t idx, uint64_t prev_ptr, uint64_t ptr);
 
   inline uint32_t num_unique_keys() { return num_unique_keys_.load(RE); }
 
+  // whether idx is the node of the key of its record. The scans over all
+  // the nodes below num_unique_keys() have to skip the others: abandoned
+  // nodes, and nodes not linked yet, whose records are not theirs to replace
+  bool Live(uint32_t idx);
+
+  // histogram[n] += #buckets holding n keys, the last entry counts the
+  // longer chains, among the first num_buckets buckets
+  void CountChainLengths(uint32_t num_buckets,
+                         std::vector<uint64_t>* histogram);
+
+#ifdef USE_BLOOM_FILTER
+  // false if key is definitely not in the index
+  inline bool MayContain(const Slice& key) { return filter_.MayContain(key); }
+#endif
+
   PmemRecord* FetchPmemRecord(uint32_t idx);
+
+#ifdef USE_INLINE_VALUES
+  // serves the value and its expiry from the DRAM mirror if there is one
+  bool FetchInlineValue(uint32_t idx, std::string* value, uint64_t* expiry);
+
+  // mirrors the record at ptr, allocating a slot when allocate is set. The
+  // writer of the record mirrors it without allocate, a reader with it
+  void MirrorValue(uint32_t idx, uint64_t ptr, const char* value,
+                   uint32_t value_len, uint64_t expiry, bool allocate);
+#endif
+
+#ifdef USE_REFERENCE_BITS
+  // sets the reference bit of idx, returns whether it was already set
+  bool Reference(uint32_t idx);
+
+  // clears the reference bit of idx, returns whether it was set
+  bool Unreference(uint32_t idx);
+#endif
 };
 
+PROFILE_NAMESPACE_END
+
 #endif
\ No newline at end of file
@@ -0,0 +1,247 @@
+#include "hot_keys.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "key_hash.h"
+#include "utils.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+namespace {
+std::atomic<uint64_t> next_tracker_id(1);
+}  // namespace
+
+struct HotKeyTracker::ThreadState {
+  struct Replica {
+    // 0 if there is none
+    uint64_t version;
+    uint64_t expiry;
+    std::string value;
+  };
+
+  uint64_t owner = 0;
+  Counter counters[HOT_SKETCH_SIZE];
+  uint32_t num_counters = 0;
+  uint64_t num_samples = 0;
+  uint64_t num_hits = 0;
+  Replica replicas[HOT_TABLE_SIZE];
+};
+
+thread_local uint64_t HotKeyTracker::rng_ = 0x9e3779b97f4a7c15ull;
+
+HotKeyTracker::HotKeyTracker()
+    : id_(next_tracker_id.fetch_add(1, RE)),
+      num_counters_(0),
+      num_samples_(0) {
+  for (auto& slot : slots_) {
+    slot.seq.store(0, RE);
+  }
+  num_replica_hits_.store(0, RE);
+}
+
+uint32_t HotKeyTracker::SlotOf(const Slice& key) {
+  return (KeyHash::Hash(key) >> 32) % HOT_TABLE_SIZE;
+}
+
+HotKeyTracker::ThreadState& HotKeyTracker::local() {
+  static thread_local ThreadState state;
+  if (state.owner != id_) {
+    state.owner = id_;
+    state.num_counters = 0;
+    state.num_samples = 0;
+    state.num_hits = 0;
+    for (auto& replica : state.replicas) {
+      replica.version = 0;
+      replica.value.clear();
+    }
+  }
+  return state;
+}
+
+bool HotKeyTracker::ReadReplica(const Slice& key, std::string* value,
+                                uint64_t* version) {
+  *version = 0;
+  uint32_t idx = SlotOf(key);
+  auto& slot = slots_[idx];
+  uint64_t seq = slot.seq.load(std::memory_order_acquire);
+  if (seq == 0 || (seq & 1)) return false;
+  bool hot = memcmp(slot.key, key.data(), KEY_SIZE) == 0;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (!hot || slot.seq.load(RE) != seq) return false;
+
+  auto& state = local();
+  auto& replica = state.replicas[idx];
+  if (replica.version == seq && !Expired(replica.expiry)) {
+    value->assign(replica.value);
+    state.num_hits++;
+    return true;
+  }
+  *version = seq;
+  return false;
+}
+
+void HotKeyTracker::WriteReplica(const Slice& key, const std::string& value,
+                                 uint64_t expiry, uint64_t version) {
+  if (value.size() > HOT_REPLICA_MAX_LEN) return;
+  auto& replica = local().replicas[SlotOf(key)];
+  replica.version = version;
+  replica.expiry = expiry;
+  replica.value.assign(value);
+}
+
+void HotKeyTracker::Invalidate(const Slice& key) {
+  // the new value must be visible before the slot is checked, or a key
+  // published meanwhile could be replicated with the previous value
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto& slot = slots_[SlotOf(key)];
+  uint64_t seq = slot.seq.load(std::memory_order_acquire);
+  while (seq != 0) {
+    // the key of the slot is being replaced, which takes a few stores
+    if (seq & 1) {
+      seq = slot.seq.load(std::memory_order_acquire);
+      continue;
+    }
+    bool hot = memcmp(slot.key, key.data(), KEY_SIZE) == 0;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t current = slot.seq.load(RE);
+    if (current != seq) {
+      seq = current;
+      continue;
+    }
+    if (!hot) return;
+    // only from an even seq, so that a replacement is never missed
+    if (slot.seq.compare_exchange_weak(seq, seq + 2)) return;
+  }
+}
+
+void HotKeyTracker::Count(const Slice& key) {
+  auto& state = local();
+
+  // Space-Saving: a key without a counter takes over the smallest one, and
+  // inherits its count as error
+  uint32_t min_idx = 0;
+  uint32_t i = 0;
+  for (; i < state.num_counters; i++) {
+    auto& counter = state.counters[i];
+    if (memcmp(counter.key, key.data(), KEY_SIZE) == 0) break;
+    if (counter.count < state.counters[min_idx].count) min_idx = i;
+  }
+  if (i < state.num_counters) {
+    state.counters[i].count++;
+  } else if (state.num_counters < HOT_SKETCH_SIZE) {
+    auto& counter = state.counters[state.num_counters++];
+    memcpy(counter.key, key.data(), KEY_SIZE);
+    counter.count = 1;
+    counter.error = 0;
+  } else {
+    auto& counter = state.counters[min_idx];
+    memcpy(counter.key, key.data(), KEY_SIZE);
+    counter.error = counter.count;
+    counter.count++;
+  }
+
+  // another thread merging means the samples can wait
+  if (++state.num_samples < HOT_MERGE_SAMPLES) return;
+  std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
+  if (!lock.owns_lock()) return;
+  Merge(state.counters, state.num_counters, state.num_samples);
+  Publish();
+  num_replica_hits_.fetch_add(state.num_hits, RE);
+  state.num_counters = 0;
+  state.num_samples = 0;
+  state.num_hits = 0;
+}
+
+void HotKeyTracker::Merge(const Counter* counters, uint32_t num_counters,
+                          uint64_t num_samples) {
+  // a key missing from a full sketch may have had up to its smallest count
+  auto min_count = [](const Counter* from, uint32_t n) -> uint64_t {
+    if (n < HOT_SKETCH_SIZE) return 0;
+    uint64_t min = UINT64_MAX;
+    for (uint32_t i = 0; i < n; i++) min = std::min(min, from[i].count);
+    return min;
+  };
+  uint64_t local_min = min_count(counters, num_counters);
+  uint64_t shared_min = min_count(counters_, num_counters_);
+
+  std::vector<Counter> merged(counters_, counters_ + num_counters_);
+  std::vector<bool> matched(num_counters, false);
+  for (auto& counter : merged) {
+    uint64_t count = local_min, error = local_min;
+    for (uint32_t i = 0; i < num_counters; i++) {
+      if (!matched[i] &&
+          memcmp(counter.key, counters[i].key, KEY_SIZE) == 0) {
+        count = counters[i].count;
+        error = counters[i].error;
+        matched[i] = true;
+        break;
+      }
+    }
+    counter.count += count;
+    counter.error += error;
+  }
+  for (uint32_t i = 0; i < num_counters; i++) {
+    if (matched[i]) continue;
+    merged.push_back(counters[i]);
+    merged.back().count += shared_min;
+    merged.back().error += shared_min;
+  }
+
+  // the counters are kept hottest first
+  std::sort(merged.begin(), merged.end(),
+            [](const Counter& a, const Counter& b) { return a.count > b.count; });
+  num_counters_ = std::min<uint64_t>(merged.size(), HOT_SKETCH_SIZE);
+  std::copy(merged.begin(), merged.begin() + num_counters_, counters_);
+
+  num_samples_ += num_samples;
+  if (num_samples_ > HOT_WINDOW_SAMPLES) {
+    for (uint32_t i = 0; i < num_counters_; i++) {
+      counters_[i].count /= 2;
+      counters_[i].error /= 2;
+    }
+    num_samples_ /= 2;
+  }
+}
+
+void HotKeyTracker::Publish() {
+  // a slot keeps its key until a hotter one maps to it
+  bool taken[HOT_TABLE_SIZE] = {};
+  uint64_t min_count = std::max<uint64_t>(num_samples_ / HOT_MIN_SHARE, 1);
+  for (uint32_t i = 0; i < num_counters_; i++) {
+    auto& counter = counters_[i];
+    if (counter.count - counter.error < min_count) continue;
+    Slice key(counter.key, KEY_SIZE);
+    uint32_t idx = SlotOf(key);
+    if (taken[idx]) continue;
+    taken[idx] = true;
+
+    auto& slot = slots_[idx];
+    uint64_t seq = slot.seq.load(RE);
+    if (seq != 0 && memcmp(slot.key, counter.key, KEY_SIZE) == 0) continue;
+    // only the publisher makes seq odd, sets may still bump it
+    while (!slot.seq.compare_exchange_weak(seq, seq + 1)) {
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(slot.key, counter.key, KEY_SIZE);
+    slot.seq.store(seq + 2, std::memory_order_release);
+  }
+}
+
+void HotKeyTracker::Top(uint32_t max_keys, std::vector<std::string>* keys) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  keys->clear();
+  for (uint32_t i = 0; i < num_counters_ && i < max_keys; i++) {
+    keys->emplace_back(counters_[i].key, KEY_SIZE);
+  }
+}
+
+uint32_t HotKeyTracker::num_hot_slots() {
+  uint32_t n = 0;
+  for (auto& slot : slots_) {
+    n += slot.seq.load(RE) != 0;
+  }
+  return n;
+}
+
+PROFILE_NAMESPACE_END
@@ -0,0 +1,110 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_HOT_KEYS_H_
+#define TAIR_CONTEST_KV_CONTEST_HOT_KEYS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/db.h"
+#include "config.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Finds the hot keys of the workload and keeps read replicas of their values.
+//
+// A sample of the gets and sets is counted by a Space-Saving sketch of the
+// calling thread, which is merged now and then into a shared sketch with
+// decaying counts. The keys that make at least 1 / HOT_MIN_SHARE of the
+// samples are published in a small table, direct-mapped by hash. Every
+// thread keeps its own replica of the values of the published keys, so hot
+// gets are served from its cache instead of the index, slab and pmem lines
+// shared with the other sockets.
+//
+// A replica is tagged with the version of the slot of its key, which changes
+// when the slot gets another key and after every set of its key, see
+// Invalidate.
+class HotKeyTracker {
+ public:
+  HotKeyTracker();
+
+  // counts one in HOT_SAMPLE_PERIOD operations on average
+  inline void Sample(const Slice& key) {
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 7;
+    rng_ ^= rng_ << 17;
+    if ((rng_ & (HOT_SAMPLE_PERIOD - 1)) == 0) Count(key);
+  }
+
+  // copies the replica of key held by the calling thread if it is current.
+  // Otherwise version receives what a new replica is to be tagged with, 0
+  // if key is not hot
+  bool ReadReplica(const Slice& key, std::string* value, uint64_t* version);
+
+  // replicates the value of key read after ReadReplica returned version,
+  // which is not served past its expiry, see PmemRecord::expiry
+  void WriteReplica(const Slice& key, const std::string& value,
+                    uint64_t expiry, uint64_t version);
+
+  // to be called after every set of key, once the new value is visible
+  void Invalidate(const Slice& key);
+
+  // up to max_keys of the hottest keys, hottest first
+  void Top(uint32_t max_keys, std::vector<std::string>* keys);
+
+  // #gets served from replicas, as of the last merge of every thread
+  inline uint64_t num_replica_hits() { return num_replica_hits_.load(RE); }
+
+  // #slots that have had a hot key
+  uint32_t num_hot_slots();
+
+ private:
+  static_assert((HOT_SAMPLE_PERIOD & (HOT_SAMPLE_PERIOD - 1)) == 0,
+                "HOT_SAMPLE_PERIOD should be 2^n");
+
+  struct Counter {
+    char key[KEY_SIZE];
+    uint64_t count;
+    // by which count may overestimate the frequency of key
+    uint64_t error;
+  };
+
+  // the sketch and replicas of a thread, see local()
+  struct ThreadState;
+
+  struct alignas(64) Slot {
+    // seqlock, odd while the key is being replaced, 0 before the first one
+    std::atomic<uint64_t> seq;
+    char key[KEY_SIZE];
+  };
+
+  static thread_local uint64_t rng_;
+
+  // tells the thread-local state of another tracker apart
+  const uint64_t id_;
+
+  Slot slots_[HOT_TABLE_SIZE];
+  std::atomic<uint64_t> num_replica_hits_;
+
+  std::mutex mtx_;
+  Counter counters_[HOT_SKETCH_SIZE];
+  uint32_t num_counters_;
+  // #samples in the counters
+  uint64_t num_samples_;
+
+  static uint32_t SlotOf(const Slice& key);
+  // the state of the calling thread, reset if it was another tracker's
+  ThreadState& local();
+  void Count(const Slice& key);
+  // merges the sketch of the calling thread, under mtx_
+  void Merge(const Counter* counters, uint32_t num_counters,
+             uint64_t num_samples);
+  // publishes the hot keys of the sketch, under mtx_
+  void Publish();
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
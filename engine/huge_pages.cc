@@ -0,0 +1,86 @@
+#include "huge_pages.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "utils.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+namespace {
+const uint64_t SMALL_PAGE_SIZE = 4 * (1 << 10);
+}  // namespace
+
+const char* PageKindName(PageKind kind) {
+  switch (kind) {
+    case kHugeTlb: {
+      return "hugetlb";
+    }
+    case kTransparentHuge: {
+      return "transparent huge pages";
+    }
+    default:
+    case kSmallPages: {
+      return "small pages";
+    }
+  }
+}
+
+void* MapHugeDram(uint64_t size, PageKind* kind) {
+  size = Align<HUGE_PAGE_BITS>(size);
+
+  int huge_flags = MAP_HUGETLB | (HUGE_PAGE_BITS << MAP_HUGE_SHIFT);
+  void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | huge_flags, -1, 0);
+  if (addr != MAP_FAILED) {
+    *kind = kHugeTlb;
+    return addr;
+  }
+
+  // over-map and trim, so that the range starts at a huge page boundary
+  uint64_t mapped_size = size + HUGE_PAGE_SIZE;
+  auto base = (char*)mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) return nullptr;
+  auto start = (char*)Align<HUGE_PAGE_BITS>((uint64_t)base);
+  if (start > base) munmap(base, start - base);
+  munmap(start + size, base + mapped_size - (start + size));
+
+  *kind = AdviseHugePages(start, size) ? kTransparentHuge : kSmallPages;
+  return start;
+}
+
+void UnmapHugeDram(void* addr, uint64_t size) {
+  munmap(addr, Align<HUGE_PAGE_BITS>(size));
+}
+
+bool AdviseHugePages(void* addr, uint64_t size) {
+  return madvise(addr, size, MADV_HUGEPAGE) == 0;
+}
+
+void Prefault(char* addr, uint64_t size, uint32_t num_threads, bool write) {
+  // every thread takes whole huge pages
+  uint64_t size_per_thread =
+      Align<HUGE_PAGE_BITS>((size + num_threads - 1) / num_threads);
+  std::vector<std::thread> threads;
+  for (uint64_t from = 0; from < size; from += size_per_thread) {
+    uint64_t to = std::min(from + size_per_thread, size);
+    threads.emplace_back([=]() {
+      for (uint64_t i = from; i < to; i += SMALL_PAGE_SIZE) {
+        if (write) {
+          ((volatile char*)addr)[i] = 0;
+        } else {
+          (void)((volatile char*)addr)[i];
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+PROFILE_NAMESPACE_END
@@ -0,0 +1,40 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_HUGE_PAGES_H_
+#define TAIR_CONTEST_KV_CONTEST_HUGE_PAGES_H_
+
+#include <stdint.h>
+
+#include "config.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Backing of large, long-lived ranges with huge pages, and prefaulting, so
+// that the first operations do not pay for page faults and TLB misses.
+
+enum PageKind : uint8_t {
+  // reserved pages of HUGE_PAGE_SIZE
+  kHugeTlb,
+  // transparent huge pages have been asked for
+  kTransparentHuge,
+  kSmallPages,
+};
+
+const char* PageKindName(PageKind kind);
+
+// maps size bytes of zeroed DRAM aligned to HUGE_PAGE_SIZE, or returns
+// nullptr. Reserved huge pages are used if there are enough of them.
+void* MapHugeDram(uint64_t size, PageKind* kind);
+
+void UnmapHugeDram(void* addr, uint64_t size);
+
+// asks for transparent huge pages on a mapped range, returns false if the
+// kernel refuses, as it does for DAX mappings that are aligned already
+bool AdviseHugePages(void* addr, uint64_t size);
+
+// takes the page faults of the range with num_threads threads. With write
+// set zeroes are written, which is only fine on a range without content
+// yet, otherwise the pages are read.
+void Prefault(char* addr, uint64_t size, uint32_t num_threads, bool write);
+
+PROFILE_NAMESPACE_END
+
+#endif
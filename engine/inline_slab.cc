@@ -0,0 +1,75 @@
+#include "inline_slab.h"
+
+#include <cstring>
+
+PROFILE_NAMESPACE_BEGIN
+
+constexpr uint32_t InlineSlab::INVALID_PTR;
+
+InlineSlab::InlineSlab() { num_slots_.store(0, RE); }
+
+int32_t InlineSlab::Allocate(const char* key) {
+  if (num_slots_.load(RE) >= NUM_SLOTS) return -1;
+  uint32_t idx = num_slots_.fetch_add(1, RE);
+  if (idx >= NUM_SLOTS) return -1;
+
+  auto slot = slots_ + idx;
+  slot->seq.store(0, RE);
+  slot->ptr = INVALID_PTR;
+  slot->value_len = 0;
+  memcpy(slot->key, key, KEY_SIZE);
+  return idx;
+}
+
+bool InlineSlab::Read(int32_t idx, const std::atomic<uint32_t>& current,
+                      std::string* value, uint64_t* expiry) {
+  auto slot = slots_ + idx;
+  char buf[INLINE_VALUE_MAX_LEN];
+
+  uint32_t seq = slot->seq.load(std::memory_order_acquire);
+  if (seq & 1) return false;
+  uint32_t ptr = slot->ptr;
+  uint32_t value_len = slot->value_len;
+  uint64_t slot_expiry = slot->expiry;
+  if (ptr == INVALID_PTR || value_len > INLINE_VALUE_MAX_LEN) return false;
+  memcpy(buf, slot->value, value_len);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (slot->seq.load(RE) != seq) return false;
+
+  if (ptr != current.load(RE)) return false;
+  value->assign(buf, value_len);
+  *expiry = slot_expiry;
+  return true;
+}
+
+void InlineSlab::Write(int32_t idx, const std::atomic<uint32_t>& current,
+                       uint32_t ptr, const char* value, uint32_t value_len,
+                       uint64_t expiry, bool replace) {
+  auto slot = slots_ + idx;
+
+  uint32_t seq = slot->seq.load(RE);
+  while (1) {
+    if ((seq & 1) == 0 &&
+        slot->seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire,
+                                        RE)) {
+      break;
+    }
+    seq = slot->seq.load(RE);
+  }
+
+  // a newer record has been published, its writer will mirror it
+  if (current.load(RE) == ptr && (replace || slot->ptr != ptr)) {
+    if (value_len <= INLINE_VALUE_MAX_LEN) {
+      slot->ptr = ptr;
+      slot->value_len = value_len;
+      slot->expiry = expiry;
+      memcpy(slot->value, value, value_len);
+    } else {
+      slot->ptr = INVALID_PTR;
+    }
+  }
+
+  slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+PROFILE_NAMESPACE_END
@@ -0,0 +1,61 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_INLINE_SLAB_H_
+#define TAIR_CONTEST_KV_CONTEST_INLINE_SLAB_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#include "config.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// DRAM mirror of small values, so that hot gets are served without touching
+// pmem. pmem keeps the durable copy, a slot is only trusted while the record
+// it mirrors is still the one referenced by the index. Pointers are in the
+// encoding of MemRecord::ptr.
+class InlineSlab {
+ public:
+  static constexpr uint32_t INVALID_PTR = ~0u;
+
+  InlineSlab();
+
+  // returns the index of a new slot for key, or -1 if the budget is used up
+  int32_t Allocate(const char* key);
+
+  inline const char* key(int32_t idx) { return slots_[idx].key; }
+
+  // copies the mirrored value and its expiry if the slot still mirrors
+  // current
+  bool Read(int32_t idx, const std::atomic<uint32_t>& current,
+            std::string* value, uint64_t* expiry);
+
+  // mirrors the record at ptr if it is still referenced by current. Unless
+  // replace is set, a slot already mirroring ptr is left alone: ptr may have
+  // been replaced and reused since the value was read, and the writer of the
+  // record mirrors it itself
+  void Write(int32_t idx, const std::atomic<uint32_t>& current, uint32_t ptr,
+             const char* value, uint32_t value_len, uint64_t expiry,
+             bool replace);
+
+ private:
+  struct alignas(64) Slot {
+    // seqlock, odd while the slot is being written
+    std::atomic<uint32_t> seq;
+    uint32_t ptr;
+    uint32_t value_len;
+    // see PmemRecord::expiry
+    uint64_t expiry;
+    char key[KEY_SIZE];
+    char value[INLINE_VALUE_MAX_LEN];
+  };
+
+  static const uint32_t NUM_SLOTS = INLINE_SLAB_SIZE_PER_SHARD / sizeof(Slot);
+
+  Slot slots_[NUM_SLOTS];
+  std::atomic<uint32_t> num_slots_;
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_KEY_HASH_H_
+#define TAIR_CONTEST_KV_CONTEST_KEY_HASH_H_
+
+#include <stdint.h>
+
+#include "common/db.h"
+#include "config.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+static_assert(KEY_SIZE == 16, "KeyHash reads keys as two words");
+
+// Hash of a key, the final rounds of wyhash on its two words. Every bit of
+// the hash depends on every bit of the key, so keys that only differ in a
+// counter spread evenly, and the bucket (high bits), the tag (low 8 bits)
+// and the shard (the bits above the tag) are independent of each other.
+// Two 64x64->128 multiplies cost less than the AES or CLMUL rounds needed
+// for the same mixing of a single block.
+//
+// not a specialization of std::hash, whose definition would differ between
+// the profiles
+struct KeyHash {
+  static inline uint64_t Hash(const Slice& key) {
+    auto arr = (const uint64_t*)key.data();
+    uint64_t h = Mum(arr[0] ^ 0xa0761d6478bd642full,
+                     arr[1] ^ 0xe7037ed1a0b428dbull);
+    return Mum(h ^ 0x8ebc6af09c88c6e3ull, KEY_SIZE ^ 0x589965cc75374cc3ull);
+  }
+
+  static inline uint32_t Bucket(uint64_t hash_value) {
+    return ((__uint128_t)hash_value * NUM_BUCKETS_PER_SHARD) >> 64;
+  }
+
+  static inline uint8_t Tag(uint64_t hash_value) {
+    return hash_value & TAG_MASK;
+  }
+
+  static inline uint32_t Shard(uint64_t hash_value) {
+    return (hash_value >> 8) & SHARD_HASH_MASK;
+  }
+
+ private:
+  static inline uint64_t Mum(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+  }
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
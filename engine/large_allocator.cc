@@ -0,0 +1,72 @@
+#include "large_allocator.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include "persist.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+void LargeAllocator::Init(uint64_t pmem_size, uint64_t* region_size,
+                          const std::atomic<uint64_t>* pmem_frontier) {
+  pmem_size_ = pmem_size;
+  region_size_ = region_size;
+  pmem_frontier_ = pmem_frontier;
+  records_end_ = 0;
+}
+
+uint64_t LargeAllocator::Reserve(uint64_t end) {
+  std::lock_guard<SpinMutex> lock(mtx_);
+  records_end_ = std::max(records_end_, end);
+  return region_start();
+}
+
+bool LargeAllocator::Allocate(uint32_t size, uint64_t* ptr, uint32_t* cap) {
+  *cap = LargeAllocator::cap(size);
+  uint32_t num_blocks = *cap >> LARGE_BLOCK_BITS;
+
+  std::lock_guard<SpinMutex> lock(mtx_);
+  for (uint32_t i = num_blocks; i <= NUM_HEADS; i++) {
+    if (free_lists_[i].empty()) continue;
+    *ptr = free_lists_[i].back();
+    free_lists_[i].pop_back();
+    if (i > num_blocks) {
+      free_lists_[i - num_blocks].push_back(*ptr + *cap);
+    }
+    return true;
+  }
+
+  uint64_t region_size = *region_size_ + *cap;
+  if (region_size > pmem_size_ ||
+      pmem_size_ - region_size <
+          std::max(pmem_frontier_->load(RE), records_end_)) {
+    return false;
+  }
+  // grown before the extent is written, an unused tail is freed on recovery
+  *region_size_ = region_size;
+  PmemPersist(region_size_, sizeof(uint64_t));
+  *ptr = pmem_size_ - region_size;
+  return true;
+}
+
+void LargeAllocator::Deallocate(uint64_t ptr, uint32_t cap) {
+  std::lock_guard<SpinMutex> lock(mtx_);
+  free_lists_[cap >> LARGE_BLOCK_BITS].push_back(ptr);
+}
+
+void LargeAllocator::Recover(std::vector<std::pair<uint64_t, uint32_t>>* used) {
+  std::sort(used->begin(), used->end());
+  used->emplace_back(pmem_size_, 0);
+
+  uint64_t ptr = region_start();
+  for (auto& extent : *used) {
+    for (; ptr < extent.first; ptr += MAX_EXTENT_SIZE) {
+      uint64_t cap = std::min<uint64_t>(extent.first - ptr, MAX_EXTENT_SIZE);
+      free_lists_[cap >> LARGE_BLOCK_BITS].push_back(ptr);
+      if (cap < MAX_EXTENT_SIZE) break;
+    }
+    ptr = extent.first + extent.second;
+  }
+}
+
+PROFILE_NAMESPACE_END
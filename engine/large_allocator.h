@@ -0,0 +1,62 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_LARGE_ALLOCATOR_H_
+#define TAIR_CONTEST_KV_CONTEST_LARGE_ALLOCATOR_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+#include "sync.h"
+#include "utils.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Allocator of the extents of large values. Extents are carved from the end
+// of the shard downwards, in blocks of 1 << LARGE_BLOCK_BITS bytes, so they
+// never fragment the free lists of PmemAllocator. The size of the carved
+// region is kept in the pool header, records are only searched below it.
+class LargeAllocator {
+ public:
+  LargeAllocator() = default;
+
+  void Init(uint64_t pmem_size, uint64_t* region_size,
+            const std::atomic<uint64_t>* pmem_frontier);
+
+  inline uint64_t region_start() { return pmem_size_ - *region_size_; }
+
+  // keeps the region above end from now on, returns its start
+  uint64_t Reserve(uint64_t end);
+
+  // returns false if the shard is full
+  bool Allocate(uint32_t size, uint64_t* ptr, uint32_t* cap);
+
+  void Deallocate(uint64_t ptr, uint32_t cap);
+
+  // frees every block of the region that is not in used, as (ptr, cap)
+  void Recover(std::vector<std::pair<uint64_t, uint32_t>>* used);
+
+  inline static uint32_t cap(uint32_t size) {
+    return Align<LARGE_BLOCK_BITS>(size);
+  }
+
+ private:
+  static const uint32_t NUM_HEADS = MAX_EXTENT_SIZE >> LARGE_BLOCK_BITS;
+
+  uint64_t pmem_size_;
+  // persistent, in the pool header
+  uint64_t* region_size_;
+  // frontier of the records growing from the start of the shard
+  const std::atomic<uint64_t>* pmem_frontier_;
+  // the zeroed prefix of the records
+  uint64_t records_end_;
+
+  SpinMutex mtx_;
+  // free extents by #blocks
+  std::vector<uint64_t> free_lists_[NUM_HEADS + 1];
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_MPMC_QUEUE_H_
+#define TAIR_CONTEST_KV_CONTEST_MPMC_QUEUE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+
+#include "config.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Bounded lock-free queue for any number of producers and consumers. Every
+// cell carries a sequence number telling whether it is ready to be written
+// or read for the current lap, so neither side ever waits for the other.
+template <typename T>
+class MpmcQueue {
+ public:
+  // capacity is rounded up to a power of 2
+  explicit MpmcQueue(uint64_t capacity) {
+    uint64_t size = 1;
+    while (size < capacity) size <<= 1;
+    cells_.reset(new Cell[size]);
+    mask_ = size - 1;
+    for (uint64_t i = 0; i < size; i++) {
+      cells_[i].seq.store(i, RE);
+    }
+    front_.store(0, RE);
+    rear_.store(0, RE);
+  }
+
+  // returns false if the queue is full
+  bool TryPush(const T& item) {
+    uint64_t pos = rear_.load(RE);
+    Cell* cell;
+    while (1) {
+      cell = &cells_[pos & mask_];
+      uint64_t seq = cell->seq.load(std::memory_order_acquire);
+      int64_t diff = (int64_t)seq - (int64_t)pos;
+      if (diff == 0) {
+        if (rear_.compare_exchange_weak(pos, pos + 1, RE)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = rear_.load(RE);
+      }
+    }
+    cell->item = item;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // returns false if the queue is empty
+  bool TryPop(T* item) {
+    uint64_t pos = front_.load(RE);
+    Cell* cell;
+    while (1) {
+      cell = &cells_[pos & mask_];
+      uint64_t seq = cell->seq.load(std::memory_order_acquire);
+      int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+      if (diff == 0) {
+        if (front_.compare_exchange_weak(pos, pos + 1, RE)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = front_.load(RE);
+      }
+    }
+    *item = cell->item;
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  // only a snapshot while the queue is in use
+  uint64_t size() {
+    uint64_t front = front_.load(RE);
+    uint64_t rear = rear_.load(RE);
+    return rear > front ? rear - front : 0;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<uint64_t> seq;
+    T item;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  uint64_t mask_;
+  // producers and consumers do not share a cache line, without making the
+  // queue over-aligned for new
+  char padding0_[64];
+  std::atomic<uint64_t> front_;
+  char padding1_[64 - sizeof(std::atomic<uint64_t>)];
+  std::atomic<uint64_t> rear_;
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
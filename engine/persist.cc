@@ -0,0 +1,105 @@
+#include "persist.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+PersistTracer* persist_tracer = nullptr;
+
+void SetPersistTracer(PersistTracer* tracer) { persist_tracer = tracer; }
+
+const PmemEmulation* pmem_emulation = nullptr;
+
+namespace {
+
+PmemEmulation emulation;
+
+std::atomic<uint64_t> bytes_read(0);
+std::atomic<uint64_t> bytes_flushed(0);
+std::atomic<uint64_t> media_bytes_written(0);
+std::atomic<uint64_t> rmw_xplines(0);
+std::atomic<uint64_t> injected_ns(0);
+
+// the media is busy writing until then
+std::atomic<uint64_t> media_busy_until(0);
+
+// the XPLine last read by the thread
+thread_local uint64_t last_read_xpline = UINT64_MAX;
+// the media has written all the thread has flushed by then
+thread_local uint64_t flushed_until = 0;
+
+inline uint64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void WaitUntil(uint64_t deadline) {
+  uint64_t now = NowNanos();
+  if (now >= deadline) return;
+  injected_ns.fetch_add(deadline - now, std::memory_order_relaxed);
+  while (NowNanos() < deadline) __builtin_ia32_pause();
+}
+
+}  // namespace
+
+void SetPmemEmulation(const PmemEmulation* e) {
+  bytes_read = 0;
+  bytes_flushed = 0;
+  media_bytes_written = 0;
+  rmw_xplines = 0;
+  injected_ns = 0;
+  media_busy_until = 0;
+  if (e == nullptr) {
+    pmem_emulation = nullptr;
+    return;
+  }
+  emulation = *e;
+  pmem_emulation = &emulation;
+}
+
+PmemEmulationStats GetPmemEmulationStats() {
+  return {bytes_read.load(), bytes_flushed.load(), media_bytes_written.load(),
+          rmw_xplines.load(), injected_ns.load()};
+}
+
+void EmulateRead(const void* addr, size_t len) {
+  if (len == 0) return;
+  uint64_t from = (uint64_t)addr;
+  uint64_t cost = len * 1000 / emulation.read_bandwidth_mbps;
+  if (from / XPLINE_SIZE != last_read_xpline) {
+    cost += emulation.read_latency_ns;
+  }
+  last_read_xpline = (from + len - 1) / XPLINE_SIZE;
+  bytes_read.fetch_add(len, std::memory_order_relaxed);
+  WaitUntil(NowNanos() + cost);
+}
+
+void EmulateFlush(const void* addr, size_t len) {
+  if (len == 0) return;
+  uint64_t from = (uint64_t)addr;
+  uint64_t to = from + len;
+  uint64_t num_xplines = (to - 1) / XPLINE_SIZE - from / XPLINE_SIZE + 1;
+  uint64_t num_rmw = 0;
+  if (from % XPLINE_SIZE != 0) num_rmw++;
+  if (to % XPLINE_SIZE != 0 && (num_xplines > 1 || num_rmw == 0)) num_rmw++;
+
+  uint64_t media_bytes = num_xplines * XPLINE_SIZE;
+  uint64_t cost = media_bytes * 1000 / emulation.write_bandwidth_mbps +
+                  num_rmw * emulation.rmw_penalty_ns;
+  bytes_flushed.fetch_add(len, std::memory_order_relaxed);
+  media_bytes_written.fetch_add(media_bytes, std::memory_order_relaxed);
+  rmw_xplines.fetch_add(num_rmw, std::memory_order_relaxed);
+
+  // the media writes the lines in the order they are flushed
+  uint64_t now = NowNanos();
+  uint64_t busy_until = media_busy_until.load(std::memory_order_relaxed);
+  uint64_t done;
+  do {
+    done = std::max(now, busy_until) + cost;
+  } while (!media_busy_until.compare_exchange_weak(busy_until, done,
+                                                   std::memory_order_relaxed));
+  flushed_until = std::max(flushed_until, done);
+}
+
+void EmulateDrain() { WaitUntil(flushed_until); }
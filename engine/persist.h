@@ -0,0 +1,152 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_PERSIST_H_
+#define TAIR_CONTEST_KV_CONTEST_PERSIST_H_
+
+#include <libpmem.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Persistence layer of the engine. Every mapping, store, flush and fence of
+// pmem goes through these wrappers of libpmem, so that a test can interpose a
+// PersistTracer and replay the persistence ordering of the engine, see
+// test/crash_test.cc, and a benchmark can emulate the performance of pmem on
+// dram. Without either they cost predictable branches.
+// Plain cpu stores to pmem are only seen once their lines are flushed.
+class PersistTracer {
+ public:
+  // the contents of the len bytes at base are durable
+  virtual void OnMap(char* base, uint64_t len) = 0;
+
+  virtual void OnUnmap(char* base) = 0;
+
+  // len bytes at addr have been written, but not flushed
+  virtual void OnStore(const void* addr, uint64_t len) = 0;
+
+  // the lines of the range are being written back
+  virtual void OnFlush(const void* addr, uint64_t len) = 0;
+
+  // the lines written back so far are durable
+  virtual void OnFence() = 0;
+
+  virtual ~PersistTracer() {}
+};
+
+extern PersistTracer* persist_tracer;
+
+// to be called while no db is open, nullptr removes the tracer
+void SetPersistTracer(PersistTracer* tracer);
+
+// Emulated performance of pmem, so that benchmarks on dram rank designs the
+// way optane would. The costs are injected as busy waits:
+// - a read pays the latency unless it starts in the XPLine last read by the
+//   thread, which the XPBuffer still holds, and its transfer at the read
+//   bandwidth;
+// - flushed lines are written to a media shared by all the threads, in whole
+//   256 B XPLines at the write bandwidth, and an XPLine flushed in part costs
+//   a read-modify-write;
+// - a drain waits until the media has written what the thread has flushed.
+// Stores left to cache evictions, as those of kVolatile sets, are not charged.
+struct PmemEmulation {
+  // over the latency of dram
+  uint32_t read_latency_ns;
+  uint32_t read_bandwidth_mbps;
+  uint32_t write_bandwidth_mbps;
+  uint32_t rmw_penalty_ns;
+
+  // a first generation optane dimm
+  static PmemEmulation Optane() { return {220, 6600, 2300, 220}; }
+};
+
+struct PmemEmulationStats {
+  uint64_t bytes_read;
+  uint64_t bytes_flushed;
+  // bytes_flushed rounded to whole XPLines
+  uint64_t media_bytes_written;
+  uint64_t rmw_xplines;
+  uint64_t injected_ns;
+};
+
+const uint64_t XPLINE_SIZE = 256;
+
+extern const PmemEmulation* pmem_emulation;
+
+// to be called while no db is open, nullptr disables the emulation, the
+// stats are reset
+void SetPmemEmulation(const PmemEmulation* emulation);
+
+PmemEmulationStats GetPmemEmulationStats();
+
+void EmulateRead(const void* addr, size_t len);
+void EmulateFlush(const void* addr, size_t len);
+void EmulateDrain();
+
+// to be called before reading len bytes of pmem at addr
+inline void PmemRead(const void* addr, size_t len) {
+  if (pmem_emulation != nullptr) EmulateRead(addr, len);
+}
+
+inline char* PmemMapFile(const char* path, size_t len, int flags, int mode,
+                         size_t* mapped_len, int* is_pmem) {
+  auto base = (char*)pmem_map_file(path, len, flags, mode, mapped_len, is_pmem);
+  if (persist_tracer != nullptr && base != nullptr) {
+    persist_tracer->OnMap(base, *mapped_len);
+  }
+  return base;
+}
+
+inline void PmemUnmap(char* base, size_t len) {
+  if (persist_tracer != nullptr) persist_tracer->OnUnmap(base);
+  pmem_unmap(base, len);
+}
+
+inline void PmemFlush(const void* addr, size_t len) {
+  pmem_flush(addr, len);
+  if (pmem_emulation != nullptr) EmulateFlush(addr, len);
+  if (persist_tracer != nullptr) persist_tracer->OnFlush(addr, len);
+}
+
+inline void PmemDrain() {
+  pmem_drain();
+  if (pmem_emulation != nullptr) EmulateDrain();
+  if (persist_tracer != nullptr) persist_tracer->OnFence();
+}
+
+inline void PmemPersist(const void* addr, size_t len) {
+  PmemFlush(addr, len);
+  PmemDrain();
+}
+
+inline void PmemMemcpy(void* to, const void* from, size_t len,
+                       unsigned flags) {
+  pmem_memcpy(to, from, len, flags);
+  if (pmem_emulation != nullptr && !(flags & PMEM_F_MEM_NOFLUSH)) {
+    EmulateFlush(to, len);
+    if (!(flags & PMEM_F_MEM_NODRAIN)) EmulateDrain();
+  }
+  if (persist_tracer == nullptr) return;
+  persist_tracer->OnStore(to, len);
+  if (flags & PMEM_F_MEM_NOFLUSH) return;
+  persist_tracer->OnFlush(to, len);
+  if (!(flags & PMEM_F_MEM_NODRAIN)) persist_tracer->OnFence();
+}
+
+inline void PmemMemcpyNodrain(void* to, const void* from, size_t len) {
+  PmemMemcpy(to, from, len, PMEM_F_MEM_NODRAIN);
+}
+
+inline void PmemMemcpyPersist(void* to, const void* from, size_t len) {
+  PmemMemcpy(to, from, len, 0);
+}
+
+inline void PmemMemsetPersist(void* to, int c, size_t len) {
+  pmem_memset_persist(to, c, len);
+  if (pmem_emulation != nullptr) {
+    EmulateFlush(to, len);
+    EmulateDrain();
+  }
+  if (persist_tracer == nullptr) return;
+  persist_tracer->OnStore(to, len);
+  persist_tracer->OnFlush(to, len);
+  persist_tracer->OnFence();
+}
+
+#endif
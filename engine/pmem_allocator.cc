@@ -1,30 +1,38 @@
 #include "pmem_allocator.h"
 
+
 #include <algorithm>
 #include <mutex>
 
+#include "persist.h"
+#include "shard_atomic.h"
 #include "utils.h"
 
-using std::make_tuple;
-
-uint32_t PmemAllocator::FreeQueue::PopFront() {
-  auto idx = front.fetch_add(1, RE);
-  return data[idx % GC_POOL_SIZE_PER_SHARD];
-}
+PROFILE_NAMESPACE_BEGIN
 
-void PmemAllocator::FreeQueue::PushBack(uint32_t item) {
-  auto idx = rear.fetch_add(1, RE);
-  data[idx % GC_POOL_SIZE_PER_SHARD] = item;
-}
+using std::make_tuple;
 
-PmemAllocator::PmemAllocator() {
-  auto heads_ptr = (int32_t *)heads_;
-  std::fill(heads_ptr, heads_ptr + NUM_HEADS + 1, -1);
+PmemAllocator::PmemAllocator() : free_queue_(GC_POOL_SIZE_PER_SHARD) {
+  auto heads_ptr = (uint64_t *)heads_;
+  std::fill(heads_ptr, heads_ptr + NUM_HEADS + 1, MakeHead(0, -1));
   for (uint32_t i = 0; i < GC_POOL_SIZE_PER_SHARD; i++) {
-    free_queue_.data[i] = i;
+    free_queue_.TryPush(i);
   }
-  free_queue_.front.store(0, RE);
-  free_queue_.rear.store(GC_POOL_SIZE_PER_SHARD, RE);
+  free_size_.store(0, RE);
+  lost_size_.store(0, RE);
+}
+
+void PmemAllocator::Init(int id, char *pmem_base, uint64_t pmem_end,
+                         uint64_t *high_water_mark,
+                         LargeAllocator *large_allocator, Logger *logger) {
+  id_ = id;
+  pmem_base_ = pmem_base;
+  pmem_end_ = pmem_end;
+  high_water_mark_ = high_water_mark;
+  large_allocator_ = large_allocator;
+  logger_ = logger;
+  zeroed_end_.store(*high_water_mark_, RE);
+  large_allocator_->Reserve(*high_water_mark_);
 }
 
 void PmemAllocator::set_pmem_frontier(uint64_t pmem_frontier) {
@@ -57,47 +65,50 @@ void PmemAllocator::set_mode(Mode mode) {
 }
 
 void PmemAllocator::Deallocate(uint64_t ptr, uint32_t cap) {
-  std::atomic<int32_t> *head = heads_ + cap;
-
-  uint32_t idx = free_queue_.PopFront();
+  uint32_t idx;
+  if (!free_queue_.TryPop(&idx)) {
+    // the pool is used up, the range is given up rather than overwriting
+    // an entry that is still in a list
+    ShardFetchAdd(&lost_size_, (uint64_t)cap);
+    return;
+  }
   pool_[idx].ptr = ptr;
 
-  // insert
-  int32_t next = head->load(RE);
-  while (1) {
-    *(uint32_t *)&pool_[idx].next = next;
-    if (head->compare_exchange_strong(next, idx)) {
-      break;
-    }
-  }
+  auto head = heads_ + cap;
+  uint64_t prev = head->load(RE);
+  do {
+    pool_[idx].next.store(HeadIndex(prev), RE);
+  } while (!ShardCompareExchange(head, &prev, MakeHead(prev, idx)));
+  ShardFetchAdd(&free_size_, (uint64_t)cap);
 }
 
 bool PmemAllocator::TryAllocate(uint32_t cap, uint64_t *ptr) {
-  int32_t idx = heads_[cap].load(RE);
-  if (idx < 0) {
-    return false;
-  }
-  int32_t next = pool_[idx].next.load(RE);
-
+  auto head = heads_ + cap;
+  uint64_t prev = head->load(RE);
   while (1) {
-    if (heads_[cap].compare_exchange_strong(idx, next)) {
-      *ptr = pool_[idx].ptr;
-      free_queue_.PushBack(idx);
-      return true;
-    }
+    int32_t idx = HeadIndex(prev);
     if (idx < 0) {
       return false;
     }
-    next = pool_[idx].next.load(RE);
+    // may be stale if idx has been popped in the meantime, the tag makes
+    // the exchange fail then
+    int32_t next = pool_[idx].next.load(RE);
+    if (ShardCompareExchange(head, &prev, MakeHead(prev, next))) {
+      *ptr = pool_[idx].ptr;
+      // cannot fail, the queue has room for every entry of the pool
+      free_queue_.TryPush(idx);
+      ShardFetchSub(&free_size_, (uint64_t)cap);
+      return true;
+    }
   }
-
-  return false;
 }
 
 std::tuple<bool, uint64_t, uint32_t> PmemAllocator::InternalAllocate(
     uint32_t min_cap) {
   uint64_t ptr;
-  for (uint32_t cap = min_cap; cap <= NUM_HEADS; cap += ADDRESS_ALIGN_NUM) {
+  uint32_t max_cap = min_cap + SHRINK_SEARCH_RANGE;
+  if (max_cap > NUM_HEADS) max_cap = NUM_HEADS;
+  for (uint32_t cap = min_cap; cap <= max_cap; cap += ADDRESS_ALIGN_NUM) {
     if (TryAllocate(cap, &ptr)) {
       return make_tuple(true, ptr, cap);
     }
@@ -106,40 +117,98 @@ std::tuple<bool, uint64_t, uint32_t> PmemAllocator::InternalAllocate(
   return make_tuple(false, 0, 0);
 }
 
-std::tuple<uint64_t, uint32_t> PmemAllocator::Allocate(uint32_t size) {
+bool PmemAllocator::ReuseRange(uint32_t size, uint64_t *ptr, uint32_t *cap) {
+  bool found;
+  std::tie(found, *ptr, *cap) = InternalAllocate(size);
+  if (!found) {
+    return false;
+  }
+  if (*cap >= size + PmemRecord::min_record_size()) {
+    Deallocate(*ptr + size, *cap - size);
+    *cap = size;
+  }
+  return true;
+}
+
+std::tuple<uint64_t, uint32_t> PmemAllocator::Allocate(uint32_t size,
+                                                       bool reserve) {
   size = Align<ADDRESS_ALIGN_BITS>(size);
 
-  Mode mode = mode_.load(RE);
-  switch (mode) {
-    case kAppend: {
-      goto use_append;
-    }
-    case kShrink: {
-      bool found;
-      uint64_t ptr;
-      uint32_t cap;
-      std::tie(found, ptr, cap) = InternalAllocate(size);
-      if (found) {
-        if (cap < size + PmemRecord::min_record_size()) {
-          return make_tuple(ptr, cap);
-        } else {
-          Deallocate(ptr + size, cap - size);
-          return make_tuple(ptr, size);
-        }
-      } else {
-        goto use_append;
-      }
+  uint64_t ptr;
+  uint32_t cap;
+  // append mode only reuses freed ranges once the shard is full
+  bool shrink = mode_.load(RE) == kShrink;
+  if (shrink && ReuseRange(size, &ptr, &cap)) {
+    return make_tuple(ptr, cap);
+  }
+  if (AppendAllocate(size, reserve, &ptr)) {
+    return make_tuple(ptr, size);
+  }
+  if (!shrink && ReuseRange(size, &ptr, &cap)) {
+    return make_tuple(ptr, cap);
+  }
+  return make_tuple(0, 0);
+}
+
+bool PmemAllocator::AppendAllocate(uint32_t cap, bool reserve, uint64_t *ptr) {
+  uint64_t limit = large_allocator_->region_start();
+  if (!reserve) {
+    limit = limit > PMEM_RESERVE_SIZE ? limit - PMEM_RESERVE_SIZE : 0;
+  }
+  uint64_t frontier = pmem_frontier_.load(RE);
+  do {
+#ifdef USE_XPLINE_PLACEMENT
+    *ptr = PlaceOnXPLines(frontier, cap);
+#else
+    *ptr = frontier;
+#endif
+    // the frontier stays below the limit, past which the shard is full
+    if (*ptr + cap > limit) {
+      return false;
     }
+  } while (!ShardCompareExchange(&pmem_frontier_, &frontier, *ptr + cap));
+  // the extents may have grown over the range meanwhile, it is given up then
+  if (*ptr + cap > zeroed_end_.load(std::memory_order_acquire) &&
+      ZeroUpTo(*ptr + cap) < *ptr + cap) {
+    return false;
   }
+#ifdef USE_XPLINE_PLACEMENT
+  // the padding is only handed out once it has been zeroed
+  if (*ptr > frontier) Deallocate(frontier, *ptr - frontier);
+#endif
+  return true;
+}
 
-use_append:;
-  uint64_t ptr;
-  uint32_t cap;
-  std::tie(ptr, cap) = AppendAllocate(size);
-  return make_tuple(ptr, cap);
+#ifdef USE_XPLINE_PLACEMENT
+uint64_t PmemAllocator::PlaceOnXPLines(uint64_t frontier, uint32_t cap) {
+  uint64_t offset = (uint64_t)(pmem_base_ + frontier) % XPLINE_SIZE;
+  uint64_t min_xplines = (cap + XPLINE_SIZE - 1) / XPLINE_SIZE;
+  if (offset == 0 ||
+      (offset + cap + XPLINE_SIZE - 1) / XPLINE_SIZE <= min_xplines) {
+    return frontier;
+  }
+  return frontier - offset + XPLINE_SIZE;
+}
+#endif
+
+uint64_t PmemAllocator::ZeroUpTo(uint64_t end) {
+  std::lock_guard<SpinMutex> lock(zero_mtx_);
+  uint64_t from = zeroed_end_.load(RE);
+  // the extents stop growing once they reach the zeroed records
+  if (end <= from) return std::min(from, large_allocator_->region_start());
+
+  uint64_t to = std::min(Align<POOL_CHUNK_BITS>(end), pmem_end_);
+  // the extents of large values are never zeroed, and may not grow below
+  // the new mark anymore
+  uint64_t limit = std::min(large_allocator_->Reserve(to), to);
+  if (limit > from) {
+    PmemMemsetPersist(pmem_base_ + from, 0, limit - from);
+  }
+  // recovery only reads up to the mark, the zeroes must be durable first
+  *high_water_mark_ = to;
+  PmemPersist(high_water_mark_, sizeof(uint64_t));
+  zeroed_end_.store(to, std::memory_order_release);
+  return limit;
 }
 
-std::tuple<uint64_t, uint32_t> PmemAllocator::AppendAllocate(uint32_t cap) {
-  uint64_t ptr = pmem_frontier_.fetch_add(cap, RE);
-  return make_tuple(ptr, cap);
-}
\ No newline at end of file
+PROFILE_NAMESPACE_END
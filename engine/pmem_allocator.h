@@ -7,10 +7,16 @@
 #include <utility>
 
 #include "config.h"
+#include "large_allocator.h"
 #include "logger.h"
+#include "mpmc_queue.h"
 #include "record.h"
+#include "spsc_queue.h"
+#include "sync.h"
 #include "utils.h"
 
+PROFILE_NAMESPACE_BEGIN
+
 class PmemAllocator {
   friend class Engine;
   friend class SubEngine;
@@ -23,46 +29,96 @@ class PmemAllocator {
 
   PmemAllocator();
 
+  // the shard is zeroed lazily up to high_water_mark, which is persistent
+  void Init(int id, char* pmem_base, uint64_t pmem_end,
+            uint64_t* high_water_mark, LargeAllocator* large_allocator,
+            Logger* logger);
+
   void set_pmem_frontier(uint64_t pmem_frontier);
 
   void set_mode(Mode mode);
 
-  // returns (ptr, cap)
-  std::tuple<uint64_t, uint32_t> Allocate(uint32_t size);
+  // returns (ptr, cap), cap is 0 if the shard is full. The last
+  // PMEM_RESERVE_SIZE bytes before the extents are only handed out with
+  // reserve, to the records that make room for the others
+  std::tuple<uint64_t, uint32_t> Allocate(uint32_t size, bool reserve = false);
 
   void Deallocate(uint64_t ptr, uint32_t cap);
 
+  inline uint64_t pmem_frontier() { return pmem_frontier_.load(RE); }
+
+  // bytes in the free lists
+  inline uint64_t free_size() { return free_size_.load(RE); }
+
+  // bytes freed while the pool of free ranges was used up, they are only
+  // reclaimed by the next recovery
+  inline uint64_t lost_size() { return lost_size_.load(RE); }
+
+  // #entries of the pool that are not holding a free range
+  inline uint64_t num_spare_ranges() { return free_queue_.size(); }
+
  private:
   int id_;
   static const uint32_t NUM_HEADS =
       Align<ADDRESS_ALIGN_BITS>(PmemRecord::max_record_size());
 
+  char* pmem_base_;
   uint64_t pmem_start_, pmem_end_;
   std::atomic<uint64_t> pmem_frontier_;
+  // persistent, in the pool header
+  uint64_t* high_water_mark_;
+  std::atomic<uint64_t> zeroed_end_;
+  SpinMutex zero_mtx_;
+  LargeAllocator* large_allocator_;
   std::atomic<Mode> mode_;
+  std::atomic<uint64_t> free_size_;
+  std::atomic<uint64_t> lost_size_;
 
-  struct FreeQueue {
-    uint32_t data[GC_POOL_SIZE_PER_SHARD];
-    std::atomic<uint64_t> front, rear;
-
-    uint32_t PopFront();
-    void PushBack(uint32_t item);
-  };
+  // the entries of pool_ that are not in a free list
+#ifdef USE_SHARD_OWNER
+  SpscQueue<uint32_t> free_queue_;
+#else
+  MpmcQueue<uint32_t> free_queue_;
+#endif
 
   struct MemoryRange {
     uint64_t ptr;
     std::atomic<int32_t> next;
   };
 
-  FreeQueue free_queue_;
   MemoryRange pool_[GC_POOL_SIZE_PER_SHARD];
-  std::atomic<int32_t> heads_[NUM_HEADS + 1];
+  // the low 32 bits are the first entry of the list, or -1, and the high
+  // ones a tag bumped by every push and pop, so that a pop cannot succeed
+  // on a head that has been popped and pushed back in the meantime (ABA)
+  std::atomic<uint64_t> heads_[NUM_HEADS + 1];
   Logger* logger_;
 
+  static inline uint64_t MakeHead(uint64_t head, int32_t idx) {
+    return ((head >> 32) + 1) << 32 | (uint32_t)idx;
+  }
+  static inline int32_t HeadIndex(uint64_t head) { return (int32_t)head; }
+
   bool TryAllocate(uint32_t cap, uint64_t* ptr);
 
   std::tuple<bool, uint64_t, uint32_t> InternalAllocate(uint32_t min_cap);
-  std::tuple<uint64_t, uint32_t> AppendAllocate(uint32_t cap);
+  // takes a freed range for size bytes, the rest of a much larger one is
+  // freed again
+  bool ReuseRange(uint32_t size, uint64_t* ptr, uint32_t* cap);
+  // returns false once the records would reach limit, which is
+  // PMEM_RESERVE_SIZE below the extents unless reserve is set
+  bool AppendAllocate(uint32_t cap, bool reserve, uint64_t* ptr);
+#ifdef USE_XPLINE_PLACEMENT
+  // where a record of cap bytes appended at frontier goes: on the next
+  // XPLine if that makes it touch fewer of them, so that records fitting in
+  // an XPLine never cross one and no XPLine is written in part twice
+  uint64_t PlaceOnXPLines(uint64_t frontier, uint32_t cap);
+#endif
+  // zeroes the chunks of the shard up to end before records are written
+  // there, returns how far records may go, which is short of end once the
+  // extents have taken the rest of the shard
+  uint64_t ZeroUpTo(uint64_t end);
 };
 
+PROFILE_NAMESPACE_END
+
 #endif
\ No newline at end of file
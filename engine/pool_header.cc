@@ -0,0 +1,45 @@
+#include "pool_header.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "persist.h"
+#include "record.h"
+#include "txn_log.h"
+#include "utils.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+namespace {
+const char POOL_MAGIC[8] = {'T', 'A', 'I', 'R', 'P', 'O', 'O', 'L'};
+}  // namespace
+
+PoolHeader::Format PoolHeader::format() {
+  if (memcmp(magic, POOL_MAGIC, sizeof(magic)) != 0) return kLegacy;
+  if (num_shards != NUM_SHARDS) return kUnknown;
+  if (version != POOL_FORMAT_VERSION) return kUnknown;
+  return kCurrent;
+}
+
+void PoolHeader::Create(char* pmem_base, uint64_t pool_size) {
+  auto header = (PoolHeader*)pmem_base;
+  header->version = POOL_FORMAT_VERSION;
+  header->num_shards = NUM_SHARDS;
+  header->pool_size = pool_size;
+
+  uint64_t shard_size = (pool_size - POOL_HEADER_SIZE) / NUM_SHARDS;
+  shard_size = std::min(shard_size, MAX_PMEM_SIZE_PER_SHARD);
+  // shards start on an XPLine, where the placement of records begins
+  header->shard_size = shard_size & ~(XPLINE_SIZE - 1);
+  std::fill(header->large_region_sizes,
+            header->large_region_sizes + NUM_SHARDS, 0);
+  std::fill(header->high_water_marks, header->high_water_marks + NUM_SHARDS,
+            0);
+  PmemPersist(header, sizeof(PoolHeader));
+  TxnLog::Format(pmem_base + TXN_LOG_OFFSET);
+
+  // the magic goes last, a torn header reads as an empty legacy pool
+  PmemMemcpyPersist(header->magic, POOL_MAGIC, sizeof(POOL_MAGIC));
+}
+
+PROFILE_NAMESPACE_END
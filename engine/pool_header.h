@@ -0,0 +1,49 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_POOL_HEADER_H_
+#define TAIR_CONTEST_KV_CONTEST_POOL_HEADER_H_
+
+#include <stdint.h>
+
+#include "config.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Header at the beginning of the pool, followed by the shards. Pools of the
+// v1 format have no header, their shards start right at the beginning.
+struct PoolHeader {
+  enum Format : uint8_t {
+    kCurrent,
+    // v1 pool, to be migrated
+    kLegacy,
+    // written by a newer version or with another NUM_SHARDS
+    kUnknown,
+  };
+
+  char magic[8];
+  uint32_t version;
+  uint32_t num_shards;
+  uint64_t pool_size;
+  uint64_t shard_size;
+  // size of the region at the end of every shard that holds the extents of
+  // large values, see LargeAllocator
+  uint64_t large_region_sizes[NUM_SHARDS];
+  // end of the zeroed prefix of every shard, records are only written and
+  // searched below it, so that a new pool does not have to be zeroed whole
+  uint64_t high_water_marks[NUM_SHARDS];
+
+  Format format();
+
+  inline char* shard_base(uint32_t i) {
+    return (char*)this + POOL_HEADER_SIZE + shard_size * i;
+  }
+
+  // initializes the header of a new pool and persists it, the rest of the
+  // pool is left as it is
+  static void Create(char* pmem_base, uint64_t pool_size);
+};
+
+static_assert(sizeof(PoolHeader) <= TXN_LOG_OFFSET,
+              "PoolHeader overlaps the TxnLog");
+
+PROFILE_NAMESPACE_END
+
+#endif
@@ -0,0 +1,30 @@
+#include "profiles.h"
+
+#include "common/db.h"
+
+// the engines of all profiles, see engine.h
+#define DECLARE_OPEN_ENGINE(p)                                  \
+  namespace PROFILE_NAMESPACE_NAME(p) {                         \
+  Status OpenEngine(const std::string& name, DB** dbptr,        \
+                    FILE* log_file);                            \
+  }
+ENGINE_PROFILES(DECLARE_OPEN_ENGINE)
+#undef DECLARE_OPEN_ENGINE
+
+Status DB::CreateOrOpen(const std::string& name, DB** dbptr, FILE* log_file) {
+  return PROFILE_NAMESPACE_NAME(DEFAULT_ENGINE_PROFILE)::OpenEngine(
+      name, dbptr, log_file);
+}
+
+Status DB::CreateOrOpen(const std::string& name, const std::string& profile,
+                        DB** dbptr, FILE* log_file) {
+#define OPEN_ENGINE(p)                                                  \
+  if (profile == EngineTraits<Profile::p>::Name()) {                    \
+    return PROFILE_NAMESPACE_NAME(p)::OpenEngine(name, dbptr, log_file); \
+  }
+  ENGINE_PROFILES(OPEN_ENGINE)
+#undef OPEN_ENGINE
+  return NotFound;
+}
+
+DB::~DB() {}
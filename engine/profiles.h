@@ -0,0 +1,106 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_PROFILES_H_
+#define TAIR_CONTEST_KV_CONTEST_PROFILES_H_
+
+#include <stdint.h>
+
+// Workload profiles. The engine is compiled once per profile of
+// ENGINE_PROFILES, with -DENGINE_PROFILE=<profile>, into an inline namespace
+// of its own whose constants come from EngineTraits<profile>, see config.h.
+// The hot path of every profile is specialised at compile time, and
+// DB::CreateOrOpen picks one of them by name at runtime.
+enum class Profile : uint8_t {
+  kContest,
+  kSmall,
+  kDebug,
+  kDebugFewShards,
+};
+
+template <Profile P>
+struct EngineTraits;
+
+// the contest: 16 threads, 24M sets each, on 64 GiB of pmem
+template <>
+struct EngineTraits<Profile::kContest> {
+  static const char* Name() { return "contest"; }
+  static constexpr uint64_t NUM_THREADS = 16;
+  static constexpr uint64_t KEY_SIZE = 16;
+  static constexpr uint32_t NUM_SHARDS = 64;
+  static constexpr uint64_t PMEM_SIZE = 64ull * (1ull << 30);
+  static constexpr uint64_t NUM_KEYS = NUM_THREADS * 24 * (1 << 20);
+  static constexpr double UNIQUE_KEYS_RATIO = 0.6;
+  // #sets after which freed ranges are reused instead of appending
+  static constexpr uint64_t SHRINK_CKPT = 220200960;
+  static constexpr uint64_t LOG_FREQ = 1 << 20;
+  static constexpr uint64_t INLINE_SLAB_SIZE_PER_SHARD = 8 * (1 << 20);
+  static constexpr uint32_t TIER_BATCH_SIZE = 1 << 20;
+  static constexpr uint32_t POOL_CHUNK_BITS = 22;
+};
+
+// a quarter of the contest machine
+template <>
+struct EngineTraits<Profile::kSmall> {
+  static const char* Name() { return "small"; }
+  static constexpr uint64_t NUM_THREADS = 4;
+  static constexpr uint64_t KEY_SIZE = 16;
+  static constexpr uint32_t NUM_SHARDS = 16;
+  static constexpr uint64_t PMEM_SIZE = 16ull * (1ull << 30);
+  static constexpr uint64_t NUM_KEYS = NUM_THREADS * 24 * (1 << 20);
+  static constexpr double UNIQUE_KEYS_RATIO = 0.6;
+  static constexpr uint64_t SHRINK_CKPT = NUM_KEYS / 64 * 35;
+  static constexpr uint64_t LOG_FREQ = 1 << 20;
+  static constexpr uint64_t INLINE_SLAB_SIZE_PER_SHARD = 8 * (1 << 20);
+  static constexpr uint32_t TIER_BATCH_SIZE = 1 << 20;
+  static constexpr uint32_t POOL_CHUNK_BITS = 22;
+};
+
+template <>
+struct EngineTraits<Profile::kDebug> {
+  static const char* Name() { return "debug"; }
+  static constexpr uint64_t NUM_THREADS = 16;
+  static constexpr uint64_t KEY_SIZE = 16;
+  static constexpr uint32_t NUM_SHARDS = 64;
+  static constexpr uint64_t PMEM_SIZE = 16 * (1 << 20);
+  static constexpr uint64_t NUM_KEYS = NUM_THREADS * 1000;
+  static constexpr double UNIQUE_KEYS_RATIO = 0.6;
+  static constexpr uint64_t SHRINK_CKPT = 220200960;
+  static constexpr uint64_t LOG_FREQ = 1;
+  static constexpr uint64_t INLINE_SLAB_SIZE_PER_SHARD = 16 * (1 << 10);
+  static constexpr uint32_t TIER_BATCH_SIZE = 1 << 16;
+  static constexpr uint32_t POOL_CHUNK_BITS = 14;
+};
+
+// the debug profile with fewer and larger shards
+template <>
+struct EngineTraits<Profile::kDebugFewShards> {
+  static const char* Name() { return "debug_few_shards"; }
+  static constexpr uint64_t NUM_THREADS = 4;
+  static constexpr uint64_t KEY_SIZE = 16;
+  static constexpr uint32_t NUM_SHARDS = 8;
+  static constexpr uint64_t PMEM_SIZE = 16 * (1 << 20);
+  static constexpr uint64_t NUM_KEYS = NUM_THREADS * 1000;
+  static constexpr double UNIQUE_KEYS_RATIO = 0.6;
+  static constexpr uint64_t SHRINK_CKPT = NUM_KEYS / 64 * 35;
+  static constexpr uint64_t LOG_FREQ = 1;
+  static constexpr uint64_t INLINE_SLAB_SIZE_PER_SHARD = 16 * (1 << 10);
+  static constexpr uint32_t TIER_BATCH_SIZE = 1 << 16;
+  static constexpr uint32_t POOL_CHUNK_BITS = 14;
+};
+
+// the profiles built into the engine, the first one is the default; the
+// build compiles the engine once for each of them
+#ifdef LOCAL_DEBUG
+#define ENGINE_PROFILES(X) \
+  X(kDebug)                \
+  X(kDebugFewShards)
+#define DEFAULT_ENGINE_PROFILE kDebug
+#else
+#define ENGINE_PROFILES(X) \
+  X(kContest)              \
+  X(kSmall)
+#define DEFAULT_ENGINE_PROFILE kContest
+#endif
+
+#define PROFILE_NAMESPACE_NAME_(profile) profile_##profile
+#define PROFILE_NAMESPACE_NAME(profile) PROFILE_NAMESPACE_NAME_(profile)
+
+#endif
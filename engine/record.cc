@@ -2,18 +2,76 @@
 
 #include <x86intrin.h>
 
+#include <algorithm>
+
 #include "utils.h"
 
+PROFILE_NAMESPACE_BEGIN
+
 bool PmemRecord::Intact() {
   if (head != PMEM_RECORD_HEAD) return false;
+  if (flags & ~FLAGS_MASK) return false;
+  if (stored_len() > MAX_VALUE_LEN) return false;
+  if (stored_len() < (expires() ? EXPIRY_SIZE : 0) +
+                         (transactional() ? TXID_SIZE : 0)) {
+    return false;
+  }
+  if (this->record_size() > cap()) return false;
+  return CalcDigest(key, value, stored_len(), cap(), timestamp, flags) ==
+         digest;
+}
+
+uint16_t PmemRecord::CalcDigest(char *key, char *value, uint32_t value_len,
+                                uint32_t cap, uint64_t timestamp,
+                                uint8_t flags) {
+  uint64_t code = *(uint64_t *)key + *(uint64_t *)(key + 8) * 3 +
+                  value_len * 7 + cap * 11 + timestamp * 13 + flags;
+  // every word of the value, the tail may overlap the key. A record torn by
+  // a crash may have any of its words missing
+  for (uint32_t i = 0; i < value_len; i += sizeof(uint64_t)) {
+    uint32_t offset = std::min<uint32_t>(i + sizeof(uint64_t), value_len);
+    code = code * 31 + *(uint64_t *)(value + offset - sizeof(uint64_t));
+  }
+  code ^= code >> 32;
+  code ^= code >> 16;
+  return code & 0xffff;
+}
+
+PmemRecord::PmemRecord(char *key, char *value, uint32_t value_len, uint32_t cap,
+                       uint64_t timestamp, uint8_t flags) {
+  InitHeader(key, value, value_len, cap, timestamp, flags);
+  memcpy(this->key, key, KEY_SIZE);
+  memcpy(this->value, value, value_len);
+}
+
+void PmemRecord::InitHeader(char *key, char *value, uint32_t value_len,
+                            uint32_t cap, uint64_t timestamp, uint8_t flags) {
+  this->head = PMEM_RECORD_HEAD;
+  this->flags = flags;
+  set_value_len(value_len);
+  set_cap(cap);
+  this->timestamp = timestamp;
+  this->reserved_ = 0;
+  this->digest = CalcDigest(key, value, this->stored_len(), this->cap(),
+                            timestamp, flags);
+}
+
+uint32_t PmemRecord::record_size() {
+  return PmemRecord::record_size(stored_len());
+}
+
+bool PmemRecordV1::Intact() {
+  if (head != PMEM_RECORD_V1_HEAD && head != PMEM_RECORD_V1_COMPRESSED_HEAD) {
+    return false;
+  }
   if (!(80 <= value_len() && value_len() <= 1024)) return false;
   if (this->record_size() > cap()) return false;
   bool ret = CalcDigest(key, value, value_len(), cap(), timestamp) == digest;
   return ret;
 }
 
-uint16_t PmemRecord::CalcDigest(char *key, char *value, uint32_t value_len,
-                                uint32_t cap, uint32_t timestamp) {
+uint16_t PmemRecordV1::CalcDigest(char *key, char *value, uint32_t value_len,
+                                  uint32_t cap, uint32_t timestamp) {
 #ifdef USE_STRICT_DIGEST
   // strict check code
   // TODO: optimize me
@@ -48,9 +106,9 @@ uint16_t PmemRecord::CalcDigest(char *key, char *value, uint32_t value_len,
   uint16_t code = 0;
   uint16_t *key_arr = reinterpret_cast<uint16_t *>(key);
   uint16_t *value_arr = reinterpret_cast<uint16_t *>(value);
-  value_len = std::min((uint16_t)1024, value_len);
+  value_len = std::min<uint32_t>(1024, value_len);
   code += key_arr[0] + key_arr[2] * 3 + key_arr[1] * 5 + key_arr[3] * 7;
-  uint16_t len = std::min(value_len / 4, 256);
+  uint16_t len = std::min<uint32_t>(value_len / 4, 256);
   for (int i = 0; i < len; i += 4) {
     code += (value_arr[i] ^ rand_nums[i]);
   }
@@ -65,9 +123,9 @@ uint16_t PmemRecord::CalcDigest(char *key, char *value, uint32_t value_len,
 #endif
 }
 
-PmemRecord::PmemRecord(char *key, char *value, uint32_t value_len, uint32_t cap,
-                       uint32_t timestamp) {
-  this->head = PMEM_RECORD_HEAD;
+PmemRecordV1::PmemRecordV1(char *key, char *value, uint32_t value_len,
+                           uint32_t cap, uint32_t timestamp, uint8_t head) {
+  this->head = head;
   set_value_len(value_len);
   set_cap(cap);
   this->digest =
@@ -77,6 +135,8 @@ PmemRecord::PmemRecord(char *key, char *value, uint32_t value_len, uint32_t cap,
   memcpy(this->value, value, value_len);
 }
 
-uint32_t PmemRecord::record_size() {
-  return PmemRecord::record_size(value_len());
+uint32_t PmemRecordV1::record_size() {
+  return PmemRecordV1::record_size(value_len());
 }
+
+PROFILE_NAMESPACE_END
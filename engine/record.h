@@ -2,11 +2,159 @@
 #define TAIR_CONTEST_KV_CONTEST_RECORD_H_
 
 #include <atomic>
+#include <cstring>
 
 #include "common/db.h"
 #include "config.h"
 
+PROFILE_NAMESPACE_BEGIN
+
 struct __attribute__((packed)) PmemRecord {
+  static constexpr uint32_t VALUE_LEN_BITS = 17;
+  // in units of ADDRESS_ALIGN_NUM
+  static constexpr uint32_t CAP_BITS = 15;
+  static constexpr uint32_t TIMESTAMP_BITS = 48;
+
+  // value holds the output of CompressValue
+  static constexpr uint8_t FLAG_COMPRESSED = 1 << 0;
+  // value holds an ExtentTable
+  static constexpr uint8_t FLAG_LARGE = 1 << 1;
+  // value holds a ColdRef
+  static constexpr uint8_t FLAG_COLD = 1 << 2;
+  // the stored value ends with the expiry of the record, see expiry()
+  static constexpr uint8_t FLAG_TTL = 1 << 3;
+  // the stored value ends with the id of the transaction that wrote the
+  // record, after the expiry, see txid()
+  static constexpr uint8_t FLAG_TXN = 1 << 4;
+  static constexpr uint8_t FLAGS_MASK =
+      FLAG_COMPRESSED | FLAG_LARGE | FLAG_COLD | FLAG_TTL | FLAG_TXN;
+
+  static constexpr uint32_t EXPIRY_SIZE = sizeof(uint64_t);
+  static constexpr uint32_t TXID_SIZE = sizeof(uint64_t);
+
+  static constexpr uint32_t HEADER_SIZE = 16;
+
+  static_assert(MAX_VALUE_LEN < (1u << VALUE_LEN_BITS),
+                "VALUE_LEN_BITS is not sufficient for MAX_VALUE_LEN");
+
+ public:
+  uint8_t head;
+  uint8_t flags;
+  uint16_t digest;
+
+ private:
+  // length of value, with the expiry and the txid
+  uint32_t value_len_ : VALUE_LEN_BITS;
+  // total capacity of the whole record
+  uint32_t cap_ : CAP_BITS;
+
+ public:
+  uint64_t timestamp : TIMESTAMP_BITS;
+
+ private:
+  uint64_t reserved_ : 64 - TIMESTAMP_BITS;
+
+ public:
+  char key[KEY_SIZE];
+  char value[80];
+
+  PmemRecord(char *key, char *value, uint32_t value_len, uint32_t cap,
+             uint64_t timestamp, uint8_t flags = 0);
+  // fills only the HEADER_SIZE bytes before the key, which may be a buffer
+  // of their own, for a record of key and value. value_len is the stored
+  // length, with the expiry and the txid
+  void InitHeader(char *key, char *value, uint32_t value_len, uint32_t cap,
+                  uint64_t timestamp, uint8_t flags);
+  bool Intact();
+
+  inline bool compressed() { return flags & FLAG_COMPRESSED; }
+  inline bool large() { return flags & FLAG_LARGE; }
+  inline bool cold() { return flags & FLAG_COLD; }
+  inline bool expires() { return flags & FLAG_TTL; }
+  inline bool transactional() { return flags & FLAG_TXN; }
+
+  // length of value, without the expiry and the txid
+  inline uint32_t value_len() {
+    return this->value_len_ - (expires() ? EXPIRY_SIZE : 0) -
+           (transactional() ? TXID_SIZE : 0);
+  }
+  // length of value as stored
+  inline uint32_t stored_len() { return this->value_len_; }
+  inline uint32_t set_value_len(uint32_t value_len) {
+    return this->value_len_ = value_len;
+  }
+  // in ms since the unix epoch, 0 if the record never expires
+  inline uint64_t expiry() {
+    uint64_t expiry = 0;
+    if (expires()) memcpy(&expiry, value + value_len(), EXPIRY_SIZE);
+    return expiry;
+  }
+  // see TxnLog, 0 if the record has not been written by a transaction
+  inline uint64_t txid() {
+    uint64_t txid = 0;
+    if (transactional()) {
+      memcpy(&txid, value + value_len_ - TXID_SIZE, TXID_SIZE);
+    }
+    return txid;
+  }
+  inline uint32_t cap() { return this->cap_ << ADDRESS_ALIGN_BITS; }
+  inline uint32_t set_cap(uint32_t cap) {
+    return this->cap_ = cap >> ADDRESS_ALIGN_BITS;
+  }
+
+  uint32_t record_size();
+
+  constexpr static uint32_t min_value_len() { return 0; }
+  constexpr static uint32_t min_record_size() {
+    return PmemRecord::record_size(min_value_len());
+  }
+  constexpr static uint32_t max_record_size() {
+    return PmemRecord::record_size(MAX_VALUE_LEN);
+  }
+  constexpr static uint32_t record_size(uint32_t value_len) {
+    return sizeof(PmemRecord) - sizeof(value) + value_len;
+  }
+
+  static uint16_t CalcDigest(char *key, char *value, uint32_t value_len,
+                             uint32_t cap, uint64_t timestamp, uint8_t flags);
+};
+
+static_assert(PmemRecord::record_size(0) ==
+                  PmemRecord::HEADER_SIZE + KEY_SIZE,
+              "PmemRecord head not aligned");
+
+// Value of a large record, the value itself is split into extents allocated
+// by LargeAllocator.
+struct ExtentTable {
+  static constexpr uint32_t MAX_EXTENTS = MAX_LARGE_VALUE_LEN / MAX_EXTENT_SIZE;
+
+  struct Extent {
+    // offset in the shard, in the encoding of MemRecord::ptr
+    uint32_t ptr;
+    uint32_t len;
+  };
+
+  uint32_t value_len;
+  uint32_t num_extents;
+  Extent extents[MAX_EXTENTS];
+
+  inline uint32_t size() {
+    return sizeof(ExtentTable) - sizeof(extents) + num_extents * sizeof(Extent);
+  }
+};
+
+static_assert(sizeof(ExtentTable) <= LARGE_VALUE_MIN_LEN,
+              "ExtentTable is larger than the values it replaces");
+
+// Value of a stub record, the record itself has been demoted to the cold
+// tier, where it is stored as is.
+struct __attribute__((packed)) ColdRef {
+  uint64_t offset;
+  uint32_t len;
+};
+
+// Record of the v1 pool format, only read when migrating a v1 pool.
+struct __attribute__((packed)) PmemRecordV1 {
   static constexpr uint32_t HEAD_BITS = 8;
   static constexpr uint32_t VALUE_LEN_BITS = 10;
   static constexpr uint32_t CAP_BITS = 11;
@@ -17,7 +165,7 @@ struct __attribute__((packed)) PmemRecord {
                  TIMESTAMP_BITS) %
                         8 ==
                     0,
-                "PmemRecord head not aligned");
+                "PmemRecordV1 head not aligned");
 
  public:
   uint16_t head : HEAD_BITS;
@@ -34,10 +182,13 @@ struct __attribute__((packed)) PmemRecord {
   char key[KEY_SIZE];
   char value[80];
 
-  PmemRecord(char *key, char *value, uint32_t value_len, uint32_t cap,
-             uint32_t timestamp);
+  PmemRecordV1(char *key, char *value, uint32_t value_len, uint32_t cap,
+               uint32_t timestamp, uint8_t head = PMEM_RECORD_V1_HEAD);
   bool Intact();
 
+  // value holds the output of CompressValue
+  inline bool compressed() { return head == PMEM_RECORD_V1_COMPRESSED_HEAD; }
+
   inline uint32_t value_len() { return 80 + this->value_len_; }
   inline uint32_t set_value_len(uint32_t value_len) {
     return this->value_len_ = value_len - 80;
@@ -47,14 +198,8 @@ struct __attribute__((packed)) PmemRecord {
 
   uint32_t record_size();
 
-  constexpr static uint32_t min_record_size() {
-    return PmemRecord::record_size(80);
-  }
-  constexpr static uint32_t max_record_size() {
-    return PmemRecord::record_size(1024);
-  }
   constexpr static uint32_t record_size(uint32_t value_len) {
-    return sizeof(PmemRecord) - sizeof(value) + value_len;
+    return sizeof(PmemRecordV1) - sizeof(value) + value_len;
   }
 
   static uint16_t CalcDigest(char *key, char *value, uint32_t value_len,
@@ -63,12 +208,24 @@ struct __attribute__((packed)) PmemRecord {
 
 struct MemRecord {
   int32_t next;
+  // offset in the shard, in units of ADDRESS_ALIGN_NUM
   std::atomic<uint32_t> ptr;
 
-#ifndef LOCAL_DEBUG
-  static_assert(NUM_SHARDS >= 64,
-                "ptr is not sufficient to reference this scale");
-#endif
+  // ptr of a node abandoned by an insert that lost the race for its key. The
+  // last unit of a shard belongs to the extents, never to a record
+  static constexpr uint32_t DEAD = UINT32_MAX;
+
+  static inline uint32_t EncodePtr(uint64_t ptr) {
+    return ptr >> ADDRESS_ALIGN_BITS;
+  }
+  static inline uint64_t DecodePtr(uint32_t ptr) {
+    return (uint64_t)ptr << ADDRESS_ALIGN_BITS;
+  }
 };
 
+// largest shard MemRecord::ptr can address
+const uint64_t MAX_PMEM_SIZE_PER_SHARD = (1ull << 32) << ADDRESS_ALIGN_BITS;
+
+PROFILE_NAMESPACE_END
+
 #endif
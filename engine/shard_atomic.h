@@ -0,0 +1,76 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_SHARD_ATOMIC_H_
+#define TAIR_CONTEST_KV_CONTEST_SHARD_ATOMIC_H_
+
+#include <atomic>
+
+#include "config.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Read-modify-writes of the index and allocator of a shard. In shard-owner
+// mode a shard is only touched by the thread owning it, so they are done
+// with plain loads and stores instead of locked instructions.
+
+template <typename T>
+inline T ShardFetchAdd(std::atomic<T>* x, T delta) {
+#ifdef USE_SHARD_OWNER
+  T prev = x->load(RE);
+  x->store(prev + delta, RE);
+  return prev;
+#else
+  return x->fetch_add(delta, RE);
+#endif
+}
+
+template <typename T>
+inline T ShardFetchSub(std::atomic<T>* x, T delta) {
+#ifdef USE_SHARD_OWNER
+  T prev = x->load(RE);
+  x->store(prev - delta, RE);
+  return prev;
+#else
+  return x->fetch_sub(delta, RE);
+#endif
+}
+
+template <typename T>
+inline T ShardFetchOr(std::atomic<T>* x, T bits) {
+#ifdef USE_SHARD_OWNER
+  T prev = x->load(RE);
+  x->store(prev | bits, RE);
+  return prev;
+#else
+  return x->fetch_or(bits, RE);
+#endif
+}
+
+template <typename T>
+inline T ShardFetchAnd(std::atomic<T>* x, T bits) {
+#ifdef USE_SHARD_OWNER
+  T prev = x->load(RE);
+  x->store(prev & bits, RE);
+  return prev;
+#else
+  return x->fetch_and(bits, RE);
+#endif
+}
+
+// on failure expected receives the current value
+template <typename T>
+inline bool ShardCompareExchange(std::atomic<T>* x, T* expected, T desired) {
+#ifdef USE_SHARD_OWNER
+  T current = x->load(RE);
+  if (current != *expected) {
+    *expected = current;
+    return false;
+  }
+  x->store(desired, RE);
+  return true;
+#else
+  return x->compare_exchange_strong(*expected, desired);
+#endif
+}
+
+PROFILE_NAMESPACE_END
+
+#endif
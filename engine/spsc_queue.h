@@ -0,0 +1,66 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_SPSC_QUEUE_H_
+#define TAIR_CONTEST_KV_CONTEST_SPSC_QUEUE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+
+#include "config.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Bounded queue for exactly one producer and one consumer. Each side owns
+// one index and only reads the other one, so no read-modify-write is needed.
+template <typename T>
+class SpscQueue {
+ public:
+  // capacity is rounded up to a power of 2
+  explicit SpscQueue(uint64_t capacity) {
+    uint64_t size = 1;
+    while (size < capacity) size <<= 1;
+    items_.reset(new T[size]);
+    mask_ = size - 1;
+    front_.store(0, RE);
+    rear_.store(0, RE);
+  }
+
+  // returns false if the queue is full
+  bool TryPush(const T& item) {
+    uint64_t rear = rear_.load(RE);
+    if (rear - front_.load(std::memory_order_acquire) > mask_) return false;
+    items_[rear & mask_] = item;
+    rear_.store(rear + 1, std::memory_order_release);
+    return true;
+  }
+
+  // returns false if the queue is empty
+  bool TryPop(T* item) {
+    uint64_t front = front_.load(RE);
+    if (front == rear_.load(std::memory_order_acquire)) return false;
+    *item = items_[front & mask_];
+    front_.store(front + 1, std::memory_order_release);
+    return true;
+  }
+
+  // only a snapshot while the queue is in use
+  uint64_t size() {
+    uint64_t front = front_.load(RE);
+    uint64_t rear = rear_.load(RE);
+    return rear > front ? rear - front : 0;
+  }
+
+ private:
+  std::unique_ptr<T[]> items_;
+  uint64_t mask_;
+  // the two sides do not share a cache line, without making the queue
+  // over-aligned for new
+  char padding0_[64];
+  std::atomic<uint64_t> front_;
+  char padding1_[64 - sizeof(std::atomic<uint64_t>)];
+  std::atomic<uint64_t> rear_;
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
@@ -1,19 +1,25 @@
 #include "subengine.h"
 
-#include <libpmem.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstddef>
+#include <cstdlib>
+#include <limits>
 #include <mutex>
+#include <string>
+#include <thread>
 #include <tuple>
+#include <vector>
 
+#include "compress.h"
 #include "config.h"
+#include "persist.h"
+#include "pool_header.h"
+#include "shard_atomic.h"
 #include "utils.h"
 
-#ifdef LOCAL_DEBUG
-#define PMEM_MEMCPY(a, b, c) pmem_memcpy_persist(a, b, c)
-#else
-#define PMEM_MEMCPY(a, b, c) pmem_memcpy(a, b, c, PMEM_F_MEM_NONTEMPORAL)
-#endif
+PROFILE_NAMESPACE_BEGIN
 
 using TP = std::chrono::high_resolution_clock::time_point;
 
@@ -42,23 +48,85 @@ double ElapsedSeconds(const TP& from, const TP& to) {
              .count() /
          1e3;
 }
+
+// records are written with their whole capacity
+const uint32_t MAX_RECORD_CAP =
+    Align<ADDRESS_ALIGN_BITS>(PmemRecord::max_record_size());
+// records that are not larger than a stub stay in pmem
+const uint32_t STUB_CAP =
+    Align<ADDRESS_ALIGN_BITS>(PmemRecord::record_size(sizeof(ColdRef)));
+// an expired record is replaced with a tombstone of its key and expiry,
+// which only makes room if the record is larger
+const uint32_t TOMBSTONE_CAP = Align<ADDRESS_ALIGN_BITS>(
+    PmemRecord::record_size(PmemRecord::EXPIRY_SIZE));
+#ifdef USE_EVICTION
+// the tombstone of an evicted record has expired long ago
+const uint64_t EVICTED_EXPIRY = 1;
+#endif
+
+// the version of a record, as Get tells it
+uint64_t VersionOf(PmemRecord* pmem_record) {
+  return Expired(pmem_record->expiry()) ? 0 : pmem_record->timestamp + 1;
+}
+
+// a value written by Increment
+bool ParseNumber(const std::string& value, int64_t* number) {
+  if (value.empty() || value.size() > 20) return false;
+  char* end;
+  errno = 0;
+  long long n = strtoll(value.c_str(), &end, 10);
+  if (errno != 0 || end != value.c_str() + value.size()) return false;
+  *number = n;
+  return true;
+}
 }  // namespace
 
+
 TP SubEngine::key_timestamps_[3] = {};
 
-void SubEngine::Init(int id, char* pmem_base, Logger* logger) {
-  pmem_allocator_.id_ = id_ = id;
-  pmem_allocator_.logger_ = logger_ = logger;
+void SubEngine::Init(int id, char* pmem_base, uint64_t pmem_size,
+                     uint64_t* large_region_size, uint64_t* high_water_mark,
+                     Logger* logger, Flusher* flusher, ColdTier* cold_tier,
+                     TxnLog* txn_log) {
+  id_ = id;
+  logger_ = logger;
+  flusher_ = flusher;
+  cold_tier_ = cold_tier;
+  txn_log_ = txn_log;
 
   pmem_base_ = pmem_base;
 
+  num_sets_.store(0, RE);
+  num_combined_sets_.store(0, RE);
+  num_demoted_.store(0, RE);
+  num_promoted_.store(0, RE);
+  num_get_misses_.store(0, RE);
+  num_filter_false_positives_.store(0, RE);
+  num_expired_.store(0, RE);
+  num_evicted_.store(0, RE);
+  num_out_of_memory_.store(0, RE);
+#ifdef USE_EVICTION
+  evict_hand_ = 0;
+#endif
+  clock_hand_ = 0;
+  for (uint32_t i = 0; i < NUM_COMBINERS_PER_SHARD; i++) {
+    combiners_[i].pending.store(nullptr, RE);
+  }
+
   logger_->LogWithTime("[engine #%d] SubEngine::Init()", id_);
 
-  uint64_t pmem_frontier = hash_index_.Reconstruct(pmem_base_);
+  large_allocator_.Init(pmem_size, large_region_size,
+                        &pmem_allocator_.pmem_frontier_);
+  uint64_t pmem_frontier = hash_index_.Reconstruct(
+      pmem_base_, std::min(*high_water_mark, large_allocator_.region_start()),
+      txn_log_);
+  pmem_allocator_.Init(id_, pmem_base_, pmem_size, high_water_mark,
+                       &large_allocator_, logger_);
 
-  pmem_allocator_.pmem_end_ = PMEM_SIZE_PER_SHARD;
   pmem_allocator_.set_pmem_frontier(pmem_frontier);
   pmem_allocator_.set_mode(PmemAllocator::kAppend);
+  RecoverExtents();
+  RecoverExpiries();
 
   logger_->Log(
       "[engine #%d] Hash index has been reconstructed. #recovered_keys = %u",
@@ -68,20 +136,553 @@ void SubEngine::Init(int id, char* pmem_base, Logger* logger) {
 
 SubEngine::~SubEngine() {}
 
-Status SubEngine::Get(const Slice& key, std::string* value) {
+Status SubEngine::Get(const Slice& key, std::string* value,
+                      uint64_t* expiry, uint64_t* version) {
+  if (version != nullptr) *version = 0;
   auto idx = hash_index_.Find(key);
   if (idx < 0) {
+    ShardFetchAdd(&num_get_misses_, (uint64_t)1);
+#ifdef USE_BLOOM_FILTER
+    // only on the miss path, the block is still in the cache
+    if (hash_index_.MayContain(key)) {
+      ShardFetchAdd(&num_filter_false_positives_, (uint64_t)1);
+    }
+#endif
     return NotFound;
   } else {
+#ifdef USE_REFERENCE_BITS
+    bool referenced = hash_index_.Reference(idx);
+#else
+    bool referenced = false;
+#endif
+#ifdef USE_INLINE_VALUES
+    // a mirrored value does not tell its version
+    uint64_t inline_expiry;
+    if (version == nullptr &&
+        hash_index_.FetchInlineValue(idx, value, &inline_expiry)) {
+      if (Expired(inline_expiry)) return NotFound;
+      if (expiry != nullptr) *expiry = inline_expiry;
+      return Ok;
+    }
+#endif
     auto pmem_record = hash_index_.FetchPmemRecord(idx);
-    char* from = pmem_record->value;
-    char* to = pmem_record->value + pmem_record->value_len();
-    *value = std::string(from, to);
+    uint64_t timestamp = pmem_record->timestamp;
+    // the sweeper reclaims the record later on, if it is still there
+    uint64_t record_expiry = pmem_record->expiry();
+    if (Expired(record_expiry)) return NotFound;
+    if (expiry != nullptr) *expiry = record_expiry;
+    if (version != nullptr) *version = timestamp + 1;
+    if (pmem_record->large()) {
+      uint32_t value_len = ((ExtentTable*)pmem_record->value)->value_len;
+      value->resize(std::min(value_len, MAX_LARGE_VALUE_LEN));
+      uint64_t read_len;
+      if (ReadExtents(idx, pmem_record, 0, &(*value)[0], value->size(),
+                      &read_len)) {
+        value->resize(read_len);
+        return Ok;
+      }
+      // replaced in the meantime, maybe with another expiry
+      return Get(key, value, expiry, version);
+    }
 
+    if (pmem_record->cold()) {
+      // a cold record read twice within a turn of the clock is promoted,
+      // unless its version is asked for, which the promotion would change
+      if (ReadCold(idx, pmem_record, referenced && version == nullptr,
+                   value)) {
+        return Ok;
+      }
+      // the stub has been replaced while being read
+      if (hash_index_.FetchPmemRecord(idx) != pmem_record) {
+        return Get(key, value, expiry, version);
+      }
+      return IOError;
+    }
+
+    PmemRead(pmem_record->value, pmem_record->value_len());
+    bool intact = true;
+    if (pmem_record->compressed()) {
+      intact = DecompressValue(pmem_record->value, pmem_record->value_len(),
+                               value);
+    } else {
+      char* from = pmem_record->value;
+      char* to = pmem_record->value + pmem_record->value_len();
+      *value = std::string(from, to);
+    }
+
+    // the record may be replaced and reused while being read, by a newer
+    // record of the same key at the same address
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (hash_index_.FetchPmemRecord(idx) != pmem_record ||
+        pmem_record->timestamp != timestamp) {
+      return Get(key, value, expiry, version);
+    }
+    if (!intact) return IOError;
+
+#ifdef USE_INLINE_VALUES
+    hash_index_.MirrorValue(idx, (char*)pmem_record - pmem_base_,
+                            value->data(), value->size(), record_expiry,
+                            true);
+#endif
     return Ok;
   }
 }
 
+Status SubEngine::Read(const Slice& key, uint64_t offset, char* buf,
+                       uint64_t len, uint64_t* read_len) {
+  auto idx = hash_index_.Find(key);
+  if (idx < 0) {
+    return NotFound;
+  }
+
+  auto pmem_record = hash_index_.FetchPmemRecord(idx);
+  while (pmem_record->large()) {
+    if (Expired(pmem_record->expiry())) {
+      return NotFound;
+    }
+    if (ReadExtents(idx, pmem_record, offset, buf, len, read_len)) {
+      return Ok;
+    }
+    pmem_record = hash_index_.FetchPmemRecord(idx);
+  }
+
+  // small values are read whole
+  std::string value;
+  Status status = Get(key, &value);
+  if (status != Ok) {
+    return status;
+  }
+  *read_len = 0;
+  if (offset < value.size()) {
+    *read_len = std::min(value.size() - offset, len);
+    memcpy(buf, value.data() + offset, *read_len);
+  }
+  return Ok;
+}
+
+bool SubEngine::ReadExtents(uint32_t idx, PmemRecord* pmem_record,
+                            uint64_t offset, char* buf, uint64_t len,
+                            uint64_t* read_len) {
+  auto pmem_table = (ExtentTable*)pmem_record->value;
+  PmemRead(pmem_table, pmem_record->value_len());
+  ExtentTable table;
+  table.value_len = pmem_table->value_len;
+  table.num_extents = pmem_table->num_extents;
+  if (table.num_extents > ExtentTable::MAX_EXTENTS) {
+    table.num_extents = ExtentTable::MAX_EXTENTS;
+  }
+  memcpy(table.extents, pmem_table->extents,
+         table.num_extents * sizeof(ExtentTable::Extent));
+
+  // the record and its extents may be reused as soon as it is replaced
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (hash_index_.FetchPmemRecord(idx) != pmem_record) return false;
+
+  *read_len = 0;
+  uint64_t extent_offset = 0;
+  for (uint32_t i = 0; i < table.num_extents && *read_len < len; i++) {
+    auto& extent = table.extents[i];
+    if (offset < extent_offset + extent.len) {
+      uint64_t from = offset - extent_offset;
+      uint64_t n = std::min(extent.len - from, len - *read_len);
+      PmemRead(pmem_base_ + MemRecord::DecodePtr(extent.ptr) + from, n);
+      memcpy(buf + *read_len, pmem_base_ + MemRecord::DecodePtr(extent.ptr) + from,
+             n);
+      *read_len += n;
+      offset += n;
+    }
+    extent_offset += extent.len;
+  }
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return hash_index_.FetchPmemRecord(idx) == pmem_record;
+}
+
+Status SubEngine::WriteExtents(const Slice& value, ExtentTable* table) {
+  table->value_len = value.size();
+  table->num_extents = 0;
+  for (uint64_t offset = 0; offset < value.size(); offset += MAX_EXTENT_SIZE) {
+    uint32_t len = std::min<uint64_t>(value.size() - offset, MAX_EXTENT_SIZE);
+    uint64_t ptr;
+    uint32_t cap;
+    bool allocated = large_allocator_.Allocate(len, &ptr, &cap);
+#ifdef USE_EVICTION
+    for (uint32_t i = 0; i < EVICTION_MAX_ROUNDS && !allocated && Evict(true);
+         i++) {
+      allocated = large_allocator_.Allocate(len, &ptr, &cap);
+    }
+#endif
+    if (!allocated) {
+      FreeExtents(*table);
+      return OutOfMemory;
+    }
+    PmemMemcpyNodrain(pmem_base_ + ptr, value.data() + offset, len);
+    table->extents[table->num_extents++] = {MemRecord::EncodePtr(ptr), len};
+  }
+  // a record must only reference durable extents, whatever its durability
+  PmemDrain();
+  return Ok;
+}
+
+Status SubEngine::AllocateRecord(uint32_t size, uint64_t* ptr, uint32_t* cap) {
+  std::tie(*ptr, *cap) = pmem_allocator_.Allocate(size);
+#ifdef USE_EVICTION
+  // least recently used records make room for the new one
+  for (uint32_t i = 0; i < EVICTION_MAX_ROUNDS && *cap == 0 && Evict(false);
+       i++) {
+    std::tie(*ptr, *cap) = pmem_allocator_.Allocate(size);
+  }
+#endif
+  return *cap == 0 ? OutOfMemory : Ok;
+}
+
+void SubEngine::FreeExtents(const ExtentTable& table) {
+  for (uint32_t i = 0; i < table.num_extents; i++) {
+    large_allocator_.Deallocate(MemRecord::DecodePtr(table.extents[i].ptr),
+                                LargeAllocator::cap(table.extents[i].len));
+  }
+}
+
+void SubEngine::RecoverExtents() {
+  std::vector<std::pair<uint64_t, uint32_t>> used;
+  for (uint32_t idx = 0; idx < hash_index_.num_unique_keys(); idx++) {
+    auto pmem_record = hash_index_.FetchPmemRecord(idx);
+    if (!pmem_record->large()) continue;
+    auto table = (ExtentTable*)pmem_record->value;
+    for (uint32_t i = 0; i < table->num_extents; i++) {
+      used.emplace_back(MemRecord::DecodePtr(table->extents[i].ptr),
+                        LargeAllocator::cap(table->extents[i].len));
+    }
+  }
+  // extents written by sets that never made it to a record are freed here
+  large_allocator_.Recover(&used);
+}
+
+void SubEngine::RecoverExpiries() {
+  // the records that have expired meanwhile still shadow the older ones of
+  // their keys, the first sweep reclaims them
+  for (uint32_t idx = 0; idx < hash_index_.num_unique_keys(); idx++) {
+    auto pmem_record = hash_index_.FetchPmemRecord(idx);
+    if (pmem_record->expires()) {
+      expiry_wheel_.Add(idx, pmem_record->expiry());
+    }
+  }
+}
+
+bool SubEngine::ReadCold(uint32_t idx, PmemRecord* pmem_record, bool promote,
+                         std::string* value) {
+  static thread_local char buf[MAX_RECORD_CAP];
+
+  ColdRef ref;
+  PmemRead(pmem_record->value, sizeof(ColdRef));
+  memcpy(&ref, pmem_record->value, sizeof(ColdRef));
+  if (ref.len > MAX_RECORD_CAP || !cold_tier_->Read(ref.offset, buf, ref.len)) {
+    return false;
+  }
+  auto cold_record = (PmemRecord*)buf;
+  if (cold_record->record_size() > ref.len || !cold_record->Intact() ||
+      memcmp(cold_record->key, pmem_record->key, KEY_SIZE) != 0) {
+    return false;
+  }
+
+  if (cold_record->compressed()) {
+    if (!DecompressValue(cold_record->value, cold_record->value_len(),
+                         value)) {
+      return false;
+    }
+  } else {
+    value->assign(cold_record->value, cold_record->value_len());
+  }
+
+  if (promote) {
+    Promote(idx, pmem_record, cold_record);
+  }
+  return true;
+}
+
+void SubEngine::Promote(uint32_t idx, PmemRecord* pmem_record,
+                        PmemRecord* cold_record) {
+  uint64_t ptr;
+  uint32_t cap;
+  std::tie(ptr, cap) = pmem_allocator_.Allocate(cold_record->record_size());
+  // the shard is full, the record stays cold
+  if (cap == 0) {
+    return;
+  }
+  // the stub is reused once replaced, the copy has to be durable by then
+  WriteRecord(ptr, Slice(cold_record->key, KEY_SIZE),
+              Slice(cold_record->value, cold_record->stored_len()),
+              cold_record->flags, cap, pmem_record->timestamp + 1, kPersist,
+              true);
+
+  uint64_t stub_ptr = (char*)pmem_record - pmem_base_;
+  if (hash_index_.Update(idx, stub_ptr, ptr) != pmem_record) {
+    DiscardRecord(ptr, cap);
+    return;
+  }
+  pmem_allocator_.Deallocate(stub_ptr, pmem_record->cap());
+  ShardFetchAdd(&num_promoted_, (uint64_t)1);
+}
+
+void SubEngine::DiscardRecord(uint64_t ptr, uint32_t cap) {
+  // it is as new as the record that won, and must not shadow it on recovery
+  PmemMemsetPersist(pmem_base_ + ptr, 0, sizeof(PmemRecord::head));
+  pmem_allocator_.Deallocate(ptr, cap);
+}
+
+void SubEngine::FreeRecord(uint64_t ptr, PmemRecord* pmem_record) {
+  // the commit of the record may still rely on it, see TxnLog
+  if (pmem_record->transactional()) {
+    txn_log_->Settle(pmem_record->txid());
+  }
+  pmem_allocator_.Deallocate(ptr, pmem_record->cap());
+}
+
+#ifdef USE_TIERING
+void SubEngine::Demote() {
+  uint64_t pmem_end = large_allocator_.region_start();
+  uint64_t pmem_frontier =
+      std::min(pmem_allocator_.pmem_frontier_.load(RE), pmem_end);
+  uint64_t free_size = pmem_end - pmem_frontier + pmem_allocator_.free_size();
+  if (free_size >= pmem_end * TIER_MIN_FREE_RATIO) {
+    return;
+  }
+
+  // the ranges of demoted records only make room if they are reused
+  if (pmem_allocator_.mode_.load(RE) != PmemAllocator::kShrink) {
+    pmem_allocator_.set_mode(PmemAllocator::kShrink);
+  }
+
+  struct Candidate {
+    uint32_t idx;
+    PmemRecord* pmem_record;
+    uint32_t offset;
+    uint32_t len;
+    uint64_t stub_ptr;
+    uint32_t stub_cap;
+  };
+  std::vector<Candidate> candidates;
+  demote_batch_.resize(TIER_BATCH_SIZE);
+  uint32_t batch_len = 0;
+
+  uint32_t num_keys = hash_index_.num_unique_keys();
+  for (uint32_t i = 0; i < TIER_SCAN_LEN && i < num_keys; i++) {
+    uint32_t idx = clock_hand_++ % num_keys;
+    if (hash_index_.Unreference(idx) || !hash_index_.Live(idx)) {
+      continue;
+    }
+    auto pmem_record = hash_index_.FetchPmemRecord(idx);
+    uint32_t len = Align<ADDRESS_ALIGN_BITS>(pmem_record->record_size());
+    if (pmem_record->large() || pmem_record->cold() || len <= STUB_CAP) {
+      continue;
+    }
+    if (batch_len + len > TIER_BATCH_SIZE) {
+      break;
+    }
+    auto copy = demote_batch_.data() + batch_len;
+    memcpy(copy, pmem_record, len);
+    // replaced in the meantime, or left to the sweeper
+    if (!((PmemRecord*)copy)->Intact() ||
+        Expired(((PmemRecord*)copy)->expiry())) {
+      continue;
+    }
+    candidates.push_back({idx, pmem_record, batch_len, len, 0, 0});
+    batch_len += len;
+  }
+  if (candidates.empty()) {
+    return;
+  }
+
+  uint64_t offset;
+  if (!cold_tier_->Append(demote_batch_.data(), batch_len, &offset)) {
+    logger_->LogWithTime("[engine #%d] failed to write the cold tier", id_);
+    return;
+  }
+
+  // the stubs are made durable at once, before any record is replaced
+  static thread_local char buf[MAX_RECORD_CAP];
+  uint64_t ticket = 0;
+  for (auto& c : candidates) {
+    auto copy = (PmemRecord*)(demote_batch_.data() + c.offset);
+    ColdRef ref = {offset + c.offset, c.len};
+    // the stub of an expiring record keeps its expiry
+    char stub_value[sizeof(ColdRef) + PmemRecord::EXPIRY_SIZE];
+    uint32_t stub_len = sizeof(ColdRef);
+    uint8_t stub_flags = PmemRecord::FLAG_COLD;
+    memcpy(stub_value, &ref, sizeof(ColdRef));
+    if (copy->expires()) {
+      uint64_t expiry = copy->expiry();
+      memcpy(stub_value + stub_len, &expiry, PmemRecord::EXPIRY_SIZE);
+      stub_len += PmemRecord::EXPIRY_SIZE;
+      stub_flags |= PmemRecord::FLAG_TTL;
+    }
+    std::tie(c.stub_ptr, c.stub_cap) =
+        pmem_allocator_.Allocate(PmemRecord::record_size(stub_len), true);
+    if (c.stub_cap == 0) {
+      break;
+    }
+    new (buf) PmemRecord(copy->key, stub_value, stub_len, c.stub_cap,
+                         copy->timestamp + 1, stub_flags);
+    char* to = pmem_base_ + c.stub_ptr;
+    PmemMemcpy(to, buf, c.stub_cap, PMEM_F_MEM_NOFLUSH);
+    ticket = flusher_->Enqueue(to, c.stub_cap);
+  }
+  flusher_->Sync(ticket);
+
+  for (auto& c : candidates) {
+    // left without a stub by a full shard
+    if (c.stub_cap == 0) {
+      break;
+    }
+    uint64_t ptr = (char*)c.pmem_record - pmem_base_;
+    if (hash_index_.Update(c.idx, ptr, c.stub_ptr) != c.pmem_record) {
+      DiscardRecord(c.stub_ptr, c.stub_cap);
+      continue;
+    }
+    FreeRecord(ptr, (PmemRecord*)(demote_batch_.data() + c.offset));
+    ShardFetchAdd(&num_demoted_, (uint64_t)1);
+  }
+}
+#endif
+
+void SubEngine::Expire(uint64_t now) {
+  expired_batch_.clear();
+  expiry_wheel_.Advance(now, EXPIRY_BATCH_SIZE, &expired_batch_);
+  if (expired_batch_.empty()) {
+    return;
+  }
+
+  std::vector<Victim> victims;
+  for (auto& entry : expired_batch_) {
+    auto pmem_record = hash_index_.FetchPmemRecord(entry.idx);
+    uint64_t timestamp = pmem_record->timestamp;
+    // replaced since, a newer record that expires has an entry of its own
+    if (pmem_record->expiry() != entry.expiry) {
+      continue;
+    }
+    if (!pmem_record->large() && pmem_record->cap() <= TOMBSTONE_CAP) {
+      continue;
+    }
+    victims.push_back({entry.idx, pmem_record, timestamp, entry.expiry, 0, 0});
+  }
+  if (victims.empty()) {
+    return;
+  }
+  ShardFetchAdd(&num_expired_, (uint64_t)Bury(&victims, true));
+  // the shard is full, the next sweep tries again
+  for (auto& v : victims) {
+    if (v.tombstone_cap == 0) expiry_wheel_.Add(v.idx, v.expiry);
+  }
+}
+
+uint32_t SubEngine::Bury(std::vector<Victim>* victims, bool wait) {
+  // the tombstones are made durable at once, before any record is replaced
+  static thread_local char buf[MAX_RECORD_CAP];
+  uint64_t ticket = 0;
+  uint32_t num_tombstones = 0;
+  bool full = false;
+  for (auto& v : *victims) {
+    if (!full) {
+      std::tie(v.tombstone_ptr, v.tombstone_cap) = pmem_allocator_.Allocate(
+          PmemRecord::record_size(PmemRecord::EXPIRY_SIZE), true);
+    }
+    if (full || v.tombstone_cap == 0) {
+      full = true;
+      v.tombstone_cap = 0;
+      continue;
+    }
+    new (buf) PmemRecord(v.pmem_record->key, (char*)&v.expiry,
+                         PmemRecord::EXPIRY_SIZE, v.tombstone_cap,
+                         v.timestamp + 1, PmemRecord::FLAG_TTL);
+    char* to = pmem_base_ + v.tombstone_ptr;
+    PmemMemcpy(to, buf, v.tombstone_cap, PMEM_F_MEM_NOFLUSH);
+    ticket = flusher_->Enqueue(to, v.tombstone_cap);
+    num_tombstones++;
+  }
+  if (num_tombstones == 0) {
+    return 0;
+  }
+  flusher_->Sync(ticket);
+
+  uint32_t num_buried = 0;
+  for (auto& v : *victims) {
+    if (v.tombstone_cap == 0) continue;
+#ifndef USE_SHARD_OWNER
+    // a set holds the combiner of its key while it replaces the record, the
+    // record checked is the one replaced
+    auto& mtx = combiners_[v.idx % NUM_COMBINERS_PER_SHARD].mtx;
+    if (wait) {
+      mtx.lock();
+    } else if (!mtx.try_lock()) {
+      DiscardRecord(v.tombstone_ptr, v.tombstone_cap);
+      continue;
+    }
+    std::lock_guard<SpinMutex> lock(mtx, std::adopt_lock);
+#endif
+    uint64_t ptr = (char*)v.pmem_record - pmem_base_;
+    if (v.pmem_record->timestamp != v.timestamp ||
+        hash_index_.Update(v.idx, ptr, v.tombstone_ptr) != v.pmem_record) {
+      DiscardRecord(v.tombstone_ptr, v.tombstone_cap);
+      continue;
+    }
+    if (v.pmem_record->large()) {
+      FreeExtents(*(ExtentTable*)v.pmem_record->value);
+    }
+    FreeRecord(ptr, v.pmem_record);
+    num_buried++;
+  }
+  return num_buried;
+}
+
+#ifdef USE_EVICTION
+bool SubEngine::Evict(bool extents) {
+  // the evictors of a shard take turns, the others retry their allocations
+  std::unique_lock<SpinMutex> lock(evict_mtx_, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    std::this_thread::yield();
+    return true;
+  }
+
+  // the ranges of evicted records only make room if they are reused
+  if (pmem_allocator_.mode_.load(RE) != PmemAllocator::kShrink) {
+    pmem_allocator_.set_mode(PmemAllocator::kShrink);
+  }
+
+  std::vector<Victim> victims;
+  uint64_t freed = 0;
+  uint32_t num_keys = hash_index_.num_unique_keys();
+  // the first turn of the hand may only clear reference bits
+  for (uint32_t i = 0; i < 2 * num_keys &&
+                       victims.size() < EVICTION_BATCH_SIZE &&
+                       freed < EVICTION_ROUND_SIZE;
+       i++) {
+    uint32_t idx = evict_hand_++ % num_keys;
+    if (hash_index_.Unreference(idx) || !hash_index_.Live(idx)) {
+      continue;
+    }
+    auto pmem_record = hash_index_.FetchPmemRecord(idx);
+    uint64_t timestamp = pmem_record->timestamp;
+    // stubs and tombstones are not larger than a tombstone
+    if (!pmem_record->large() &&
+        (extents || pmem_record->cap() <= TOMBSTONE_CAP)) {
+      continue;
+    }
+    victims.push_back({idx, pmem_record, timestamp, EVICTED_EXPIRY, 0, 0});
+    // a guess, the record may be replaced meanwhile
+    if (pmem_record->large()) {
+      freed += ((ExtentTable*)pmem_record->value)->value_len;
+    } else {
+      freed += pmem_record->cap() - TOMBSTONE_CAP;
+    }
+  }
+  if (victims.empty()) {
+    return false;
+  }
+  ShardFetchAdd(&num_evicted_, (uint64_t)Bury(&victims, false));
+  return true;
+}
+#endif
+
 void SubEngine::RecordTimestamp(uint32_t idx) {
   constexpr uint32_t N = sizeof(key_timestamps_) / sizeof(key_timestamps_[0]);
   static std::once_flag flags[N];
@@ -120,54 +721,288 @@ void SubEngine::AdjustStrategy(uint64_t set_idx) {
   }
 }
 
-Status SubEngine::Set(const Slice& key, const Slice& value) {
-  auto set_idx = num_sets_.fetch_add(1, RE);
+void SubEngine::WriteRecord(uint64_t ptr, const Slice& key,
+                            const Slice& stored, uint8_t flags, uint32_t cap,
+                            uint64_t timestamp, Durability durability,
+                            bool with_body) {
+  char* to = pmem_base_ + ptr;
+  alignas(8) char header[PmemRecord::HEADER_SIZE];
+  ((PmemRecord*)header)
+      ->InitHeader(key.data(), stored.data(), stored.size(), cap, timestamp,
+                   flags);
+  uint32_t len =
+      with_body ? PmemRecord::record_size(stored.size()) : sizeof(header);
+
+  // ranges flushed by the flusher must be written with cached stores, a
+  // writer that drains on its own streams them past the cache
+  unsigned store_flags = PMEM_F_MEM_NOFLUSH;
+#ifndef USE_GROUP_COMMIT
+  if (durability == kPersist) {
+    store_flags = PMEM_F_MEM_NONTEMPORAL | PMEM_F_MEM_NODRAIN;
+  }
+#endif
+  if (with_body) {
+    PmemMemcpy(to + sizeof(header), key.data(), KEY_SIZE, store_flags);
+    PmemMemcpy(to + sizeof(header) + KEY_SIZE, stored.data(), stored.size(),
+               store_flags);
+  }
+  PmemMemcpy(to, header, sizeof(header), store_flags);
+
+  switch (durability) {
+    case kVolatile: {
+      break;
+    }
+    case kFlushAsync: {
+      flusher_->Enqueue(to, len);
+      break;
+    }
+    default:
+    case kPersist: {
+#ifdef USE_GROUP_COMMIT
+      flusher_->Sync(flusher_->Enqueue(to, len));
+#else
+      PmemDrain();
+#endif
+      break;
+    }
+  }
+}
+
+bool SubEngine::Update(uint32_t idx, const Slice& key, const Slice& stored,
+                       uint8_t flags, const Slice& value, Durability durability,
+                       uint64_t ptr, uint32_t cap, bool with_body,
+                       PmemRecord* expected) {
+  auto previous_pmem_record =
+      expected != nullptr ? expected : hash_index_.FetchPmemRecord(idx);
+  PmemRecord* last = nullptr;
+  uint64_t previous_ptr;
+
+  do {
+    // a retry only needs a newer timestamp, the body is in place
+    WriteRecord(ptr, key, stored, flags, cap,
+                previous_pmem_record->timestamp + 1, durability, with_body);
+    with_body = false;
+
+    previous_ptr = (char*)previous_pmem_record - pmem_base_;
+    last = previous_pmem_record;
+    previous_pmem_record = hash_index_.Update(idx, previous_ptr, ptr);
+    if (expected != nullptr && previous_pmem_record != last) {
+      return false;
+    }
+  } while (previous_pmem_record != last);
+
+#ifdef USE_INLINE_VALUES
+  hash_index_.MirrorValue(idx, ptr, value.data(), value.size(),
+                          ((PmemRecord*)(pmem_base_ + ptr))->expiry(), false);
+#endif
+
+  if (previous_pmem_record->large()) {
+    // the extents may be reused right away, the record replacing them must
+    // not be lost anymore
+    if (durability != kPersist) {
+      PmemPersist(pmem_base_ + ptr, cap);
+    }
+    FreeExtents(*(ExtentTable*)previous_pmem_record->value);
+  }
+  FreeRecord(previous_ptr, previous_pmem_record);
+  return true;
+}
+
+void SubEngine::CombineUpdate(UpdateRequest* req) {
+  auto combiner = combiners_ + req->idx % NUM_COMBINERS_PER_SHARD;
+
+  req->status = Ok;
+  req->done.store(false, RE);
+  req->next = combiner->pending.load(RE);
+  while (!combiner->pending.compare_exchange_weak(
+      req->next, req, std::memory_order_release, RE))
+    ;
+
+  while (!req->done.load(std::memory_order_acquire)) {
+    if (!combiner->mtx.try_lock()) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    // newest first, so the first request of a key is the last writer
+    auto batch = combiner->pending.exchange(nullptr, std::memory_order_acquire);
+    for (auto r = batch; r != nullptr; r = r->next) {
+      bool superseded = false;
+      for (auto p = batch; p != r; p = p->next) {
+        if (p->idx == r->idx && p->status == Ok) {
+          superseded = true;
+          break;
+        }
+      }
+      if (superseded) {
+        num_combined_sets_.fetch_add(1, RE);
+        if (r->flags & PmemRecord::FLAG_LARGE) {
+          FreeExtents(*(ExtentTable*)r->stored.data());
+        }
+        continue;
+      }
+
+      // superseded writes are only as durable as the one that replaces them
+      Durability durability = r->durability;
+      for (auto p = r->next; p != nullptr; p = p->next) {
+        if (p->idx == r->idx) durability = std::max(durability, p->durability);
+      }
+
+      uint64_t ptr;
+      uint32_t cap;
+      r->status =
+          AllocateRecord(PmemRecord::record_size(r->stored.size()), &ptr, &cap);
+      // an older request of the key may still be applied instead
+      if (r->status != Ok) {
+        if (r->flags & PmemRecord::FLAG_LARGE) {
+          FreeExtents(*(ExtentTable*)r->stored.data());
+        }
+        continue;
+      }
+      Update(r->idx, *r->key, r->stored, r->flags, *r->value, durability, ptr,
+             cap, true);
+    }
+
+    // a request may be gone as soon as it is marked as done
+    for (auto r = batch; r != nullptr;) {
+      auto next = r->next;
+      r->done.store(true, std::memory_order_release);
+      r = next;
+    }
+    combiner->mtx.unlock();
+  }
+}
+
+Status SubEngine::EncodeValue(const Slice& value, uint64_t expiry,
+                              uint64_t txid, Slice* stored, uint8_t* flags) {
+  *stored = value;
+  *flags = 0;
+  static thread_local ExtentTable table;
+  if (value.size() >= LARGE_VALUE_MIN_LEN) {
+    Status status = WriteExtents(value, &table);
+    if (status != Ok) {
+      return status;
+    }
+    *stored = Slice((char*)&table, table.size());
+    *flags |= PmemRecord::FLAG_LARGE;
+  }
+#ifdef USE_COMPRESSION
+  static thread_local char compressed[LARGE_VALUE_MIN_LEN];
+  uint32_t stored_len;
+  if (*flags == 0 && value.size() >= COMPRESS_MIN_VALUE_LEN &&
+      CompressValue(value, PmemRecord::min_value_len(), compressed,
+                    sizeof(compressed), &stored_len)) {
+    *stored = Slice(compressed, stored_len);
+    *flags |= PmemRecord::FLAG_COMPRESSED;
+  }
+#endif
+  static thread_local char trailed[LARGE_VALUE_MIN_LEN +
+                                   PmemRecord::EXPIRY_SIZE +
+                                   PmemRecord::TXID_SIZE];
+  if (expiry != 0 || txid != 0) {
+    uint32_t len = stored->size();
+    memcpy(trailed, stored->data(), len);
+    if (expiry != 0) {
+      memcpy(trailed + len, &expiry, PmemRecord::EXPIRY_SIZE);
+      len += PmemRecord::EXPIRY_SIZE;
+      *flags |= PmemRecord::FLAG_TTL;
+    }
+    if (txid != 0) {
+      memcpy(trailed + len, &txid, PmemRecord::TXID_SIZE);
+      len += PmemRecord::TXID_SIZE;
+      *flags |= PmemRecord::FLAG_TXN;
+    }
+    *stored = Slice(trailed, len);
+  }
+  return Ok;
+}
+
+Status SubEngine::Set(const Slice& key, const Slice& value,
+                      Durability durability, uint64_t expiry) {
+  if (value.size() > MAX_LARGE_VALUE_LEN) {
+    return IOError;
+  }
+
+  auto set_idx = ShardFetchAdd(&num_sets_, (uint64_t)1);
   AdjustStrategy(set_idx);
 
   auto idx = hash_index_.Find(key);
 
-  uint32_t record_size = PmemRecord::record_size(value.size());
-  uint64_t ptr;
-  uint32_t cap;
-  std::tie(ptr, cap) = pmem_allocator_.Allocate(record_size);
-
-  static thread_local char buf[1 << 12];
+  Slice stored;
+  uint8_t flags;
+  Status status = EncodeValue(value, expiry, 0, &stored, &flags);
+  if (status != Ok) {
+    ShardFetchAdd(&num_out_of_memory_, (uint64_t)1);
+    return status;
+  }
 
 #ifdef USE_LOG
   bool is_update = (idx >= 0);
 #endif
+#ifdef USE_REFERENCE_BITS
+  if (idx >= 0) {
+    hash_index_.Reference(idx);
+  }
+#endif
 
   if (idx < 0) {
-    new (buf) PmemRecord(key.data(), value.data(), value.size(), cap, 0);
-    PMEM_MEMCPY(pmem_base_ + ptr, buf, cap);
+    uint64_t ptr;
+    uint32_t cap;
+    status = AllocateRecord(PmemRecord::record_size(stored.size()), &ptr, &cap);
+    if (status == Ok) {
+      WriteRecord(ptr, key, stored, flags, cap, 0, durability, true);
 
-    if ((idx = hash_index_.Insert(key, ptr)) >= 0) {
-      goto modify;
+      // another writer has inserted the key in the meantime
+      idx = hash_index_.Insert(key, ptr);
+      if (idx == HashIndex::FULL) {
+        // index nodes are never freed, the keys of a shard are bounded
+        DiscardRecord(ptr, cap);
+        status = OutOfMemory;
+      } else if (idx >= 0) {
+        Update(idx, key, stored, flags, value, durability, ptr, cap, false);
+      }
     }
   } else {
-modify:
-    auto previous_pmem_record = hash_index_.FetchPmemRecord(idx);
-    PmemRecord* last = nullptr;
-    uint64_t previous_ptr;
-
-    do {
-      new (buf) PmemRecord(key.data(), value.data(), value.size(), cap,
-                           previous_pmem_record->timestamp + 1);
-      PMEM_MEMCPY(pmem_base_ + ptr, buf, cap);
-
-      previous_ptr = (char*)previous_pmem_record - pmem_base_;
-      last = previous_pmem_record;
-      previous_pmem_record = hash_index_.Update(idx, previous_ptr, ptr);
-    } while (previous_pmem_record != last);
+#ifdef USE_SHARD_OWNER
+    // the owner is the only writer of the shard, there is nothing to combine
+    uint64_t ptr;
+    uint32_t cap;
+    status = AllocateRecord(PmemRecord::record_size(stored.size()), &ptr, &cap);
+    if (status == Ok) {
+      Update(idx, key, stored, flags, value, durability, ptr, cap, true);
+    }
+#else
+    UpdateRequest req;
+    req.idx = idx;
+    req.key = &key;
+    req.stored = stored;
+    req.flags = flags;
+    req.value = &value;
+    req.durability = durability;
+    CombineUpdate(&req);
+    // the combiner has freed the extents of a failed request
+    if (req.status != Ok) {
+      ShardFetchAdd(&num_out_of_memory_, (uint64_t)1);
+      return req.status;
+    }
+#endif
+  }
+  if (status != Ok) {
+    if (flags & PmemRecord::FLAG_LARGE) {
+      FreeExtents(*(ExtentTable*)stored.data());
+    }
+    ShardFetchAdd(&num_out_of_memory_, (uint64_t)1);
+    return status;
+  }
 
-    pmem_allocator_.Deallocate(previous_ptr, previous_pmem_record->cap());
+  if (expiry != 0) {
+    expiry_wheel_.Add(idx >= 0 ? idx : hash_index_.Find(key), expiry);
   }
 
 #ifdef USE_LOG
   if ((set_idx % LOG_FREQ) == 0) {
-    auto front = pmem_allocator_.free_queue_.front.load(RE);
-    auto rear = pmem_allocator_.free_queue_.rear.load(RE);
-    auto free_queue_size = rear - front;
+    auto free_queue_size = pmem_allocator_.num_spare_ranges();
+    double lost_size = 1.0 * pmem_allocator_.lost_size() / (1 << 30);
 
     uint64_t frontier = pmem_allocator_.pmem_frontier_.load(RE);
     bool r = (pmem_allocator_.pmem_end_ > frontier);
@@ -176,16 +1011,249 @@ modify:
 
     double mem_used = 1.0 * GetMemUsed() / (1 << 10);
     uint64_t num_unique_keys = hash_index_.num_unique_keys() / (1 << 10);
+    uint64_t num_combined_sets = num_combined_sets_.load(RE);
+    uint64_t num_demoted = num_demoted_.load(RE);
+    uint64_t num_promoted = num_promoted_.load(RE);
+    uint64_t num_expired = num_expired_.load(RE);
+    uint64_t num_evicted = num_evicted_.load(RE);
+    uint64_t num_out_of_memory = num_out_of_memory_.load(RE);
 
     logger_->Log(
         "[set #%llu] [engine #%d] #unique_keys = %lluk, len(free_queue) = "
-        "%llu, remained_pmem_size = %.4fG, memory_usage = %.2fM, "
-        "update = %s, len(value) = %llu",
-        set_idx, id_, num_unique_keys, free_queue_size, remained_size, mem_used,
-        is_update ? "true" : "false", value.size());
+        "%llu, remained_pmem_size = %.4fG, lost_pmem_size = %.4fG, "
+        "memory_usage = %.2fM, update = %s, len(value) = %llu, "
+        "#combined_sets = %llu, #demoted = %llu, #promoted = %llu, "
+        "#expired = %llu, #evicted = %llu, #out_of_memory = %llu",
+        set_idx, id_, num_unique_keys, free_queue_size, remained_size,
+        lost_size, mem_used, is_update ? "true" : "false", value.size(),
+        num_combined_sets, num_demoted, num_promoted, num_expired,
+        num_evicted, num_out_of_memory);
     logger_->Flush();
   }
 #endif
 
   return Ok;
 }
+
+Status SubEngine::CompareAndSet(const Slice& key, const Slice& value,
+                                Durability durability, uint64_t expiry,
+                                uint64_t* version) {
+  if (value.size() > MAX_LARGE_VALUE_LEN) {
+    return IOError;
+  }
+
+  // a stale version fails before anything is written
+  auto idx = hash_index_.Find(key);
+  uint64_t current =
+      idx < 0 ? 0 : VersionOf(hash_index_.FetchPmemRecord(idx));
+  if (current != *version) {
+    *version = current;
+    return VersionMismatch;
+  }
+
+  auto set_idx = ShardFetchAdd(&num_sets_, (uint64_t)1);
+  AdjustStrategy(set_idx);
+
+  Slice stored;
+  uint8_t flags;
+  uint64_t ptr;
+  uint32_t cap;
+  Status status = EncodeValue(value, expiry, 0, &stored, &flags);
+  if (status == Ok) {
+    status = AllocateRecord(PmemRecord::record_size(stored.size()), &ptr, &cap);
+    if (status != Ok && (flags & PmemRecord::FLAG_LARGE)) {
+      FreeExtents(*(ExtentTable*)stored.data());
+    }
+  }
+  if (status != Ok) {
+    ShardFetchAdd(&num_out_of_memory_, (uint64_t)1);
+    return status;
+  }
+
+  bool replaced;
+  uint64_t new_version;
+  if (idx < 0) {
+    WriteRecord(ptr, key, stored, flags, cap, 0, durability, true);
+    // another writer may have inserted the key in the meantime
+    idx = hash_index_.Insert(key, ptr);
+    replaced = idx == -1;
+    new_version = 1;
+  } else {
+#ifndef USE_SHARD_OWNER
+    // the sets of the key are applied under the lock, see CombineUpdate
+    std::lock_guard<SpinMutex> lock(
+        combiners_[idx % NUM_COMBINERS_PER_SHARD].mtx);
+#endif
+    auto pmem_record = hash_index_.FetchPmemRecord(idx);
+    new_version = pmem_record->timestamp + 2;
+    replaced = VersionOf(pmem_record) == *version &&
+               Update(idx, key, stored, flags, value, durability, ptr, cap,
+                      true, pmem_record);
+  }
+
+  if (!replaced) {
+    DiscardRecord(ptr, cap);
+    if (flags & PmemRecord::FLAG_LARGE) {
+      FreeExtents(*(ExtentTable*)stored.data());
+    }
+    if (idx == HashIndex::FULL) {
+      ShardFetchAdd(&num_out_of_memory_, (uint64_t)1);
+      return OutOfMemory;
+    }
+    *version = VersionOf(hash_index_.FetchPmemRecord(idx));
+    return VersionMismatch;
+  }
+  if (expiry != 0) {
+    expiry_wheel_.Add(idx >= 0 ? idx : hash_index_.Find(key), expiry);
+  }
+  *version = new_version;
+  return Ok;
+}
+
+Status SubEngine::Increment(const Slice& key, int64_t delta,
+                            Durability durability, int64_t* result) {
+  std::string value;
+  // only a concurrent set of the key makes the loop go round again
+  for (;;) {
+    uint64_t expiry = 0;
+    uint64_t version;
+    Status status = Get(key, &value, &expiry, &version);
+    if (status == NotFound) {
+      value = "0";
+    } else if (status != Ok) {
+      return status;
+    }
+    int64_t number;
+    if (!ParseNumber(value, &number) ||
+        (delta > 0 && number > std::numeric_limits<int64_t>::max() - delta) ||
+        (delta < 0 && number < std::numeric_limits<int64_t>::min() - delta)) {
+      return IOError;
+    }
+    number += delta;
+    value = std::to_string(number);
+    // the expiry of the counter is kept
+    status = CompareAndSet(key, Slice(&value[0], value.size()), durability,
+                           expiry, &version);
+    if (status != VersionMismatch) {
+      if (status == Ok) *result = number;
+      return status;
+    }
+  }
+}
+
+Status SubEngine::Append(const Slice& key, const Slice& suffix,
+                         Durability durability) {
+  std::string value;
+  for (;;) {
+    uint64_t expiry = 0;
+    uint64_t version;
+    Status status = Get(key, &value, &expiry, &version);
+    if (status == NotFound) {
+      value.clear();
+    } else if (status != Ok) {
+      return status;
+    }
+    value.append(suffix.data(), suffix.size());
+    status = CompareAndSet(key, Slice((char*)value.data(), value.size()),
+                           durability, expiry, &version);
+    if (status != VersionMismatch) {
+      return status;
+    }
+  }
+}
+
+Status SubEngine::PrepareTxn(const Slice& key, const Slice& value,
+                             uint64_t txid, TxnLog::Entry* entry) {
+  if (value.size() > MAX_LARGE_VALUE_LEN) {
+    return IOError;
+  }
+
+  auto set_idx = ShardFetchAdd(&num_sets_, (uint64_t)1);
+  AdjustStrategy(set_idx);
+
+  // a committed record must find a node of the index once published
+  auto idx = hash_index_.Find(key);
+  if (idx < 0 && hash_index_.num_unique_keys() >= UNIQUE_KEYS_PER_SHARD) {
+    ShardFetchAdd(&num_out_of_memory_, (uint64_t)1);
+    return OutOfMemory;
+  }
+
+  Slice stored;
+  uint8_t flags;
+  uint64_t ptr;
+  uint32_t cap;
+  Status status = EncodeValue(value, 0, txid, &stored, &flags);
+  if (status == Ok) {
+    status = AllocateRecord(PmemRecord::record_size(stored.size()), &ptr, &cap);
+    if (status != Ok && (flags & PmemRecord::FLAG_LARGE)) {
+      FreeExtents(*(ExtentTable*)stored.data());
+    }
+  }
+  if (status != Ok) {
+    ShardFetchAdd(&num_out_of_memory_, (uint64_t)1);
+    return status;
+  }
+
+  uint64_t timestamp =
+      (idx < 0 ? 0 : hash_index_.FetchPmemRecord(idx)->timestamp) +
+      TXN_TIMESTAMP_GAP;
+  WriteRecord(ptr, key, stored, flags, cap, timestamp, kVolatile, true);
+  PmemFlush(pmem_base_ + ptr, PmemRecord::record_size(stored.size()));
+#ifdef USE_SHARD_OWNER
+  // a fence only orders the flushes of its own cpu, the one of the commit
+  // runs on the client's
+  PmemDrain();
+#endif
+  entry->shard = id_;
+  entry->ptr = MemRecord::EncodePtr(ptr);
+  entry->timestamp = timestamp;
+  return Ok;
+}
+
+void SubEngine::PublishTxn(const Slice& key, const Slice& value,
+                           const TxnLog::Entry& entry, bool committed) {
+  uint64_t ptr = MemRecord::DecodePtr(entry.ptr);
+  auto pmem_record = (PmemRecord*)(pmem_base_ + ptr);
+  if (committed) {
+    int32_t idx = hash_index_.Insert(key, ptr);
+    while (idx >= 0) {
+      auto current = hash_index_.FetchPmemRecord(idx);
+      // outrun by the sets of the key since it was prepared
+      if (current->timestamp >= entry.timestamp) {
+        break;
+      }
+      uint64_t current_ptr = (char*)current - pmem_base_;
+      if (hash_index_.Update(idx, current_ptr, ptr) != current) {
+        continue;
+      }
+#ifdef USE_REFERENCE_BITS
+      hash_index_.Reference(idx);
+#endif
+#ifdef USE_INLINE_VALUES
+      hash_index_.MirrorValue(idx, ptr, value.data(), value.size(), 0,
+                              false);
+#endif
+      if (current->large()) {
+        FreeExtents(*(ExtentTable*)current->value);
+      }
+      FreeRecord(current_ptr, current);
+      return;
+    }
+    if (idx == -1) {
+      return;
+    }
+    // outrun, or the index has filled up since the record was prepared
+    if (idx == HashIndex::FULL) {
+      ShardFetchAdd(&num_out_of_memory_, (uint64_t)1);
+    }
+    txn_log_->Settle(pmem_record->txid());
+  }
+
+  // the extents go first, the record is reused as soon as it is discarded
+  if (pmem_record->large()) {
+    FreeExtents(*(ExtentTable*)pmem_record->value);
+  }
+  DiscardRecord(ptr, pmem_record->cap());
+}
+
+PROFILE_NAMESPACE_END
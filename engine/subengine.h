@@ -5,20 +5,83 @@
 
 #include <atomic>
 #include <chrono>
+#include <vector>
 
+#include "cold_tier.h"
+#include "expiry_wheel.h"
+#include "flusher.h"
 #include "hash_index.h"
+#include "large_allocator.h"
 #include "logger.h"
 #include "pmem_allocator.h"
+#include "sync.h"
+#include "txn_log.h"
+
+PROFILE_NAMESPACE_BEGIN
 
 class SubEngine {
  public:
   SubEngine() = default;
 
-  void Init(int id, char* pmem_base, Logger* logger);
+  void Init(int id, char* pmem_base, uint64_t pmem_size,
+            uint64_t* large_region_size, uint64_t* high_water_mark,
+            Logger* logger, Flusher* flusher, ColdTier* cold_tier,
+            TxnLog* txn_log);
+
+  // expiry receives the expiry of the value unless it is nullptr, see
+  // PmemRecord::expiry, and version its version, see CompareAndSet
+  Status Get(const Slice& key, std::string* value,
+             uint64_t* expiry = nullptr, uint64_t* version = nullptr);
+
+  Status Read(const Slice& key, uint64_t offset, char* buf, uint64_t len,
+              uint64_t* read_len);
+
+  // the value expires at expiry, in ms since the unix epoch, never if 0
+  Status Set(const Slice& key, const Slice& value, Durability durability,
+             uint64_t expiry);
+
+  // sets key to value if *version is still the version of key, which is 0
+  // for a key that is not found and the timestamp of its record plus 1
+  // otherwise. *version receives the new version, or the current one with
+  // VersionMismatch
+  Status CompareAndSet(const Slice& key, const Slice& value,
+                       Durability durability, uint64_t expiry,
+                       uint64_t* version);
+
+  // read-modify-writes of the value of key by CompareAndSet, which keep its
+  // expiry, see DB::Increment and DB::Append
+  Status Increment(const Slice& key, int64_t delta, Durability durability,
+                   int64_t* result);
+  Status Append(const Slice& key, const Slice& suffix, Durability durability);
+
+  // writes the record of key of the transaction txid, flushed but not
+  // fenced, and fills in entry for its commit, see TxnLog
+  Status PrepareTxn(const Slice& key, const Slice& value, uint64_t txid,
+                    TxnLog::Entry* entry);
+  // replaces the record of key with the prepared one, unless a newer set of
+  // the key outran it, or discards it if the transaction has not committed
+  void PublishTxn(const Slice& key, const Slice& value,
+                  const TxnLog::Entry& entry, bool committed);
+
+  // reclaims a batch of the records that have expired by now
+  void Expire(uint64_t now);
 
-  Status Get(const Slice& key, std::string* value);
+#ifdef USE_TIERING
+  // demotes a batch of cold records if the shard is running out of space
+  void Demote();
+#endif
 
-  Status Set(const Slice& key, const Slice& value);
+  // #gets of missing keys, and how many of them passed the bloom filter
+  inline uint64_t num_get_misses() { return num_get_misses_.load(RE); }
+  inline uint64_t num_filter_false_positives() {
+    return num_filter_false_positives_.load(RE);
+  }
+  inline uint64_t num_expired() { return num_expired_.load(RE); }
+  inline uint64_t num_evicted() { return num_evicted_.load(RE); }
+  inline uint64_t num_out_of_memory() {
+    return num_out_of_memory_.load(RE);
+  }
+  inline HashIndex* hash_index() { return &hash_index_; }
 
   ~SubEngine();
 
@@ -26,18 +89,129 @@ class SubEngine {
   int id_;
 
   Logger* logger_;
+  Flusher* flusher_;
+  ColdTier* cold_tier_;
+  TxnLog* txn_log_;
   char* pmem_base_;
 
   HashIndex hash_index_;
   PmemAllocator pmem_allocator_;
+  LargeAllocator large_allocator_;
+  ExpiryWheel expiry_wheel_;
 
   // #sets
   std::atomic<uint64_t> num_sets_;
+  // #sets that were overwritten by a concurrent set before reaching pmem
+  std::atomic<uint64_t> num_combined_sets_;
+  // #records moved to and back from the cold tier
+  std::atomic<uint64_t> num_demoted_, num_promoted_;
+  std::atomic<uint64_t> num_get_misses_, num_filter_false_positives_;
+  // #expired records reclaimed
+  std::atomic<uint64_t> num_expired_;
+  // #records evicted, and #sets that failed for lack of space
+  std::atomic<uint64_t> num_evicted_, num_out_of_memory_;
+  // only touched by the demoter
+  uint32_t clock_hand_;
+  std::vector<char> demote_batch_;
+  // only touched by the sweeper
+  std::vector<ExpiryWheel::Entry> expired_batch_;
+#ifdef USE_EVICTION
+  // held by the evictor of the shard, with the clock hand
+  SpinMutex evict_mtx_;
+  uint32_t evict_hand_;
+#endif
+
+  // Updates are flat-combined: a writer publishes its request to the
+  // combiner of the key and whoever holds the combiner's lock applies the
+  // pending requests, persisting only the last one per key.
+  struct UpdateRequest {
+    uint32_t idx;
+    const Slice* key;
+    Slice stored;
+    uint8_t flags;
+    const Slice* value;
+    Durability durability;
+    // set by the combiner that applied the request
+    Status status;
+    UpdateRequest* next;
+    std::atomic<bool> done;
+  };
+
+  struct alignas(64) Combiner {
+    SpinMutex mtx;
+    std::atomic<UpdateRequest*> pending;
+  };
+
+  Combiner combiners_[NUM_COMBINERS_PER_SHARD];
 
   static std::chrono::high_resolution_clock::time_point key_timestamps_[3];
 
   void RecordTimestamp(uint32_t idx);
   void AdjustStrategy(uint64_t set_idx);
+  // writes a record straight from key and stored, without staging it:
+  // the key and value once, unless with_body is false because they are at
+  // ptr already, then the header
+  void WriteRecord(uint64_t ptr, const Slice& key, const Slice& stored,
+                   uint8_t flags, uint32_t cap, uint64_t timestamp,
+                   Durability durability, bool with_body);
+  // with_body is false if the record has been written at ptr already.
+  // Whatever record idx has is replaced, or only expected if it is set,
+  // and false is returned once expected is not the record of idx anymore
+  bool Update(uint32_t idx, const Slice& key, const Slice& stored,
+              uint8_t flags, const Slice& value, Durability durability,
+              uint64_t ptr, uint32_t cap, bool with_body,
+              PmemRecord* expected = nullptr);
+  void CombineUpdate(UpdateRequest* req);
+  // allocates a record, evicting others to make room in USE_EVICTION
+  Status AllocateRecord(uint32_t size, uint64_t* ptr, uint32_t* cap);
+  // writes the extents of a large value and makes the stored form of value,
+  // which is valid until the next call of the thread. txid is 0 outside of
+  // transactions
+  Status EncodeValue(const Slice& value, uint64_t expiry, uint64_t txid,
+                     Slice* stored, uint8_t* flags);
+  Status WriteExtents(const Slice& value, ExtentTable* table);
+  void FreeExtents(const ExtentTable& table);
+  void RecoverExtents();
+  // puts the expiring records found by the recovery on the wheel
+  void RecoverExpiries();
+  // copies the value of a large record, returns false if it has been
+  // replaced in the meantime
+  bool ReadExtents(uint32_t idx, PmemRecord* pmem_record, uint64_t offset,
+                   char* buf, uint64_t len, uint64_t* read_len);
+  // reads the value of a stub record, returns false if the cold copy is
+  // not the one of the stub
+  bool ReadCold(uint32_t idx, PmemRecord* pmem_record, bool promote,
+                std::string* value);
+  void Promote(uint32_t idx, PmemRecord* pmem_record, PmemRecord* cold_record);
+  // frees a record that never made it to the index
+  void DiscardRecord(uint64_t ptr, uint32_t cap);
+  // frees a record replaced in the index, pmem_record may be a copy of it
+  void FreeRecord(uint64_t ptr, PmemRecord* pmem_record);
+
+  // a record to be replaced with a tombstone, see Bury
+  struct Victim {
+    uint32_t idx;
+    PmemRecord* pmem_record;
+    uint64_t timestamp;
+    // of the tombstone
+    uint64_t expiry;
+    uint64_t tombstone_ptr;
+    uint32_t tombstone_cap;
+  };
+  // replaces the victims with tombstones of their keys and frees them,
+  // unless they have been replaced in the meantime. The victims left
+  // without room for a tombstone get a tombstone_cap of 0. A set of a
+  // victim is waited for if wait is set, otherwise the victim is skipped.
+  // Returns #victims replaced
+  uint32_t Bury(std::vector<Victim>* victims, bool wait);
+#ifdef USE_EVICTION
+  // evicts a batch of records by CLOCK, only those of large values if
+  // extents is set, since the extents and the records do not share freed
+  // space. Returns false if there is none left to evict
+  bool Evict(bool extents);
+#endif
 };
 
+PROFILE_NAMESPACE_END
+
 #endif
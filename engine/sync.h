@@ -31,7 +31,7 @@ class WaitGroup {
 
 class SpinMutex {
  private:
-  std::atomic_flag flag_;
+  std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
 
  public:
   inline void lock() {
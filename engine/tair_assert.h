@@ -9,7 +9,8 @@
     exit(1);                                     \
   }
 #else
-#define ASSERT(cond) (cond)
+// the condition still runs, it may be a call with side effects
+#define ASSERT(cond) ((void)(cond))
 #endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include "txn_log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "record.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+namespace {
+std::atomic<uint32_t> next_slot_hint(0);
+}  // namespace
+
+TxnLog::TxnLog() : pmem_slots_(nullptr) {
+  for (auto& slot : slots_) {
+    slot.committed_seq.store(0, RE);
+    slot.settled_seq.store(0, RE);
+  }
+}
+
+void TxnLog::Format(char* base) {
+  static_assert(sizeof(CommitRecord) == XPLINE_SIZE,
+                "a commit record should fill an XPLine");
+  static_assert(
+      TXN_LOG_OFFSET + sizeof(PmemSlot) * TXN_LOG_SLOTS <= POOL_HEADER_SIZE,
+      "TxnLog does not fit in POOL_HEADER_SIZE");
+  PmemMemsetPersist(base, 0, sizeof(PmemSlot) * TXN_LOG_SLOTS);
+}
+
+void TxnLog::Recover(char* base, PoolHeader* header) {
+  pmem_slots_ = (PmemSlot*)base;
+  for (uint32_t i = 0; i < TXN_LOG_SLOTS; i++) {
+    auto& pmem_slot = pmem_slots_[i];
+    uint64_t settled = pmem_slot.settled_seq;
+    const CommitRecord* newest = nullptr;
+    for (auto& commit : pmem_slot.commits) {
+      if (commit.seq == 0 || commit.num_entries > TXN_MAX_KEYS ||
+          commit.checksum != Checksum(commit)) {
+        continue;
+      }
+      if (newest == nullptr || commit.seq > newest->seq) newest = &commit;
+    }
+
+    uint64_t committed = settled;
+    if (newest != nullptr) {
+      // a commit without all of its records never returned, the older
+      // commits of the slot had
+      uint64_t seq = newest->seq;
+      uint64_t txid = ((uint64_t)i << SEQ_BITS) | seq;
+      if (seq > settled && !Proven(*newest, txid, header)) seq--;
+      committed = std::max(committed, seq);
+    }
+    slots_[i].committed_seq.store(committed, RE);
+    slots_[i].settled_seq.store(settled, RE);
+  }
+}
+
+uint64_t TxnLog::Begin() {
+  // a thread starts from the slot it had last, which is most likely free
+  static thread_local uint32_t hint =
+      next_slot_hint.fetch_add(1, RE) % TXN_LOG_SLOTS;
+  for (uint32_t i = 0;; i++) {
+    uint32_t idx = (hint + i) % TXN_LOG_SLOTS;
+    if (slots_[idx].lease.try_lock()) {
+      hint = idx;
+      uint64_t seq = slots_[idx].committed_seq.load(RE) + 1;
+      return ((uint64_t)idx << SEQ_BITS) | seq;
+    }
+    if (i % TXN_LOG_SLOTS == TXN_LOG_SLOTS - 1) std::this_thread::yield();
+  }
+}
+
+void TxnLog::Commit(uint64_t txid, const Entry* entries,
+                    uint32_t num_entries) {
+  uint32_t idx = SlotOf(txid);
+  uint64_t seq = SeqOf(txid);
+  CommitRecord commit;
+  memset(&commit, 0, sizeof(commit));
+  commit.seq = seq;
+  commit.num_entries = num_entries;
+  std::copy(entries, entries + num_entries, commit.entries);
+  commit.checksum = Checksum(commit);
+
+  // the records have been flushed already, the fence of the commit is the
+  // only one of the transaction
+  PmemMemcpy(&pmem_slots_[idx].commits[seq % 2], &commit, sizeof(commit),
+             PMEM_F_MEM_NODRAIN);
+  PmemDrain();
+  slots_[idx].committed_seq.store(seq, std::memory_order_release);
+  slots_[idx].lease.unlock();
+}
+
+void TxnLog::Abort(uint64_t txid) { slots_[SlotOf(txid)].lease.unlock(); }
+
+bool TxnLog::Committed(uint64_t txid) {
+  return SeqOf(txid) <= slots_[SlotOf(txid)].committed_seq.load(RE);
+}
+
+void TxnLog::Settle(uint64_t txid) {
+  auto& slot = slots_[SlotOf(txid)];
+  uint64_t seq = SeqOf(txid);
+  // an older commit is proven by the newer commit records of its slot
+  if (seq != slot.committed_seq.load(std::memory_order_acquire) ||
+      slot.settled_seq.load(std::memory_order_acquire) >= seq) {
+    return;
+  }
+  std::lock_guard<SpinMutex> lock(slot.settle_mtx);
+  if (slot.settled_seq.load(RE) >= seq) return;
+  auto& pmem_slot = pmem_slots_[SlotOf(txid)];
+  pmem_slot.settled_seq = seq;
+  PmemPersist(&pmem_slot.settled_seq, sizeof(uint64_t));
+  slot.settled_seq.store(seq, std::memory_order_release);
+}
+
+uint32_t TxnLog::Checksum(const CommitRecord& commit) {
+  uint64_t code = commit.seq * 31 + commit.num_entries;
+  for (uint32_t i = 0; i < commit.num_entries; i++) {
+    auto& entry = commit.entries[i];
+    code = code * 31 + entry.shard;
+    code = code * 31 + entry.ptr;
+    code = code * 31 + entry.timestamp;
+  }
+  code ^= code >> 32;
+  return code & 0xffffffff;
+}
+
+bool TxnLog::Proven(const CommitRecord& commit, uint64_t txid,
+                    PoolHeader* header) {
+  for (uint32_t i = 0; i < commit.num_entries; i++) {
+    auto& entry = commit.entries[i];
+    uint64_t ptr = MemRecord::DecodePtr(entry.ptr);
+    if (entry.shard >= NUM_SHARDS ||
+        ptr + PmemRecord::record_size(0) > header->shard_size) {
+      return false;
+    }
+    auto pmem_record = (PmemRecord*)(header->shard_base(entry.shard) + ptr);
+    if (ptr + pmem_record->record_size() > header->shard_size ||
+        !pmem_record->Intact() ||
+        pmem_record->timestamp != entry.timestamp ||
+        pmem_record->txid() != txid) {
+      return false;
+    }
+  }
+  return true;
+}
+
+PROFILE_NAMESPACE_END
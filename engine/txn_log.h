@@ -0,0 +1,105 @@
+#ifndef TAIR_CONTEST_KV_CONTEST_TXN_LOG_H_
+#define TAIR_CONTEST_KV_CONTEST_TXN_LOG_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "config.h"
+#include "persist.h"
+#include "pool_header.h"
+#include "sync.h"
+
+PROFILE_NAMESPACE_BEGIN
+
+// Commit log of the transactions of DB::MultiSet, in the pool header.
+//
+// A transaction leases a slot of the log and writes the records of its keys
+// tagged with its txid, flushed but not fenced. The commit record listing
+// them is then flushed to the slot, and a single fence makes the records and
+// the commit durable together. On recovery a commit only counts if every
+// record it lists is intact, the records of the transactions that have not
+// committed are discarded.
+//
+// The commits of a slot are sequential, so a commit record proves that the
+// older commits of its slot are complete. Only the newest one relies on its
+// records, which is why the slot is settled before one of them is freed:
+// settling persists that the commit needs no proof anymore.
+class TxnLog {
+ public:
+  // a record of a transaction, as listed by its commit
+  struct Entry {
+    uint32_t shard;
+    // offset in the shard, in the encoding of MemRecord::ptr
+    uint32_t ptr;
+    uint64_t timestamp;
+  };
+
+  TxnLog();
+
+  // zeroes the log of a new pool at base
+  static void Format(char* base);
+
+  // finds out which transactions of the log at base have committed, before
+  // the shards of header are recovered
+  void Recover(char* base, PoolHeader* header);
+
+  // leases a slot and returns the txid of the transaction, which ends with
+  // Commit or Abort
+  uint64_t Begin();
+
+  // persists the commit of the records of txid, which have been flushed
+  void Commit(uint64_t txid, const Entry* entries, uint32_t num_entries);
+
+  // ends a transaction whose records have been discarded
+  void Abort(uint64_t txid);
+
+  // whether the records of txid are to be recovered
+  bool Committed(uint64_t txid);
+
+  // to be called before a record of txid is freed
+  void Settle(uint64_t txid);
+
+ private:
+  // a txid is the index of its slot followed by the seq of its commit
+  static constexpr uint32_t SEQ_BITS = 48;
+
+  struct CommitRecord {
+    uint64_t seq;
+    uint32_t num_entries;
+    uint32_t checksum;
+    Entry entries[TXN_MAX_KEYS];
+  };
+
+  struct PmemSlot {
+    // the commit of seq is written over that of seq - 2
+    CommitRecord commits[2];
+    // the newest commit whose records may have been freed
+    uint64_t settled_seq;
+    char padding[XPLINE_SIZE - sizeof(uint64_t)];
+  };
+
+  struct alignas(64) Slot {
+    SpinMutex lease;
+    SpinMutex settle_mtx;
+    std::atomic<uint64_t> committed_seq;
+    std::atomic<uint64_t> settled_seq;
+  };
+
+  PmemSlot* pmem_slots_;
+  Slot slots_[TXN_LOG_SLOTS];
+
+  static inline uint32_t SlotOf(uint64_t txid) { return txid >> SEQ_BITS; }
+  static inline uint64_t SeqOf(uint64_t txid) {
+    return txid & ((1ull << SEQ_BITS) - 1);
+  }
+
+  static uint32_t Checksum(const CommitRecord& commit);
+  // whether every record listed by commit is intact
+  static bool Proven(const CommitRecord& commit, uint64_t txid,
+                     PoolHeader* header);
+};
+
+PROFILE_NAMESPACE_END
+
+#endif
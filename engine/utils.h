@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include <chrono>
+
 template <uint32_t B>
 constexpr uint64_t Residual() {
   return ((uint64_t)1 << (uint64_t)B) - (uint64_t)1;
@@ -13,4 +15,17 @@ constexpr uint64_t Align(const uint64_t num) {
   return (num + Residual<B>()) & (~Residual<B>());
 }
 
+// the clock of the expiries of records, which outlive the process
+inline uint64_t WallClockMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// whether a record with expiry is gone, see PmemRecord::expiry. The clock
+// is only read for records that expire
+inline bool Expired(uint64_t expiry) {
+  return expiry != 0 && expiry <= WallClockMs();
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "common/db.h"
+#include "engine/config.h"
+#include "engine/key_hash.h"
+#include "engine/persist.h"
+#include "utils.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Counts the minor page faults and the dTLB load misses of the process, the
+// latter only where perf events are available. Threads are only counted if
+// they are started after the counter.
+class FaultCounter {
+ public:
+  FaultCounter() {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    faults_ = MinorFaults();
+  }
+
+  ~FaultCounter() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+  int64_t faults() { return MinorFaults() - faults_; }
+
+  // -1 if unavailable
+  int64_t tlb_misses() {
+    int64_t count;
+    if (fd_ < 0 || read(fd_, &count, sizeof(count)) != sizeof(count)) {
+      return -1;
+    }
+    return count;
+  }
+
+ private:
+  int fd_;
+  int64_t faults_;
+
+  static int64_t MinorFaults() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+  }
+};
+
+struct Latencies {
+  std::vector<uint64_t> nanos;
+  double seconds;
+  int64_t faults;
+  int64_t tlb_misses;
+};
+
+void GenKey(char* key, uint32_t x) {
+  memset(key, 0, KEY_SIZE);
+  *(uint32_t*)key = x;
+}
+
+// Runs func(thread_id, op_id) num_ops times on each of num_threads threads and
+// collects the latency of every call.
+Latencies Run(uint64_t num_ops,
+              const std::function<void(uint64_t, uint64_t)>& func,
+              uint32_t num_threads = NUM_THREADS) {
+  std::vector<std::vector<uint64_t>> nanos(num_threads);
+  std::thread threads[NUM_THREADS];
+
+  FaultCounter counter;
+  auto start = Clock::now();
+  for (uint32_t i = 0; i < num_threads; i++) {
+    threads[i] = std::thread(
+        [&](uint64_t id) {
+          nanos[id].reserve(num_ops);
+          for (uint64_t j = 0; j < num_ops; j++) {
+            auto from = Clock::now();
+            func(id, j);
+            auto to = Clock::now();
+            nanos[id].push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(to - from)
+                    .count());
+          }
+        },
+        i);
+  }
+  for (uint32_t i = 0; i < num_threads; i++) {
+    threads[i].join();
+  }
+  auto end = Clock::now();
+
+  Latencies ret;
+  ret.faults = counter.faults();
+  ret.tlb_misses = counter.tlb_misses();
+  for (auto& v : nanos) ret.nanos.insert(ret.nanos.end(), v.begin(), v.end());
+  std::sort(ret.nanos.begin(), ret.nanos.end());
+  ret.seconds =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count() /
+      1e6;
+  return ret;
+}
+
+// Runs num_ops operations from a single thread through an async queue of
+// the given depth, with latencies measured from submission to completion.
+Latencies RunAsync(DB* db, uint64_t num_ops, uint32_t depth,
+                   const std::function<void(uint64_t, AsyncOp*)>& prepare) {
+  std::unique_ptr<AsyncQueue> queue(db->NewAsyncQueue(depth));
+  std::vector<AsyncOp> ops(num_ops);
+  std::vector<std::array<char, KEY_SIZE>> keys(num_ops);
+  std::vector<std::string> results(num_ops);
+  std::vector<Clock::time_point> submitted(num_ops);
+  std::vector<AsyncCompletion> completions(depth);
+  for (uint64_t i = 0; i < num_ops; i++) {
+    ops[i].key = Slice(keys[i].data(), KEY_SIZE);
+    ops[i].result = &results[i];
+    ops[i].user_data = (void*)(uintptr_t)i;
+    prepare(i, &ops[i]);
+  }
+
+  Latencies ret;
+  ret.nanos.reserve(num_ops);
+  FaultCounter counter;
+  auto start = Clock::now();
+  for (uint64_t num_submitted = 0; ret.nanos.size() < num_ops;) {
+    auto now = Clock::now();
+    uint32_t n = queue->Submit(ops.data() + num_submitted,
+                               num_ops - num_submitted);
+    for (uint32_t i = 0; i < n; i++) submitted[num_submitted + i] = now;
+    num_submitted += n;
+
+    n = queue->Poll(completions.data(), depth);
+    now = Clock::now();
+    for (uint32_t i = 0; i < n; i++) {
+      uintptr_t idx = (uintptr_t)completions[i].user_data;
+      ret.nanos.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              now - submitted[idx])
+                              .count());
+    }
+  }
+  auto end = Clock::now();
+  ret.faults = counter.faults();
+  ret.tlb_misses = counter.tlb_misses();
+
+  std::sort(ret.nanos.begin(), ret.nanos.end());
+  ret.seconds =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count() /
+      1e6;
+  return ret;
+}
+
+void Report(const char* name, const Latencies& l) {
+  uint64_t sum = 0;
+  for (auto x : l.nanos) sum += x;
+  uint64_t n = l.nanos.size();
+  printf("%-24s ops = %8llu, %8.3lf Mops/s, avg = %7.0lfns, p50 = %7lluns, "
+         "p99 = %7lluns, faults = %6lld, dTLB misses = %9lld\n",
+         name, (unsigned long long)n, n / l.seconds / 1e6, 1.0 * sum / n,
+         (unsigned long long)l.nanos[n / 2],
+         (unsigned long long)l.nanos[n * 99 / 100], (long long)l.faults,
+         (long long)l.tlb_misses);
+}
+
+}  // namespace
+
+// usage: benchmark [db_file] [num_ops] [emulation]
+// emulation emulates the performance of pmem on dram, either "optane" or
+// "read_latency_ns,read_mbps,write_mbps,rmw_penalty_ns"
+int main(int argc, char** argv) {
+  std::string db_file_path = argc >= 2 ? argv[1] : "/tmp/benchmark";
+  uint64_t num_ops = argc >= 3 ? atoll(argv[2]) : NUM_KEYS / NUM_THREADS / 4;
+
+  PmemEmulation emulation = PmemEmulation::Optane();
+  if (argc >= 4) {
+    if (strcmp(argv[3], "optane") != 0 &&
+        sscanf(argv[3], "%u,%u,%u,%u", &emulation.read_latency_ns,
+               &emulation.read_bandwidth_mbps, &emulation.write_bandwidth_mbps,
+               &emulation.rmw_penalty_ns) != 4) {
+      fprintf(stderr, "bad emulation %s\n", argv[3]);
+      return 1;
+    }
+    SetPmemEmulation(&emulation);
+    printf("emulation = read %uns %uMB/s, write %uMB/s, rmw %uns\n",
+           emulation.read_latency_ns, emulation.read_bandwidth_mbps,
+           emulation.write_bandwidth_mbps, emulation.rmw_penalty_ns);
+  }
+
+#ifdef USE_SHARD_OWNER
+  printf("mode = shard-owner\n");
+#else
+  printf("mode = shared\n");
+#endif
+
+  remove(db_file_path.c_str());
+  DB* db;
+  auto open_start = Clock::now();
+  DB::CreateOrOpen(db_file_path, &db, nullptr);
+  printf("open = %.3lfs\n",
+         std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               open_start)
+                 .count() /
+             1e6);
+
+  std::vector<std::string> values(NUM_THREADS);
+  for (uint32_t i = 0; i < NUM_THREADS; i++) {
+    std::mt19937 mt(i);
+    values[i] = GenerateRandomString(mt, 80 + i * 3);
+  }
+
+  // the first operation of every shard, on an index that has not been
+  // touched yet unless it has been prefaulted
+  std::vector<uint32_t> first_keys(NUM_SHARDS, UINT32_MAX);
+  for (uint32_t x = 0, n = 0; n < NUM_SHARDS; x++) {
+    char key[KEY_SIZE];
+    GenKey(key, x);
+    uint32_t shard = KeyHash::Shard(KeyHash::Hash(Slice(key, KEY_SIZE)));
+    if (first_keys[shard] == UINT32_MAX) {
+      first_keys[shard] = x;
+      n++;
+    }
+  }
+  auto l = Run(
+      NUM_SHARDS,
+      [&](uint64_t id, uint64_t j) {
+        char key[KEY_SIZE];
+        GenKey(key, first_keys[j]);
+        db->Set(Slice(key, KEY_SIZE),
+                Slice((char*)values[0].data(), values[0].size()));
+      },
+      1);
+  Report("set(first)", l);
+
+  const char* durability_names[] = {"set(volatile)", "set(flush_async)",
+                                    "set(persist)"};
+  Durability durabilities[] = {kVolatile, kFlushAsync, kPersist};
+  for (uint32_t d = 0; d < 3; d++) {
+    auto l = Run(num_ops, [&](uint64_t id, uint64_t j) {
+      char key[KEY_SIZE];
+      GenKey(key, (uint32_t)(id * num_ops + j));
+      db->Set(Slice(key, KEY_SIZE),
+              Slice((char*)values[id].data(), values[id].size()),
+              durabilities[d]);
+    });
+    Report(durability_names[d], l);
+  }
+
+  // synchronous persistence should scale with the number of writers
+  for (uint32_t num_threads = 1; num_threads <= NUM_THREADS;
+       num_threads *= 2) {
+    auto l = Run(
+        num_ops,
+        [&](uint64_t id, uint64_t j) {
+          char key[KEY_SIZE];
+          GenKey(key, (uint32_t)(id * num_ops + j));
+          db->Set(Slice(key, KEY_SIZE),
+                  Slice((char*)values[id].data(), values[id].size()), kPersist);
+        },
+        num_threads);
+    char name[32];
+    snprintf(name, sizeof(name), "set(persist) x%u", num_threads);
+    Report(name, l);
+  }
+
+  // the scaling curves to compare the shared and the shard-owner modes
+  for (uint32_t num_threads = 1; num_threads <= NUM_THREADS;
+       num_threads *= 2) {
+    auto l = Run(
+        num_ops,
+        [&](uint64_t id, uint64_t j) {
+          char key[KEY_SIZE];
+          GenKey(key, (uint32_t)(id * num_ops + j));
+          db->Set(Slice(key, KEY_SIZE),
+                  Slice((char*)values[id].data(), values[id].size()),
+                  kVolatile);
+        },
+        num_threads);
+    char name[32];
+    snprintf(name, sizeof(name), "set(volatile) x%u", num_threads);
+    Report(name, l);
+  }
+  for (uint32_t num_threads = 1; num_threads <= NUM_THREADS;
+       num_threads *= 2) {
+    auto l = Run(
+        num_ops,
+        [&](uint64_t id, uint64_t j) {
+          char key[KEY_SIZE];
+          GenKey(key, (uint32_t)(id * num_ops + j));
+          std::string value;
+          db->Get(Slice(key, KEY_SIZE), &value);
+        },
+        num_threads);
+    char name[32];
+    snprintf(name, sizeof(name), "get x%u", num_threads);
+    Report(name, l);
+  }
+
+  // updates concentrated on a few keys
+  l = Run(num_ops, [&](uint64_t id, uint64_t j) {
+    char key[KEY_SIZE];
+    GenKey(key, (uint32_t)(j % 4 * num_ops));
+    db->Set(Slice(key, KEY_SIZE),
+            Slice((char*)values[id].data(), values[id].size()));
+  });
+  Report("set(hot)", l);
+
+  l = Run(num_ops, [&](uint64_t id, uint64_t j) {
+    char key[KEY_SIZE];
+    GenKey(key, (uint32_t)(id * num_ops + j));
+    std::string value;
+    db->Get(Slice(key, KEY_SIZE), &value);
+  });
+  Report("get", l);
+
+  // keys that have never been set, answered by the bloom filter
+  l = Run(num_ops, [&](uint64_t id, uint64_t j) {
+    char key[KEY_SIZE];
+    GenKey(key, (uint32_t)((NUM_THREADS + id) * num_ops + j));
+    std::string value;
+    db->Get(Slice(key, KEY_SIZE), &value);
+  });
+  Report("get(miss)", l);
+
+  // reads concentrated on a few keys
+  l = Run(num_ops, [&](uint64_t id, uint64_t j) {
+    char key[KEY_SIZE];
+    GenKey(key, (uint32_t)(j % NUM_THREADS * num_ops));
+    std::string value;
+    db->Get(Slice(key, KEY_SIZE), &value);
+  });
+  Report("get(hot)", l);
+
+  // a single client thread with many operations in flight
+  const uint32_t ASYNC_DEPTH = 256;
+  uint64_t num_async_ops = num_ops * NUM_THREADS;
+  l = RunAsync(db, num_async_ops, ASYNC_DEPTH, [&](uint64_t i, AsyncOp* op) {
+    GenKey(op->key.data(), (uint32_t)i);
+    op->type = AsyncOp::kSet;
+    op->durability = kPersist;
+    op->value = Slice((char*)values[i % NUM_THREADS].data(),
+                      values[i % NUM_THREADS].size());
+  });
+  Report("set(async) x1", l);
+
+  l = RunAsync(db, num_async_ops, ASYNC_DEPTH, [&](uint64_t i, AsyncOp* op) {
+    GenKey(op->key.data(), (uint32_t)i);
+    op->type = AsyncOp::kGet;
+  });
+  Report("get(async) x1", l);
+
+  delete db;
+  if (pmem_emulation != nullptr) {
+    auto stats = GetPmemEmulationStats();
+    printf("emulated: read = %lluMB, flushed = %lluMB, media written = "
+           "%lluMB, rmw = %llu XPLines, injected = %.3lfs\n",
+           (unsigned long long)(stats.bytes_read >> 20),
+           (unsigned long long)(stats.bytes_flushed >> 20),
+           (unsigned long long)(stats.media_bytes_written >> 20),
+           (unsigned long long)stats.rmw_xplines, stats.injected_ns / 1e9);
+    SetPmemEmulation(nullptr);
+  }
+  return 0;
+}
@@ -0,0 +1,42 @@
+#include <cstring>
+#include <random>
+
+#include "engine/bloom_filter.h"
+#include "engine/config.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+Slice MakeKey(char* buf, uint64_t x, uint64_t y) {
+  memcpy(buf, &x, sizeof(x));
+  memcpy(buf + sizeof(x), &y, sizeof(y));
+  return Slice(buf, KEY_SIZE);
+}
+
+}  // namespace
+
+// A filter holding the keys it has been sized for never rejects one of them,
+// and lets through only a few of the others.
+TEST(BloomFilterTest, FalsePositives) {
+  BloomFilter filter;
+  std::mt19937_64 mt(0);
+  char buf[KEY_SIZE];
+
+  std::vector<std::pair<uint64_t, uint64_t>> keys;
+  for (uint64_t i = 0; i < UNIQUE_KEYS_PER_SHARD; i++) {
+    keys.emplace_back(mt(), i);
+    filter.Add(MakeKey(buf, keys.back().first, keys.back().second));
+  }
+  for (auto& key : keys) {
+    EXPECT_TRUE(filter.MayContain(MakeKey(buf, key.first, key.second)));
+  }
+
+  // keys of the contest only differ in a few bytes
+  const uint64_t num_probes = 100000;
+  uint64_t num_false_positives = 0;
+  for (uint64_t i = 0; i < num_probes; i++) {
+    num_false_positives +=
+        filter.MayContain(MakeKey(buf, UNIQUE_KEYS_PER_SHARD + i, 0));
+  }
+  EXPECT_LT(num_false_positives, num_probes / 10);
+}
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common/db.h"
+#include "engine/compress.h"
+#include "engine/config.h"
+#include "engine/record.h"
+#include "gtest/gtest.h"
+#include "utils.h"
+
+namespace {
+
+// json-like values with a lot of repetition
+std::string CompressibleValue(std::mt19937& mt, uint32_t len) {
+  std::string value;
+  while (value.size() < len) {
+    value += "{\"id\":" + std::to_string(mt() % 100) + ",\"name\":\"" +
+             GenerateRandomString(mt, 2 + mt() % 8) + "\"},";
+  }
+  value.resize(len);
+  return value;
+}
+
+std::string RoundTrip(const std::string& value) {
+  char buf[1 << 12];
+  uint32_t stored_len;
+  if (!CompressValue(Slice((char*)value.data(), value.size()), 80, buf,
+                     sizeof(buf), &stored_len)) {
+    return value;
+  }
+  EXPECT_LT(stored_len, value.size());
+  std::string ans;
+  EXPECT_TRUE(DecompressValue(buf, stored_len, &ans));
+  return ans;
+}
+
+TEST(CompressTest, RoundTrip) {
+  std::mt19937 mt(time(nullptr));
+  std::uniform_int_distribution<uint32_t> len_dis(COMPRESS_MIN_VALUE_LEN,
+                                                  1024);
+
+  for (int i = 0; i < 1000; i++) {
+    uint32_t len = len_dis(mt);
+    std::string value = CompressibleValue(mt, len);
+    EXPECT_EQ(RoundTrip(value), value);
+
+    value = GenerateRandomString(mt, len);
+    EXPECT_EQ(RoundTrip(value), value);
+  }
+}
+
+TEST(CompressTest, Incompressible) {
+  std::mt19937 mt(time(nullptr));
+  std::string value(512, 0);
+  for (auto& c : value) c = mt();
+
+  char buf[1 << 12];
+  uint32_t stored_len;
+  EXPECT_FALSE(CompressValue(Slice((char*)value.data(), value.size()), 80, buf,
+                             sizeof(buf), &stored_len));
+}
+
+TEST(CompressTest, Malformed) {
+  std::string value(1024, 'a');
+  char buf[1 << 12];
+  uint32_t stored_len;
+  ASSERT_TRUE(CompressValue(Slice((char*)value.data(), value.size()), 80, buf,
+                            sizeof(buf), &stored_len));
+
+  std::string ans;
+  // truncated block
+  EXPECT_FALSE(DecompressValue(buf, 6, &ans));
+  // offset pointing before the start of the output
+  std::string bad = std::string("\x00\x04\x00\x00\x04\x61\xff\xff", 8);
+  EXPECT_FALSE(DecompressValue(bad.data(), bad.size(), &ans));
+}
+
+}  // namespace
+
+// Compressible values of every length stored in a record, some of them
+// expiring, are read whole and in parts, also after a reopen. With
+// USE_COMPRESSION they are stored compressed.
+TEST(CompressTest, DB) {
+  std::string db_file_path = "/tmp/compress";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+
+  std::mt19937 mt(0);
+  std::vector<std::string> keys, values;
+  for (uint32_t len = COMPRESS_MIN_VALUE_LEN; len < LARGE_VALUE_MIN_LEN;
+       len += 97) {
+    keys.push_back(MakeKey(len));
+    values.push_back(CompressibleValue(mt, len));
+    uint64_t ttl_ms = keys.size() % 3 == 0 ? 3600 * 1000 : 0;
+    ASSERT_EQ(Ok, db->Set(AsSlice(keys.back()), AsSlice(values.back()),
+                          kPersist, ttl_ms));
+  }
+
+  auto check = [&]() {
+    std::string value;
+    char buf[256];
+    for (uint32_t i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(Ok, db->Get(AsSlice(keys[i]), &value)) << "key " << i;
+      EXPECT_EQ(values[i], value) << "key " << i;
+      uint64_t len = values[i].size();
+      for (uint64_t offset : {0ul, len / 3, len - 100, len}) {
+        uint64_t read_len;
+        ASSERT_EQ(Ok, db->Read(AsSlice(keys[i]), offset, buf, sizeof(buf),
+                               &read_len))
+            << "key " << i << " at " << offset;
+        EXPECT_EQ(values[i].substr(offset, sizeof(buf)),
+                  std::string(buf, read_len))
+            << "key " << i << " at " << offset;
+      }
+    }
+  };
+  check();
+  delete db;
+
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+  check();
+  delete db;
+
+#ifdef USE_COMPRESSION
+  // the records of most keys in the pool are compressed
+  FILE* file = fopen(db_file_path.c_str(), "rb");
+  ASSERT_NE(nullptr, file);
+  std::vector<char> image;
+  fseek(file, 0, SEEK_END);
+  image.resize(ftell(file));
+  fseek(file, 0, SEEK_SET);
+  ASSERT_EQ(image.size(), fread(&image[0], 1, image.size(), file));
+  fclose(file);
+  uint32_t num_compressed = 0;
+  for (uint64_t ptr = 0; ptr + sizeof(PmemRecord) <= image.size();
+       ptr += ADDRESS_ALIGN_NUM) {
+    auto pmem_record = (PmemRecord*)&image[ptr];
+    if (pmem_record->head == PMEM_RECORD_HEAD && pmem_record->compressed() &&
+        std::any_of(keys.begin(), keys.end(), [&](const std::string& key) {
+          return memcmp(pmem_record->key, key.data(), KEY_SIZE) == 0;
+        })) {
+      num_compressed++;
+    }
+  }
+  EXPECT_GE(num_compressed, keys.size() / 2);
+#endif
+}
@@ -1,10 +1,14 @@
+#include <array>
 #include <atomic>
 #include <cstdio>
 #include <functional>
 #include <map>
+#include <memory>
 #include <random>
+#include <set>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "common/db.h"
 #include "engine/config.h"
@@ -18,7 +22,10 @@ class DBTest : public ::testing::Test {
   constexpr static int PER_SET = 100;
   constexpr static int PER_GET = 100;
 
+  constexpr static int NUM_HOT_KEYS = 4;
+
   std::thread ths_[NUM_THREADS];
+  std::set<std::string> written_[NUM_HOT_KEYS][NUM_THREADS];
 
   const std::string db_file_path_ = "/tmp/correctness";
   DB* db_;
@@ -83,6 +90,26 @@ class DBTest : public ::testing::Test {
     }
   }
 
+  // every thread updates the same few keys
+  void HotKeyUpdate(uint64_t id) {
+    std::mt19937 mt(23333 * id * time(nullptr));
+    std::uniform_int_distribution<uint32_t> key_dis(0, NUM_HOT_KEYS - 1);
+    std::uniform_int_distribution<uint32_t> value_len_dis(80, 128);
+
+    for (int i = 0; i < PER_SET; i++) {
+      uint32_t int_key = key_dis(mt);
+      char key[KEY_SIZE];
+      memset(key, 0, KEY_SIZE);
+      memcpy(key, (char*)&int_key, sizeof(int_key));
+
+      // tag the value with its writer so it can be checked afterwards
+      auto value = GenerateRandomString(mt, value_len_dis(mt));
+      memcpy(&value[1], &id, sizeof(uint8_t));
+      db_->Set(Slice(key, KEY_SIZE), Slice((char*)value.data(), value.size()));
+      written_[int_key][id].insert(value);
+    }
+  }
+
   void LaunchThreads(const std::function<void(uint64_t)>& func) {
     for (uint32_t i = 0; i < NUM_THREADS; ++i) {
       ths_[i] = std::thread(func, i);
@@ -98,4 +125,73 @@ TEST_F(DBTest, Correctness) {
   LaunchThreads([this](uint64_t id) -> void { this->Correctness(id); });
 }
 
+TEST_F(DBTest, HotKeyUpdate) {
+  LaunchThreads([this](uint64_t id) -> void { this->HotKeyUpdate(id); });
+
+  for (uint32_t int_key = 0; int_key < NUM_HOT_KEYS; int_key++) {
+    char key[KEY_SIZE];
+    memset(key, 0, KEY_SIZE);
+    memcpy(key, (char*)&int_key, sizeof(int_key));
+
+    std::string value;
+    ASSERT_EQ(Ok, db_->Get(Slice(key, KEY_SIZE), &value));
+    uint8_t id = value[1];
+    ASSERT_LT(id, NUM_THREADS);
+    EXPECT_EQ(1, written_[int_key][id].count(value));
+  }
+}
+
+// one thread keeps many operations in flight
+TEST_F(DBTest, Async) {
+  const uint32_t NUM_KEYS_ASYNC = 1000;
+  const uint32_t DEPTH = 64;
+  std::mt19937 mt(time(nullptr));
+
+  std::vector<std::array<char, KEY_SIZE>> keys(NUM_KEYS_ASYNC);
+  std::vector<std::string> values(NUM_KEYS_ASYNC), results(NUM_KEYS_ASYNC);
+  std::vector<AsyncOp> ops(NUM_KEYS_ASYNC);
+  for (uint32_t i = 0; i < NUM_KEYS_ASYNC; i++) {
+    keys[i].fill(0);
+    memcpy(keys[i].data(), &i, sizeof(i));
+    values[i] = GenerateRandomString(mt, 80 + i % 128);
+    ops[i].key = Slice(keys[i].data(), KEY_SIZE);
+    ops[i].value = Slice((char*)values[i].data(), values[i].size());
+    ops[i].durability = kPersist;
+    ops[i].result = &results[i];
+    ops[i].user_data = (void*)(uintptr_t)i;
+  }
+
+  std::unique_ptr<AsyncQueue> queue(db_->NewAsyncQueue(DEPTH));
+  auto run = [&](AsyncOp::Type type) {
+    std::vector<bool> completed(NUM_KEYS_ASYNC, false);
+    for (auto& op : ops) op.type = type;
+
+    uint32_t num_submitted = 0, num_completed = 0;
+    AsyncCompletion completions[DEPTH];
+    while (num_completed < NUM_KEYS_ASYNC) {
+      num_submitted += queue->Submit(ops.data() + num_submitted,
+                                     NUM_KEYS_ASYNC - num_submitted);
+      ASSERT_LE(num_submitted - num_completed, DEPTH);
+      uint32_t n = queue->Poll(completions, DEPTH);
+      for (uint32_t i = 0; i < n; i++) {
+        uint32_t idx = (uintptr_t)completions[i].user_data;
+        EXPECT_EQ(Ok, completions[i].status);
+        EXPECT_FALSE(completed[idx]);
+        completed[idx] = true;
+      }
+      num_completed += n;
+    }
+  };
+
+  run(AsyncOp::kSet);
+  run(AsyncOp::kGet);
+  for (uint32_t i = 0; i < NUM_KEYS_ASYNC; i++) {
+    EXPECT_EQ(results[i], values[i]);
+
+    std::string value;
+    EXPECT_EQ(Ok, db_->Get(Slice(keys[i].data(), KEY_SIZE), &value));
+    EXPECT_EQ(value, values[i]);
+  }
+}
+
 }  // namespace
\ No newline at end of file
@@ -0,0 +1,444 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common/db.h"
+#include "engine/config.h"
+#include "engine/key_hash.h"
+#include "engine/persist.h"
+#include "engine/record.h"
+#include "gtest/gtest.h"
+#include "utils.h"
+
+namespace {
+
+const uint64_t LINE_SIZE = 64;
+// stores of aligned words are atomic, larger ones may be torn
+const uint64_t WORD_SIZE = 8;
+
+// Replays the persistence ordering of the engine on a shadow copy of the
+// pool, which holds what is durable. At a crash, every line flushed since
+// the last fence and every line stored but not flushed may have reached pmem
+// in full, in part or not at all, independently of the others.
+class CrashTracer : public PersistTracer {
+ public:
+  struct Image {
+    uint64_t event;
+    // #operations of the workload that had returned at the crash
+    uint64_t num_completed;
+    std::vector<char> data;
+  };
+
+  // takes an image right before each of the events in crash_points
+  CrashTracer(const std::vector<uint64_t>& crash_points, uint32_t seed,
+              const std::atomic<uint64_t>* num_completed)
+      : crash_points_(crash_points.begin(), crash_points.end()),
+        mt_(seed),
+        num_completed_(num_completed),
+        base_(nullptr),
+        num_events_(0) {}
+
+  std::vector<Image> images;
+
+  void OnMap(char* base, uint64_t len) override {
+    std::lock_guard<std::mutex> lock(mtx_);
+    base_ = base;
+    durable_.assign(base, base + len);
+    pending_.clear();
+    dirty_.clear();
+  }
+
+  void OnUnmap(char* base) override {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (base == base_) base_ = nullptr;
+  }
+
+  void OnStore(const void* addr, uint64_t len) override {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!Traced(addr)) return;
+    MaybeCrash();
+    ForEachLine(addr, len, [&](uint64_t line) { dirty_.insert(line); });
+  }
+
+  void OnFlush(const void* addr, uint64_t len) override {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!Traced(addr)) return;
+    MaybeCrash();
+    ForEachLine(addr, len, [&](uint64_t line) {
+      auto& content = pending_[line];
+      content.assign(base_ + line, base_ + line + LINE_SIZE);
+      dirty_.erase(line);
+    });
+  }
+
+  void OnFence() override {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (base_ == nullptr) return;
+    MaybeCrash();
+    for (auto& p : pending_) {
+      memcpy(&durable_[p.first], p.second.data(), LINE_SIZE);
+    }
+    pending_.clear();
+  }
+
+ private:
+  std::mutex mtx_;
+  std::set<uint64_t> crash_points_;
+  std::mt19937 mt_;
+  const std::atomic<uint64_t>* num_completed_;
+
+  char* base_;
+  uint64_t num_events_;
+  std::vector<char> durable_;
+  // lines flushed since the last fence, as they were flushed
+  std::map<uint64_t, std::vector<char>> pending_;
+  // lines stored but not flushed
+  std::set<uint64_t> dirty_;
+
+  bool Traced(const void* addr) {
+    return base_ != nullptr && (const char*)addr >= base_ &&
+           (const char*)addr < base_ + durable_.size();
+  }
+
+  template <typename F>
+  void ForEachLine(const void* addr, uint64_t len, F func) {
+    uint64_t from = ((const char*)addr - base_) / LINE_SIZE * LINE_SIZE;
+    uint64_t to = std::min((uint64_t)durable_.size(),
+                           (uint64_t)((const char*)addr - base_) + len);
+    for (uint64_t line = from; line < to; line += LINE_SIZE) func(line);
+  }
+
+  // writes back none, all or some of the words of a line
+  void MaybeApply(std::vector<char>* data, uint64_t line,
+                  const char* content) {
+    uint32_t choice = mt_() % 4;
+    for (uint64_t i = 0; i < LINE_SIZE; i += WORD_SIZE) {
+      if (choice == 0) break;
+      if (choice == 1 || mt_() % 2 == 0) {
+        memcpy(&(*data)[line + i], content + i, WORD_SIZE);
+      }
+    }
+  }
+
+  void MaybeCrash() {
+    if (crash_points_.count(num_events_++) == 0) return;
+
+    images.emplace_back();
+    auto& image = images.back();
+    image.event = num_events_ - 1;
+    image.num_completed = num_completed_->load();
+    image.data = durable_;
+    for (auto& p : pending_) {
+      MaybeApply(&image.data, p.first, p.second.data());
+    }
+    for (auto line : dirty_) {
+      MaybeApply(&image.data, line, base_ + line);
+    }
+  }
+};
+
+// values of all kinds: mostly plain ones, some compressible and a few large
+std::string RandomValue(std::mt19937& mt) {
+  uint32_t len;
+  switch (mt() % 8) {
+    case 0:
+      len = LARGE_VALUE_MIN_LEN + mt() % (2 * LARGE_VALUE_MIN_LEN);
+      break;
+    case 1:
+      len = 256 + mt() % 2048;
+      break;
+    default:
+      len = 1 + mt() % 200;
+      break;
+  }
+  return GenerateRandomString(mt, len);
+}
+
+void WriteImage(const CrashTracer::Image& image, const std::string& path) {
+  remove(path.c_str());
+  remove((path + ".cold").c_str());
+  FILE* file = fopen(path.c_str(), "wb");
+  ASSERT_EQ(image.data.size(),
+            fwrite(image.data.data(), 1, image.data.size(), file));
+  fclose(file);
+}
+
+// offset in image of the record of key holding value
+uint64_t FindRecord(const std::vector<char>& image, const std::string& key,
+                    const std::string& value) {
+  const uint64_t key_offset = 16;
+  for (uint64_t ptr = 0; ptr + key_offset + KEY_SIZE + value.size() <=
+                         image.size();
+       ptr += LINE_SIZE) {
+    if (memcmp(&image[ptr + key_offset], key.data(), KEY_SIZE) == 0 &&
+        memcmp(&image[ptr + key_offset + KEY_SIZE], value.data(),
+               value.size()) == 0) {
+      return ptr;
+    }
+  }
+  return image.size();
+}
+
+}  // namespace
+
+// Sets values of all kinds, takes crash images at random points and checks
+// that each of them recovers every completed set and nothing made up.
+TEST(CrashTest, RandomCrashPoints) {
+  const uint32_t seed = time(nullptr);
+  SCOPED_TRACE("seed " + std::to_string(seed));
+  std::mt19937 mt(seed);
+
+  const uint32_t num_keys = 4 * NUM_SHARDS;
+  const uint32_t num_sets = 1000;
+  const uint32_t num_images = 32;
+
+  static char key[KEY_SIZE];
+  auto gen_key = [&](uint32_t x) {
+    memset(key, 0, KEY_SIZE);
+    *(uint32_t*)key = x;
+  };
+
+  std::vector<std::pair<uint32_t, std::string>> history;
+  for (uint32_t i = 0; i < num_sets; i++) {
+    history.emplace_back(mt() % num_keys, RandomValue(mt));
+  }
+
+  // every set makes at least a store, a flush and a fence
+  std::vector<uint64_t> crash_points;
+  for (uint32_t i = 0; i < num_images; i++) {
+    crash_points.push_back(mt() % (3 * num_sets));
+  }
+
+  std::atomic<uint64_t> num_completed(0);
+  CrashTracer tracer(crash_points, seed, &num_completed);
+  std::string db_file_path = "/tmp/crash";
+  remove(db_file_path.c_str());
+  SetPersistTracer(&tracer);
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+  for (auto& set : history) {
+    gen_key(set.first);
+    ASSERT_EQ(Ok, db->Set(Slice(key, KEY_SIZE),
+                          Slice(&set.second[0], set.second.size())));
+    num_completed.fetch_add(1);
+  }
+  SetPersistTracer(nullptr);
+  delete db;
+  ASSERT_FALSE(tracer.images.empty());
+
+  std::string image_path = "/tmp/crash_image";
+  for (auto& image : tracer.images) {
+    SCOPED_TRACE("crash at event " + std::to_string(image.event) + " after " +
+                 std::to_string(image.num_completed) + " sets");
+    WriteImage(image, image_path);
+
+    // the last value of every key, and the set that may have been cut
+    std::map<uint32_t, const std::string*> model;
+    for (uint64_t i = 0; i < image.num_completed; i++) {
+      model[history[i].first] = &history[i].second;
+    }
+    const std::pair<uint32_t, std::string>* cut = nullptr;
+    if (image.num_completed < history.size()) {
+      cut = &history[image.num_completed];
+    }
+
+    ASSERT_EQ(Ok, DB::CreateOrOpen(image_path, &db, nullptr));
+    for (uint32_t i = 0; i < num_keys; i++) {
+      gen_key(i);
+      std::string value;
+      Status status = db->Get(Slice(key, KEY_SIZE), &value);
+      bool cut_value = cut != nullptr && cut->first == i &&
+                       status == Ok && value == cut->second;
+      if (model.count(i) == 0) {
+        EXPECT_TRUE(status == NotFound || cut_value) << "key " << i;
+      } else {
+        EXPECT_TRUE((status == Ok && value == *model[i]) || cut_value)
+            << "key " << i;
+      }
+    }
+    delete db;
+  }
+}
+
+// Interleaves transactions with plain sets, takes crash images at random
+// points and checks that each of them recovers every completed operation and
+// either all or none of the keys of the one that was cut.
+TEST(CrashTest, Transactions) {
+  const uint32_t seed = time(nullptr);
+  SCOPED_TRACE("seed " + std::to_string(seed));
+  std::mt19937 mt(seed);
+
+  const uint32_t num_keys = 4 * NUM_SHARDS;
+  const uint32_t num_ops = 300;
+  const uint32_t num_images = 32;
+
+  auto gen_key = [](uint32_t x) {
+    std::string key(KEY_SIZE, 0);
+    memcpy(&key[0], &x, sizeof(x));
+    return key;
+  };
+
+  // the keys and values of every operation, a plain set has a single key
+  std::vector<std::vector<std::pair<uint32_t, std::string>>> history;
+  for (uint32_t i = 0; i < num_ops; i++) {
+    uint32_t n = mt() % 3 == 0 ? 1 : 2 + mt() % (TXN_MAX_KEYS - 1);
+    std::set<uint32_t> keys;
+    while (keys.size() < n) keys.insert(mt() % num_keys);
+    history.emplace_back();
+    for (auto x : keys) history.back().emplace_back(x, RandomValue(mt));
+  }
+
+  // every key of an operation makes at least a store and a flush
+  std::vector<uint64_t> crash_points;
+  for (uint32_t i = 0; i < num_images; i++) {
+    crash_points.push_back(mt() % (8 * num_ops));
+  }
+
+  std::atomic<uint64_t> num_completed(0);
+  CrashTracer tracer(crash_points, seed, &num_completed);
+  std::string db_file_path = "/tmp/crash_txn";
+  remove(db_file_path.c_str());
+  SetPersistTracer(&tracer);
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+  for (auto& op : history) {
+    std::vector<std::string> keys;
+    std::vector<Slice> key_slices, value_slices;
+    for (auto& set : op) keys.push_back(gen_key(set.first));
+    for (uint32_t i = 0; i < op.size(); i++) {
+      key_slices.emplace_back(&keys[i][0], KEY_SIZE);
+      value_slices.emplace_back((char*)op[i].second.data(),
+                                op[i].second.size());
+    }
+    if (op.size() == 1) {
+      ASSERT_EQ(Ok, db->Set(key_slices[0], value_slices[0]));
+    } else {
+      ASSERT_EQ(Ok, db->MultiSet(key_slices.data(), value_slices.data(),
+                                 op.size()));
+    }
+    num_completed.fetch_add(1);
+  }
+  SetPersistTracer(nullptr);
+  delete db;
+  ASSERT_FALSE(tracer.images.empty());
+
+  std::string image_path = "/tmp/crash_txn_image";
+  for (auto& image : tracer.images) {
+    SCOPED_TRACE("crash at event " + std::to_string(image.event) + " after " +
+                 std::to_string(image.num_completed) + " operations");
+    WriteImage(image, image_path);
+
+    // the last value of every key, without and with the operation that may
+    // have been cut
+    std::map<uint32_t, const std::string*> before;
+    for (uint64_t i = 0; i < image.num_completed; i++) {
+      for (auto& set : history[i]) before[set.first] = &set.second;
+    }
+    auto after = before;
+    if (image.num_completed < history.size()) {
+      for (auto& set : history[image.num_completed]) {
+        after[set.first] = &set.second;
+      }
+    }
+
+    ASSERT_EQ(Ok, DB::CreateOrOpen(image_path, &db, nullptr));
+    bool matches_before = true, matches_after = true;
+    for (uint32_t i = 0; i < num_keys; i++) {
+      std::string key = gen_key(i);
+      std::string value;
+      Status status = db->Get(Slice(&key[0], KEY_SIZE), &value);
+      ASSERT_TRUE(status == Ok || status == NotFound) << "key " << i;
+      auto matches = [&](const std::map<uint32_t, const std::string*>& m) {
+        auto it = m.find(i);
+        if (it == m.end()) return status == NotFound;
+        return status == Ok && value == *it->second;
+      };
+      matches_before = matches_before && matches(before);
+      matches_after = matches_after && matches(after);
+    }
+    EXPECT_TRUE(matches_before || matches_after);
+    delete db;
+  }
+}
+
+// The range of a freed record is split for a new record whose header has not
+// reached pmem at the crash, while the tail has been reused for a durable
+// record since. The old header still covers the tail, whose record must be
+// recovered nonetheless.
+TEST(CrashTest, ReuseWithSplit) {
+  std::mt19937 mt(0);
+  // three keys of a shard
+  std::vector<std::string> keys;
+  for (uint64_t x = 0; keys.size() < 3; x++) {
+    std::string key(KEY_SIZE, 0);
+    memcpy(&key[0], &x, sizeof(x));
+    if (KeyHash::Shard(KeyHash::Hash(Slice(&key[0], KEY_SIZE))) == 0) {
+      keys.push_back(key);
+    }
+  }
+  std::string freed = GenerateRandomString(mt, 1400);
+  std::string tail = GenerateRandomString(mt, 500);
+  std::string other = GenerateRandomString(mt, 100);
+
+  std::string db_file_path = "/tmp/crash_split";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+  auto set = [&](const std::string& key, const std::string& value) {
+    ASSERT_EQ(Ok, db->Set(Slice((char*)key.data(), KEY_SIZE),
+                          Slice((char*)value.data(), value.size())));
+  };
+  set(keys[0], freed);
+  set(keys[1], tail);
+  set(keys[0], other);
+  set(keys[2], other);
+  delete db;
+
+  CrashTracer::Image image;
+  FILE* file = fopen(db_file_path.c_str(), "rb");
+  ASSERT_NE(nullptr, file);
+  fseek(file, 0, SEEK_END);
+  image.data.resize(ftell(file));
+  fseek(file, 0, SEEK_SET);
+  ASSERT_EQ(image.data.size(),
+            fread(&image.data[0], 1, image.data.size(), file));
+  fclose(file);
+
+  // move the record of keys[1] to the tail of the freed range of keys[0]
+  uint64_t freed_ptr = FindRecord(image.data, keys[0], freed);
+  uint64_t tail_ptr = FindRecord(image.data, keys[1], tail);
+  ASSERT_LT(freed_ptr, image.data.size());
+  ASSERT_LT(tail_ptr, image.data.size());
+  uint64_t freed_cap = ((PmemRecord*)&image.data[freed_ptr])->cap();
+  uint64_t tail_cap = ((PmemRecord*)&image.data[tail_ptr])->cap();
+  ASSERT_GE(freed_cap, tail_cap + 256);
+  uint64_t split = freed_cap - tail_cap;
+  std::vector<char> record(&image.data[tail_ptr],
+                           &image.data[tail_ptr] + tail_cap);
+  memset(&image.data[tail_ptr], 0, tail_cap);
+  std::copy(record.begin(), record.end(), &image.data[freed_ptr + split]);
+  // the digest of the old header may still match by chance
+  auto old = (PmemRecord*)&image.data[freed_ptr];
+  old->digest = PmemRecord::CalcDigest(old->key, old->value, old->stored_len(),
+                                       old->cap(), old->timestamp, old->flags);
+  ASSERT_TRUE(old->Intact());
+  std::string image_path = "/tmp/crash_split_image";
+  WriteImage(image, image_path);
+
+  ASSERT_EQ(Ok, DB::CreateOrOpen(image_path, &db, nullptr));
+  std::string value;
+  ASSERT_EQ(Ok, db->Get(Slice(&keys[0][0], KEY_SIZE), &value));
+  EXPECT_EQ(other, value);
+  ASSERT_EQ(Ok, db->Get(Slice(&keys[1][0], KEY_SIZE), &value));
+  EXPECT_EQ(tail, value);
+  ASSERT_EQ(Ok, db->Get(Slice(&keys[2][0], KEY_SIZE), &value));
+  EXPECT_EQ(other, value);
+  delete db;
+}
@@ -0,0 +1,192 @@
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/db.h"
+#include "engine/config.h"
+#include "engine/key_hash.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// the first n keys of shard 0, so that a few of them fill it
+std::vector<std::string> Shard0Keys(uint32_t n) {
+  std::vector<std::string> keys;
+  for (uint64_t x = 0; keys.size() < n; x++) {
+    std::string key(KEY_SIZE, 0);
+    memcpy(&key[0], &x, sizeof(x));
+    if (KeyHash::Shard(KeyHash::Hash(Slice(&key[0], KEY_SIZE))) == 0) {
+      keys.push_back(key);
+    }
+  }
+  return keys;
+}
+
+// random bytes, so that compression does not make room
+std::string RandomValue(std::mt19937* mt, uint32_t len) {
+  std::string value(len, 0);
+  for (auto& c : value) c = (char)(*mt)();
+  return value;
+}
+
+Status Set(DB* db, const std::string& key, const std::string& value) {
+  return db->Set(Slice((char*)key.data(), KEY_SIZE),
+                 Slice((char*)value.data(), value.size()));
+}
+
+Status Get(DB* db, const std::string& key, std::string* value) {
+  return db->Get(Slice((char*)key.data(), KEY_SIZE), value);
+}
+
+}  // namespace
+
+#ifndef USE_EVICTION
+// A full shard fails the sets that do not fit with OutOfMemory, and the
+// keys set before are left intact.
+TEST(EvictionTest, OutOfMemory) {
+  std::string db_file_path = "/tmp/eviction";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+
+  std::mt19937 mt(0);
+  auto keys = Shard0Keys(2 * UNIQUE_KEYS_PER_SHARD);
+  std::vector<std::string> values;
+  uint32_t num_failed = 0;
+  for (auto& key : keys) {
+    values.push_back(RandomValue(&mt, 3000));
+    Status status = Set(db, key, values.back());
+    ASSERT_TRUE(status == Ok || status == OutOfMemory);
+    if (status != Ok) {
+      values.back().clear();
+      num_failed++;
+    }
+  }
+  EXPECT_GE(num_failed, UNIQUE_KEYS_PER_SHARD);
+
+  // values too large for the shard
+  std::string large = RandomValue(&mt, PMEM_SIZE / NUM_SHARDS);
+  EXPECT_EQ(OutOfMemory, Set(db, keys[0], large));
+
+  std::string value;
+  for (uint32_t i = 0; i < keys.size(); i++) {
+    if (values[i].empty()) {
+      EXPECT_EQ(NotFound, Get(db, keys[i], &value)) << "key " << i;
+    } else {
+      ASSERT_EQ(Ok, Get(db, keys[i], &value)) << "key " << i;
+      EXPECT_EQ(values[i], value) << "key " << i;
+    }
+  }
+  delete db;
+}
+#else
+// A full shard evicts the least recently used records to make room: every
+// set succeeds, and a key is either gone or has its last value, also after
+// a reopen.
+TEST(EvictionTest, Evict) {
+  std::string db_file_path = "/tmp/eviction_cache";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+
+  std::mt19937 mt(0);
+  auto keys = Shard0Keys(UNIQUE_KEYS_PER_SHARD);
+  std::vector<std::string> values(keys.size());
+  std::string value;
+  for (uint32_t round = 0; round < 3; round++) {
+    for (uint32_t i = 0; i < keys.size(); i++) {
+      // large values, in extents, and records alike
+      uint32_t len = i % 10 == 0 ? 40000 : 3000;
+      values[i] = RandomValue(&mt, len);
+      ASSERT_EQ(Ok, Set(db, keys[i], values[i])) << "key " << i;
+      ASSERT_EQ(Ok, Get(db, keys[i], &value)) << "key " << i;
+      EXPECT_EQ(values[i], value) << "key " << i;
+    }
+  }
+
+  auto check = [&]() {
+    uint32_t num_found = 0;
+    for (uint32_t i = 0; i < keys.size(); i++) {
+      Status status = Get(db, keys[i], &value);
+      ASSERT_TRUE(status == Ok || status == NotFound) << "key " << i;
+      if (status == Ok) {
+        EXPECT_EQ(values[i], value) << "key " << i;
+        num_found++;
+      }
+    }
+    EXPECT_GT(num_found, 0u);
+  };
+  check();
+  delete db;
+
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+  check();
+  delete db;
+}
+
+// Threads racing to insert the same keys leave index nodes behind, which
+// the eviction rounds that follow must not take for the nodes of the keys.
+TEST(EvictionTest, RacingInserts) {
+  std::string db_file_path = "/tmp/eviction_racing";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+
+  // a lost race costs a node, the fillers still fit in the index
+  const uint32_t num_threads = 4;
+  const uint32_t num_raced = 16;
+  const uint32_t num_fillers = 80;
+  auto keys = Shard0Keys(num_raced + num_fillers);
+  std::vector<std::vector<std::string>> raced_values(num_threads);
+  for (uint32_t t = 0; t < num_threads; t++) {
+    std::mt19937 mt(t);
+    for (uint32_t i = 0; i < num_raced; i++) {
+      raced_values[t].push_back(RandomValue(&mt, 1000));
+    }
+  }
+
+  // the threads set each key at once
+  std::atomic<uint32_t> arrived(0);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      for (uint32_t i = 0; i < num_raced; i++) {
+        arrived.fetch_add(1);
+        while (arrived.load() < (i + 1) * num_threads) {
+          std::this_thread::yield();
+        }
+        EXPECT_EQ(Ok, Set(db, keys[i], raced_values[t][i])) << "key " << i;
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  // more than the shard holds, the ranges of the evicted records are reused
+  std::mt19937 mt(num_threads);
+  std::vector<std::string> values(keys.size());
+  std::string value;
+  for (uint32_t i = num_raced; i < keys.size(); i++) {
+    values[i] = RandomValue(&mt, 4000);
+    ASSERT_EQ(Ok, Set(db, keys[i], values[i])) << "key " << i;
+  }
+
+  for (uint32_t i = 0; i < keys.size(); i++) {
+    Status status = Get(db, keys[i], &value);
+    ASSERT_TRUE(status == Ok || status == NotFound) << "key " << i;
+    if (status != Ok) continue;
+    if (i >= num_raced) {
+      EXPECT_EQ(values[i], value) << "key " << i;
+      continue;
+    }
+    bool found = false;
+    for (uint32_t t = 0; t < num_threads; t++) {
+      found = found || value == raced_values[t][i];
+    }
+    EXPECT_TRUE(found) << "key " << i;
+  }
+  delete db;
+}
+#endif
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/db.h"
+#include "engine/config.h"
+#include "engine/hot_keys.h"
+#include "gtest/gtest.h"
+#include "utils.h"
+
+namespace {
+
+// a few keys take num_hot / 10 of the operations each, the others are spread
+// over many keys
+void Skewed(HotKeyTracker* tracker, uint32_t num_hot, uint64_t num_ops,
+            uint32_t seed) {
+  std::mt19937_64 mt(seed);
+  for (uint64_t i = 0; i < num_ops; i++) {
+    uint64_t x = mt() % 10 < num_hot ? mt() % num_hot : num_hot + mt() % 100000;
+    std::string key = MakeKey(x);
+    tracker->Sample(Slice(&key[0], KEY_SIZE));
+  }
+}
+
+}  // namespace
+
+// The sketches of several threads agree on the hottest keys.
+TEST(HotKeysTest, Top) {
+  HotKeyTracker tracker;
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < 4; i++) {
+    threads.emplace_back(Skewed, &tracker, 4, 200000, i);
+  }
+  for (auto& thread : threads) thread.join();
+
+  std::vector<std::string> keys;
+  tracker.Top(4, &keys);
+  ASSERT_EQ(4u, keys.size());
+  std::sort(keys.begin(), keys.end());
+  for (uint64_t i = 0; i < 4; i++) {
+    EXPECT_TRUE(std::binary_search(keys.begin(), keys.end(), MakeKey(i)))
+        << "key " << i;
+  }
+  EXPECT_GT(tracker.num_hot_slots(), 0u);
+}
+
+// A replica is only served until the next set of its key, by any thread.
+TEST(HotKeysTest, Replicas) {
+  HotKeyTracker tracker;
+  Skewed(&tracker, 1, 100000, 0);
+  std::string key = MakeKey(0);
+  Slice key_slice(&key[0], KEY_SIZE);
+
+  std::string value;
+  uint64_t version;
+  ASSERT_FALSE(tracker.ReadReplica(key_slice, &value, &version));
+  ASSERT_NE(0u, version);
+  tracker.WriteReplica(key_slice, "v1", 0, version);
+  ASSERT_TRUE(tracker.ReadReplica(key_slice, &value, &version));
+  EXPECT_EQ("v1", value);
+
+  std::thread([&]() { tracker.Invalidate(key_slice); }).join();
+  EXPECT_FALSE(tracker.ReadReplica(key_slice, &value, &version));
+  EXPECT_NE(0u, version);
+
+  // cold keys are never replicated
+  std::string cold = MakeKey(1 << 20);
+  EXPECT_FALSE(
+      tracker.ReadReplica(Slice(&cold[0], KEY_SIZE), &value, &version));
+  EXPECT_EQ(0u, version);
+}
+
+// Readers of a hot key never go back to an older value while it is being
+// set, and see the last one once the sets are over.
+TEST(HotKeysTest, SetsInvalidateReplicas) {
+  std::string db_file_path = "/tmp/hot_keys";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+
+  std::string key = MakeKey(7);
+  Slice key_slice(&key[0], KEY_SIZE);
+  const uint64_t num_sets = 20000;
+  auto set = [&](uint64_t x) {
+    std::string value = std::to_string(x);
+    return db->Set(key_slice, Slice(&value[0], value.size()));
+  };
+  ASSERT_EQ(Ok, set(0));
+
+  std::atomic<bool> done(false);
+  std::vector<std::thread> readers;
+  std::atomic<uint32_t> num_errors(0);
+  for (uint32_t i = 0; i < 2; i++) {
+    readers.emplace_back([&]() {
+      uint64_t last = 0;
+      std::string value;
+      while (!done.load()) {
+        if (db->Get(key_slice, &value) != Ok || std::stoull(value) < last) {
+          num_errors++;
+        } else {
+          last = std::stoull(value);
+        }
+      }
+      if (db->Get(key_slice, &value) != Ok || std::stoull(value) != num_sets) {
+        num_errors++;
+      }
+    });
+  }
+  for (uint64_t x = 1; x <= num_sets; x++) {
+    std::string value;
+    bool ok = set(x) == Ok && db->Get(key_slice, &value) == Ok &&
+              value == std::to_string(x);
+    EXPECT_TRUE(ok) << "set " << x << ", got " << value;
+    if (!ok) break;
+  }
+  done.store(true);
+  for (auto& reader : readers) reader.join();
+  EXPECT_EQ(0u, num_errors.load());
+
+  std::vector<std::string> keys;
+  db->HotKeys(1, &keys);
+  ASSERT_EQ(1u, keys.size());
+  EXPECT_EQ(key, keys[0]);
+  delete db;
+}
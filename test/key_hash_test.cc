@@ -0,0 +1,67 @@
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "engine/config.h"
+#include "engine/key_hash.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// every count is within 6 standard deviations of a uniform distribution
+void ExpectUniform(const std::vector<uint64_t>& counts, const char* what) {
+  uint64_t sum = 0;
+  for (auto c : counts) sum += c;
+  double mean = 1.0 * sum / counts.size();
+  for (uint64_t i = 0; i < counts.size(); i++) {
+    EXPECT_NEAR(counts[i], mean, 6 * std::sqrt(mean)) << what << " " << i;
+  }
+}
+
+// Hashes 64 keys of pattern per bucket of every shard, and checks that the
+// shards, and the buckets and the tags within a shard, are evenly used. The
+// former multiply-add hash, with the shard taken from the first byte of the
+// key, left counters of a shard with 4 of the 256 tags.
+void CheckDistribution(const std::function<void(uint64_t, char*)>& pattern) {
+  const uint64_t n = 64 * NUM_BUCKETS_PER_SHARD * NUM_SHARDS;
+  std::vector<uint64_t> shards(NUM_SHARDS, 0);
+  std::vector<uint64_t> buckets(NUM_BUCKETS_PER_SHARD, 0);
+  std::vector<uint64_t> tags(TAG_MASK + 1, 0);
+  // bucket and tag of a shard are independent
+  std::vector<uint64_t> pairs(16, 0);
+  char key[KEY_SIZE];
+  for (uint64_t i = 0; i < n; i++) {
+    memset(key, 0, KEY_SIZE);
+    pattern(i, key);
+    uint64_t hash_value = KeyHash::Hash(Slice(key, KEY_SIZE));
+    uint32_t shard = KeyHash::Shard(hash_value);
+    shards[shard]++;
+    if (shard != 0) continue;
+    buckets[KeyHash::Bucket(hash_value)]++;
+    tags[KeyHash::Tag(hash_value)]++;
+    pairs[KeyHash::Bucket(hash_value) % 4 * 4 + KeyHash::Tag(hash_value) % 4]++;
+  }
+  ExpectUniform(shards, "shard");
+  ExpectUniform(buckets, "bucket");
+  ExpectUniform(tags, "tag");
+  ExpectUniform(pairs, "bucket and tag");
+}
+
+}  // namespace
+
+TEST(KeyHashTest, Counters) {
+  CheckDistribution([](uint64_t i, char* key) { *(uint64_t*)key = i; });
+}
+
+TEST(KeyHashTest, HighWordCounters) {
+  CheckDistribution(
+      [](uint64_t i, char* key) { *(uint64_t*)(key + 8) = i; });
+}
+
+TEST(KeyHashTest, Strides) {
+  CheckDistribution([](uint64_t i, char* key) {
+    *(uint64_t*)key = i << 20;
+    *(uint64_t*)(key + 8) = i * 199;
+  });
+}
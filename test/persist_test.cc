@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "engine/persist.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t MicrosSince(const Clock::time_point& from) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               from)
+      .count();
+}
+
+}  // namespace
+
+// Flushes are written to the media in whole XPLines, those written in part
+// cost a read-modify-write.
+TEST(PersistTest, EmulatedWriteAmplification) {
+  char* buf = (char*)aligned_alloc(XPLINE_SIZE, 4 * XPLINE_SIZE);
+  memset(buf, 0, 4 * XPLINE_SIZE);
+  PmemEmulation emulation = PmemEmulation::Optane();
+  SetPmemEmulation(&emulation);
+
+  PmemPersist(buf, 64);
+  auto stats = GetPmemEmulationStats();
+  EXPECT_EQ(64u, stats.bytes_flushed);
+  EXPECT_EQ(XPLINE_SIZE, stats.media_bytes_written);
+  EXPECT_EQ(1u, stats.rmw_xplines);
+
+  PmemPersist(buf, 2 * XPLINE_SIZE);
+  stats = GetPmemEmulationStats();
+  EXPECT_EQ(3 * XPLINE_SIZE, stats.media_bytes_written);
+  EXPECT_EQ(1u, stats.rmw_xplines);
+
+  // straddles two XPLines, both in part
+  PmemMemcpyPersist(buf + 200, buf, 100);
+  stats = GetPmemEmulationStats();
+  EXPECT_EQ(2 * XPLINE_SIZE + 64 + 100, stats.bytes_flushed);
+  EXPECT_EQ(5 * XPLINE_SIZE, stats.media_bytes_written);
+  EXPECT_EQ(3u, stats.rmw_xplines);
+
+  // stores that are not flushed are not charged
+  PmemMemcpy(buf, buf + XPLINE_SIZE, XPLINE_SIZE, PMEM_F_MEM_NOFLUSH);
+  EXPECT_EQ(5 * XPLINE_SIZE, GetPmemEmulationStats().media_bytes_written);
+
+  SetPmemEmulation(nullptr);
+  PmemPersist(buf, 64);
+  EXPECT_EQ(0u, GetPmemEmulationStats().media_bytes_written);
+  free(buf);
+}
+
+// A drain waits for the media to write what has been flushed, and a read
+// pays the latency once per XPLine.
+TEST(PersistTest, EmulatedCosts) {
+  char* buf = (char*)aligned_alloc(XPLINE_SIZE, 4 * XPLINE_SIZE);
+  memset(buf, 0, 4 * XPLINE_SIZE);
+  // 1 MB/s writes 256 bytes in 256 us
+  PmemEmulation emulation = {1000, 1000000, 1, 0};
+  SetPmemEmulation(&emulation);
+
+  auto start = Clock::now();
+  PmemFlush(buf, 64);
+  EXPECT_LT(MicrosSince(start), 256u);
+  PmemDrain();
+  EXPECT_GE(MicrosSince(start), 256u);
+
+  start = Clock::now();
+  PmemRead(buf + XPLINE_SIZE, 16);
+  EXPECT_GE(MicrosSince(start), 1u);
+  for (uint32_t i = 1; i < 16; i++) PmemRead(buf + XPLINE_SIZE + i * 16, 16);
+  EXPECT_EQ(XPLINE_SIZE, GetPmemEmulationStats().bytes_read);
+  EXPECT_LT(GetPmemEmulationStats().injected_ns, 256000u + 2 * 1000u);
+
+  SetPmemEmulation(nullptr);
+  free(buf);
+}
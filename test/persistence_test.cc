@@ -1,10 +1,36 @@
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
 #include <random>
+#include <vector>
 
 #include "common/db.h"
 #include "engine/config.h"
+#include "engine/key_hash.h"
+#include "engine/pool_header.h"
+#include "engine/record.h"
 #include "gtest/gtest.h"
 #include "utils.h"
 
+namespace {
+
+// the first n keys, as integers, that are in shard 0
+std::vector<uint32_t> Shard0Keys(uint32_t n) {
+  std::vector<uint32_t> keys;
+  char key[KEY_SIZE];
+  for (uint32_t x = 0; keys.size() < n; x++) {
+    memset(key, 0, KEY_SIZE);
+    *(uint32_t*)key = x;
+    if (KeyHash::Shard(KeyHash::Hash(Slice(key, KEY_SIZE))) == 0) {
+      keys.push_back(x);
+    }
+  }
+  return keys;
+}
+
+}  // namespace
+
 TEST(DBTest, Persistence) {
   DB* db;
   std::string db_file_path = "/tmp/persistence";
@@ -47,4 +73,306 @@ TEST(DBTest, Persistence) {
       EXPECT_EQ(ans, dic[i]);
     }
   }
-}
\ No newline at end of file
+}
+TEST(DBTest, LargeValue) {
+  DB* db;
+  std::string db_file_path = "/tmp/persistence_large_value";
+  remove(db_file_path.c_str());
+
+  std::mt19937 mt(time(nullptr));
+
+  static char key[KEY_SIZE];
+  auto gen_key = [&](uint32_t x) {
+    memset(key, 0, KEY_SIZE);
+    *(uint32_t*)key = x;
+  };
+
+  // from small records up to several extents, every key in its own shard
+  const uint32_t lens[] = {LARGE_VALUE_MIN_LEN - 1, LARGE_VALUE_MIN_LEN,
+                           MAX_EXTENT_SIZE, MAX_EXTENT_SIZE + 1,
+                           MAX_VALUE_LEN + 1, 2 * MAX_EXTENT_SIZE + 100};
+  const uint32_t num_keys = sizeof(lens) / sizeof(lens[0]);
+
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path.c_str(), &db, nullptr));
+  std::map<uint32_t, std::string> dic;
+  for (uint32_t i = 0; i < num_keys; i++) {
+    gen_key(i);
+    std::string value = GenerateRandomString(mt, lens[i]);
+    dic[i] = value;
+    EXPECT_EQ(Ok, db->Set(Slice(key, KEY_SIZE),
+                          Slice((char*)value.data(), value.size())));
+  }
+  std::string value = GenerateRandomString(mt, MAX_LARGE_VALUE_LEN + 1);
+  EXPECT_NE(Ok, db->Set(Slice(key, KEY_SIZE),
+                        Slice((char*)value.data(), value.size())));
+  delete db;
+
+  for (int round = 0; round < 2; round++) {
+    ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path.c_str(), &db, nullptr));
+    for (uint32_t i = 0; i < num_keys; i++) {
+      gen_key(i);
+      std::string ans;
+      auto ret = db->Get(Slice(key, KEY_SIZE), &ans);
+      EXPECT_EQ(ret, Ok);
+      if (ret == Ok) {
+        EXPECT_EQ(ans, dic[i]);
+      }
+
+      // streamed in chunks that straddle the extents
+      std::string streamed;
+      char buf[1000];
+      uint64_t read_len = sizeof(buf);
+      while (read_len == sizeof(buf)) {
+        ASSERT_EQ(Ok, db->Read(Slice(key, KEY_SIZE), streamed.size(), buf,
+                               sizeof(buf), &read_len));
+        streamed.append(buf, read_len);
+      }
+      EXPECT_EQ(streamed, dic[i]);
+    }
+
+    // the extents of overwritten values are reused, before and after
+    // recovery, so the shard does not run out of space
+    gen_key(num_keys);
+    for (int j = 0; j < 20; j++) {
+      value = GenerateRandomString(mt, MAX_EXTENT_SIZE + j);
+      dic[num_keys] = value;
+      ASSERT_EQ(Ok, db->Set(Slice(key, KEY_SIZE),
+                            Slice((char*)value.data(), value.size())));
+    }
+    std::string ans;
+    EXPECT_EQ(Ok, db->Get(Slice(key, KEY_SIZE), &ans));
+    EXPECT_EQ(ans, dic[num_keys]);
+    delete db;
+  }
+}
+
+#ifdef USE_TIERING
+TEST(DBTest, Tiering) {
+  DB* db;
+  std::string db_file_path = "/tmp/persistence_tiering";
+  remove(db_file_path.c_str());
+
+  std::mt19937 mt(time(nullptr));
+
+  // all in the first shard
+  auto keys = Shard0Keys(UNIQUE_KEYS_PER_SHARD / 2);
+  static char key[KEY_SIZE];
+  auto gen_key = [&](uint32_t x) {
+    memset(key, 0, KEY_SIZE);
+    *(uint32_t*)key = keys[x];
+  };
+  auto cold_tier_size = [&]() {
+    struct stat buffer;
+    stat((db_file_path + ".cold").c_str(), &buffer);
+    return buffer.st_size;
+  };
+  auto check = [&](std::map<uint32_t, std::string>& dic) {
+    for (auto& kv : dic) {
+      gen_key(kv.first);
+      std::string ans;
+      auto ret = db->Get(Slice(key, KEY_SIZE), &ans);
+      EXPECT_EQ(ret, Ok);
+      if (ret == Ok) {
+        EXPECT_EQ(ans, kv.second);
+      }
+    }
+  };
+
+  // fill the shard far beyond the demotion threshold
+  const uint32_t shard_size = (PMEM_SIZE - POOL_HEADER_SIZE) / NUM_SHARDS;
+  const uint32_t num_keys = UNIQUE_KEYS_PER_SHARD / 2;
+  const uint32_t value_len = shard_size * 0.9 / num_keys - 64;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path.c_str(), &db, nullptr));
+  std::map<uint32_t, std::string> dic;
+  for (uint32_t i = 0; i < num_keys; i++) {
+    gen_key(i);
+    std::string value = GenerateRandomString(mt, value_len);
+    dic[i] = value;
+    ASSERT_EQ(Ok, db->Set(Slice(key, KEY_SIZE),
+                          Slice((char*)value.data(), value.size())));
+  }
+  // until the demoter has made room for a tenth of the keys
+  const uint32_t min_cold_size = num_keys / 10 * value_len;
+  for (int i = 0; i < 100 && cold_tier_size() < min_cold_size; i++) {
+    usleep(10000);
+  }
+  EXPECT_GE(cold_tier_size(), min_cold_size);
+
+  // read from the cold tier, then promoted
+  check(dic);
+  check(dic);
+  for (uint32_t i = 0; i < num_keys; i += 10) {
+    gen_key(i);
+    std::string value = GenerateRandomString(mt, value_len);
+    dic[i] = value;
+    ASSERT_EQ(Ok, db->Set(Slice(key, KEY_SIZE),
+                          Slice((char*)value.data(), value.size())));
+  }
+  check(dic);
+  delete db;
+
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path.c_str(), &db, nullptr));
+  check(dic);
+  delete db;
+}
+#endif
+
+TEST(DBTest, MigrateFromV1) {
+  DB* db;
+  std::string db_file_path = "/tmp/persistence_v1";
+  remove(db_file_path.c_str());
+
+  std::mt19937 mt(time(nullptr));
+
+  static char key[KEY_SIZE];
+  auto gen_key = [&](uint32_t x) {
+    memset(key, 0, KEY_SIZE);
+    *(uint32_t*)key = x;
+  };
+
+  // lay out a v1 pool by hand, with two versions of the first keys
+  std::vector<char> pool(PMEM_SIZE, 0);
+  std::vector<uint64_t> frontiers(NUM_SHARDS, 0);
+  std::map<uint32_t, std::string> dic;
+  for (uint32_t timestamp = 0; timestamp < 2; timestamp++) {
+    for (uint32_t i = 0; i < (timestamp == 0 ? 66 : 10); i++) {
+      gen_key(i);
+      std::string value = GenerateRandomString(mt, 80 + i);
+      dic[i] = value;
+
+      uint32_t shard = key[0] & SHARD_HASH_MASK;
+      uint32_t cap = PmemRecordV1::record_size(value.size());
+      char* base = pool.data() + PMEM_SIZE / NUM_SHARDS * shard;
+      new (base + frontiers[shard]) PmemRecordV1(
+          key, (char*)value.data(), value.size(), cap, timestamp);
+      frontiers[shard] += cap;
+    }
+  }
+  FILE* file = fopen(db_file_path.c_str(), "wb");
+  ASSERT_EQ(pool.size(), fwrite(pool.data(), 1, pool.size(), file));
+  fclose(file);
+
+  for (int round = 0; round < 2; round++) {
+    ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path.c_str(), &db, nullptr));
+    for (uint32_t i = 0; i < 66; i++) {
+      gen_key(i);
+      std::string ans;
+      auto ret = db->Get(Slice(key, KEY_SIZE), &ans);
+      EXPECT_EQ(ret, Ok);
+      if (ret == Ok) {
+        EXPECT_EQ(ans, dic[i]);
+      }
+    }
+    delete db;
+  }
+}
+
+// The shards of a new pool are only zeroed up to their high-water marks.
+// Whatever lies beyond a mark, like a record left by a previous user of the
+// device, is not recovered.
+TEST(DBTest, LazyInit) {
+  DB* db;
+  std::string db_file_path = "/tmp/persistence_lazy_init";
+  remove(db_file_path.c_str());
+
+  std::mt19937 mt(time(nullptr));
+
+  static char key[KEY_SIZE];
+  auto gen_key = [&](uint32_t x) {
+    memset(key, 0, KEY_SIZE);
+    *(uint32_t*)key = x;
+  };
+
+  // the records of shard 0 end just below its first chunk
+  const uint32_t cap = 1024;
+  const uint32_t value_len = cap - PmemRecord::record_size(0);
+  const uint32_t num_keys = (1 << POOL_CHUNK_BITS) / cap - 1;
+  std::map<uint32_t, std::string> dic;
+  auto keys = Shard0Keys(num_keys);
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path.c_str(), &db, nullptr));
+  for (uint32_t i = 0; i < num_keys; i++) {
+    gen_key(keys[i]);
+    std::string value = GenerateRandomString(mt, value_len);
+    dic[i] = value;
+    db->Set(Slice(key, KEY_SIZE), Slice((char*)value.data(), value.size()));
+  }
+  delete db;
+
+  FILE* file = fopen(db_file_path.c_str(), "r+b");
+  PoolHeader header;
+  ASSERT_EQ(1u, fread(&header, sizeof(header), 1, file));
+  EXPECT_EQ(header.high_water_marks[0], 1u << POOL_CHUNK_BITS);
+  for (uint32_t i = 1; i < NUM_SHARDS; i++) {
+    EXPECT_EQ(header.high_water_marks[i], 0u);
+  }
+
+  // a newer record of the first key right at the mark
+  gen_key(keys[0]);
+  std::string stale(value_len, 'x');
+  std::vector<char> record(cap);
+  new (record.data()) PmemRecord(key, &stale[0], value_len, cap, 100);
+  uint64_t stale_offset = POOL_HEADER_SIZE + header.high_water_marks[0];
+  fseek(file, stale_offset, SEEK_SET);
+  ASSERT_EQ(cap, fwrite(record.data(), 1, cap, file));
+  fclose(file);
+
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path.c_str(), &db, nullptr));
+  for (uint32_t i = 0; i < num_keys; i++) {
+    gen_key(keys[i]);
+    std::string ans;
+    auto ret = db->Get(Slice(key, KEY_SIZE), &ans);
+    EXPECT_EQ(ret, Ok);
+    if (ret == Ok) {
+      EXPECT_EQ(ans, dic[i]);
+    }
+  }
+  delete db;
+}
+
+// A pool created by the engine of one profile is reopened by it, but not by
+// the engines of profiles with another shard count.
+TEST(DBTest, Profiles) {
+  DB* db;
+  std::string db_file_path = "/tmp/persistence_profiles";
+  remove(db_file_path.c_str());
+
+  std::mt19937 mt(time(nullptr));
+
+  static char key[KEY_SIZE];
+  auto gen_key = [&](uint32_t x) {
+    memset(key, 0, KEY_SIZE);
+    *(uint32_t*)key = x;
+  };
+
+  const char* profile = "debug_few_shards";
+  EXPECT_EQ(NotFound, DB::CreateOrOpen(db_file_path.c_str(), "none", &db));
+
+  std::map<uint32_t, std::string> dic;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path.c_str(), profile, &db));
+  for (uint32_t i = 0; i < 1000; i++) {
+    gen_key(i);
+    std::string value = GenerateRandomString(mt, 80 + i % 200);
+    dic[i] = value;
+    db->Set(Slice(key, KEY_SIZE), Slice((char*)value.data(), value.size()));
+  }
+  delete db;
+
+  FILE* file = fopen(db_file_path.c_str(), "rb");
+  PoolHeader header;
+  ASSERT_EQ(1u, fread(&header, sizeof(header), 1, file));
+  fclose(file);
+  ASSERT_NE(header.num_shards, NUM_SHARDS);
+  EXPECT_EQ(IOError, DB::CreateOrOpen(db_file_path.c_str(), &db, nullptr));
+
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path.c_str(), profile, &db));
+  for (uint32_t i = 0; i < 1000; i++) {
+    gen_key(i);
+    std::string ans;
+    auto ret = db->Get(Slice(key, KEY_SIZE), &ans);
+    EXPECT_EQ(ret, Ok);
+    if (ret == Ok) {
+      EXPECT_EQ(ans, dic[i]);
+    }
+  }
+  delete db;
+}
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "engine/config.h"
+#include "engine/large_allocator.h"
+#include "engine/logger.h"
+#include "engine/persist.h"
+#include "engine/pmem_allocator.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// address space of the allocator, in units of ADDRESS_ALIGN_NUM bytes
+const uint64_t NUM_UNITS = 1 << 20;
+
+class PmemAllocatorTest : public testing::Test {
+ protected:
+  std::unique_ptr<Logger> logger_;
+  std::unique_ptr<PmemAllocator> allocator_;
+  LargeAllocator large_allocator_;
+  uint64_t large_region_size_;
+  std::atomic<uint64_t> large_frontier_;
+  // the whole range counts as zeroed, nothing is written
+  uint64_t high_water_mark_;
+
+  void SetUp() override {
+    logger_.reset(new Logger(nullptr));
+    large_region_size_ = 0;
+    large_frontier_.store(0);
+    high_water_mark_ = NUM_UNITS * ADDRESS_ALIGN_NUM;
+    large_allocator_.Init(high_water_mark_, &large_region_size_,
+                          &large_frontier_);
+    allocator_.reset(new PmemAllocator());
+    allocator_->Init(0, nullptr, NUM_UNITS * ADDRESS_ALIGN_NUM,
+                     &high_water_mark_, &large_allocator_, logger_.get());
+    allocator_->set_pmem_frontier(0);
+    allocator_->set_mode(PmemAllocator::kShrink);
+  }
+};
+
+#ifndef USE_SHARD_OWNER
+TEST_F(PmemAllocatorTest, Stress) {
+  const uint32_t num_ops = 5000;
+  const uint32_t max_held = 16;
+  // the owner of every unit, a unit handed out twice is an overlap
+  std::vector<std::atomic<uint8_t>> owned(NUM_UNITS);
+  std::atomic<uint64_t> num_overlaps(0), num_out_of_range(0);
+
+  auto take = [&](uint64_t ptr, uint32_t cap, uint8_t owner) {
+    if (ptr + cap > NUM_UNITS * ADDRESS_ALIGN_NUM) {
+      num_out_of_range++;
+      return false;
+    }
+    for (uint64_t u = ptr / ADDRESS_ALIGN_NUM;
+         u < (ptr + cap) / ADDRESS_ALIGN_NUM; u++) {
+      if (owned[u].exchange(owner) != 0) num_overlaps++;
+    }
+    return true;
+  };
+  auto give_back = [&](uint64_t ptr, uint32_t cap) {
+    for (uint64_t u = ptr / ADDRESS_ALIGN_NUM;
+         u < (ptr + cap) / ADDRESS_ALIGN_NUM; u++) {
+      owned[u].store(0);
+    }
+    allocator_->Deallocate(ptr, cap);
+  };
+
+  std::thread threads[NUM_THREADS];
+  for (uint32_t i = 0; i < NUM_THREADS; i++) {
+    threads[i] = std::thread([&, i]() {
+      std::mt19937 mt(i);
+      std::vector<std::pair<uint64_t, uint32_t>> held;
+      for (uint32_t j = 0; j < num_ops; j++) {
+        if (held.size() < max_held && (held.empty() || mt() % 2 == 0)) {
+          uint32_t size = ADDRESS_ALIGN_NUM + mt() % 448;
+          uint64_t ptr;
+          uint32_t cap;
+          std::tie(ptr, cap) = allocator_->Allocate(size);
+          EXPECT_GE(cap, size);
+          if (take(ptr, cap, i + 1)) held.emplace_back(ptr, cap);
+        } else {
+          uint32_t k = mt() % held.size();
+          give_back(held[k].first, held[k].second);
+          held[k] = held.back();
+          held.pop_back();
+        }
+      }
+      for (auto& range : held) give_back(range.first, range.second);
+    });
+  }
+  for (uint32_t i = 0; i < NUM_THREADS; i++) {
+    threads[i].join();
+  }
+
+  EXPECT_EQ(num_overlaps.load(), 0);
+  EXPECT_EQ(num_out_of_range.load(), 0);
+  // every byte below the frontier is either free again or accounted as lost
+  EXPECT_EQ(allocator_->free_size() + allocator_->lost_size(),
+            allocator_->pmem_frontier());
+}
+#endif
+
+TEST_F(PmemAllocatorTest, Exhausted) {
+  const uint32_t cap = 2 * ADDRESS_ALIGN_NUM;
+  const uint32_t num_ranges = GC_POOL_SIZE_PER_SHARD + 10;
+  std::vector<uint64_t> ptrs;
+  for (uint32_t i = 0; i < num_ranges; i++) {
+    uint64_t ptr;
+    uint32_t allocated_cap;
+    std::tie(ptr, allocated_cap) = allocator_->Allocate(cap);
+    ASSERT_EQ(allocated_cap, cap);
+    ptrs.push_back(ptr);
+  }
+  uint64_t frontier = allocator_->pmem_frontier();
+  ASSERT_EQ(frontier, (uint64_t)num_ranges * cap);
+
+  // the ranges beyond the size of the pool are given up, not overwritten
+  for (auto ptr : ptrs) allocator_->Deallocate(ptr, cap);
+  EXPECT_EQ(allocator_->free_size(), (uint64_t)GC_POOL_SIZE_PER_SHARD * cap);
+  EXPECT_EQ(allocator_->lost_size(), 10ull * cap);
+  EXPECT_EQ(allocator_->num_spare_ranges(), 0);
+
+  // the tracked ranges are reused, then the allocator falls back to append
+  std::vector<uint64_t> reused;
+  for (uint32_t i = 0; i < num_ranges; i++) {
+    uint64_t ptr;
+    uint32_t allocated_cap;
+    std::tie(ptr, allocated_cap) = allocator_->Allocate(cap);
+    EXPECT_EQ(allocated_cap, cap);
+    if (i < GC_POOL_SIZE_PER_SHARD) {
+      EXPECT_LT(ptr, frontier);
+      reused.push_back(ptr);
+    } else {
+      EXPECT_GE(ptr, frontier);
+    }
+  }
+  std::sort(reused.begin(), reused.end());
+  EXPECT_TRUE(std::unique(reused.begin(), reused.end()) == reused.end());
+  EXPECT_EQ(allocator_->free_size(), 0);
+  EXPECT_EQ(allocator_->num_spare_ranges(), GC_POOL_SIZE_PER_SHARD);
+}
+
+// A full shard hands out nothing rather than ranges past its end, except for
+// the reserve and the ranges freed since.
+TEST_F(PmemAllocatorTest, Full) {
+  const uint32_t cap = 4 * XPLINE_SIZE;
+  uint64_t limit = NUM_UNITS * ADDRESS_ALIGN_NUM - PMEM_RESERVE_SIZE;
+  std::vector<uint64_t> ptrs;
+  for (;;) {
+    uint64_t ptr;
+    uint32_t allocated_cap;
+    std::tie(ptr, allocated_cap) = allocator_->Allocate(cap);
+    if (allocated_cap == 0) break;
+    ASSERT_EQ(allocated_cap, cap);
+    ASSERT_LE(ptr + cap, limit);
+    ptrs.push_back(ptr);
+  }
+  EXPECT_EQ(limit / cap, ptrs.size());
+  EXPECT_LE(allocator_->pmem_frontier(), limit);
+
+  // the reserve is only handed out on demand, and ends with the shard
+  uint64_t ptr;
+  uint32_t allocated_cap;
+  std::tie(ptr, allocated_cap) = allocator_->Allocate(cap, true);
+  EXPECT_EQ(allocated_cap, cap);
+  EXPECT_GE(ptr, limit);
+  for (uint32_t i = 1; i < PMEM_RESERVE_SIZE / cap; i++) {
+    std::tie(ptr, allocated_cap) = allocator_->Allocate(cap, true);
+    EXPECT_EQ(allocated_cap, cap);
+  }
+  std::tie(ptr, allocated_cap) = allocator_->Allocate(cap, true);
+  EXPECT_EQ(allocated_cap, 0u);
+  EXPECT_EQ(allocator_->pmem_frontier(), NUM_UNITS * ADDRESS_ALIGN_NUM);
+
+  allocator_->Deallocate(ptrs[7], cap);
+  std::tie(ptr, allocated_cap) = allocator_->Allocate(cap);
+  EXPECT_EQ(allocated_cap, cap);
+  EXPECT_EQ(ptr, ptrs[7]);
+}
+
+#ifdef USE_XPLINE_PLACEMENT
+// Appended records that fit in an XPLine never cross one, larger ones touch
+// as few as they can, and the padding is kept in the free lists.
+TEST_F(PmemAllocatorTest, XPLinePlacement) {
+  allocator_->set_mode(PmemAllocator::kAppend);
+  std::mt19937 mt(0);
+  uint64_t allocated = 0;
+  for (uint32_t i = 0; i < 1000; i++) {
+    uint32_t size = ADDRESS_ALIGN_NUM + mt() % 640;
+    uint64_t ptr;
+    uint32_t cap;
+    std::tie(ptr, cap) = allocator_->Allocate(size);
+    allocated += cap;
+    uint64_t num_xplines = (ptr + cap - 1) / XPLINE_SIZE - ptr / XPLINE_SIZE + 1;
+    EXPECT_EQ((cap + XPLINE_SIZE - 1) / XPLINE_SIZE, num_xplines)
+        << "ptr " << ptr << ", cap " << cap;
+  }
+  EXPECT_GT(allocator_->free_size(), 0u);
+  EXPECT_EQ(allocated + allocator_->free_size() + allocator_->lost_size(),
+            allocator_->pmem_frontier());
+}
+#endif
+
+}  // namespace
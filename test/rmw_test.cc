@@ -0,0 +1,119 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/db.h"
+#include "engine/config.h"
+#include "gtest/gtest.h"
+#include "utils.h"
+
+// A write only succeeds from the version it expects, which every write of
+// the key changes, also across a reopen.
+TEST(RMWTest, CompareAndSet) {
+  std::string db_file_path = "/tmp/rmw";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+
+  std::string key = MakeKey(1);
+  std::string small(100, 's'), large(100000, 'l'), value;
+  uint64_t version;
+  ASSERT_EQ(VersionMismatch, db->CompareAndSet(AsSlice(key), 1, AsSlice(small),
+                                               &version));
+  EXPECT_EQ(0u, version);
+  ASSERT_EQ(Ok, db->CompareAndSet(AsSlice(key), 0, AsSlice(small), &version));
+  uint64_t first = version;
+  EXPECT_NE(0u, first);
+  ASSERT_EQ(Ok, db->Get(AsSlice(key), &value, &version));
+  EXPECT_EQ(small, value);
+  EXPECT_EQ(first, version);
+
+  ASSERT_EQ(VersionMismatch,
+            db->CompareAndSet(AsSlice(key), 0, AsSlice(large), &version));
+  EXPECT_EQ(first, version);
+  ASSERT_EQ(Ok,
+            db->CompareAndSet(AsSlice(key), first, AsSlice(large), &version));
+  uint64_t second = version;
+  EXPECT_NE(first, second);
+  ASSERT_EQ(Ok, db->Get(AsSlice(key), &value));
+  EXPECT_EQ(large, value);
+
+  // a plain set moves the version on as well
+  ASSERT_EQ(Ok, db->Set(AsSlice(key), AsSlice(small)));
+  ASSERT_EQ(VersionMismatch,
+            db->CompareAndSet(AsSlice(key), second, AsSlice(large), &version));
+  uint64_t third = version;
+  EXPECT_NE(second, third);
+  delete db;
+
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+  ASSERT_EQ(Ok, db->Get(AsSlice(key), &value, &version));
+  EXPECT_EQ(third, version);
+  ASSERT_EQ(Ok,
+            db->CompareAndSet(AsSlice(key), third, AsSlice(large), &version));
+  ASSERT_EQ(Ok, db->Get(AsSlice(key), &value));
+  EXPECT_EQ(large, value);
+  delete db;
+}
+
+// Increments and appends of several threads to the same keys are never lost.
+TEST(RMWTest, IncrementAndAppend) {
+  std::string db_file_path = "/tmp/rmw_concurrent";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+
+  std::string counter = MakeKey(1), log = MakeKey(2);
+  const uint32_t num_threads = 4;
+  const int64_t num_ops = 100;
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < num_threads; i++) {
+    threads.emplace_back([&, i]() {
+      std::string suffix(1, 'a' + i);
+      for (int64_t j = 0; j < num_ops; j++) {
+        int64_t result;
+        EXPECT_EQ(Ok, db->Increment(AsSlice(counter), 2, &result));
+        EXPECT_EQ(Ok, db->Append(AsSlice(log), AsSlice(suffix)));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  std::string value;
+  ASSERT_EQ(Ok, db->Get(AsSlice(counter), &value));
+  EXPECT_EQ(std::to_string(2 * num_threads * num_ops), value);
+  int64_t result;
+  ASSERT_EQ(Ok, db->Increment(AsSlice(counter), -500, &result));
+  EXPECT_EQ(2 * num_threads * num_ops - 500, result);
+
+  ASSERT_EQ(Ok, db->Get(AsSlice(log), &value));
+  ASSERT_EQ((uint64_t)(num_threads * num_ops), value.size());
+  for (uint32_t i = 0; i < num_threads; i++) {
+    EXPECT_EQ(num_ops, std::count(value.begin(), value.end(), 'a' + i));
+  }
+
+  // not a number
+  EXPECT_EQ(IOError, db->Increment(AsSlice(log), 1, &result));
+  std::string max = std::to_string(INT64_MAX);
+  ASSERT_EQ(Ok, db->Set(AsSlice(counter), AsSlice(max)));
+  EXPECT_EQ(IOError, db->Increment(AsSlice(counter), 1, &result));
+
+  // the expiry of the value is kept
+  ASSERT_EQ(Ok, db->Set(AsSlice(counter), AsSlice(std::string("7")), kPersist,
+                        300));
+  ASSERT_EQ(Ok, db->Increment(AsSlice(counter), 1, &result));
+  EXPECT_EQ(8, result);
+  ASSERT_EQ(Ok, db->Append(AsSlice(counter), AsSlice(std::string("0"))));
+  ASSERT_EQ(Ok, db->Get(AsSlice(counter), &value));
+  EXPECT_EQ("80", value);
+  usleep(400 * 1000);
+  EXPECT_EQ(NotFound, db->Get(AsSlice(counter), &value));
+  ASSERT_EQ(Ok, db->Increment(AsSlice(counter), 1, &result));
+  EXPECT_EQ(1, result);
+  delete db;
+}
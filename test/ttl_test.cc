@@ -0,0 +1,145 @@
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "common/db.h"
+#include "engine/config.h"
+#include "engine/expiry_wheel.h"
+#include "engine/utils.h"
+#include "gtest/gtest.h"
+#include "utils.h"
+
+namespace {
+
+Status SetWithTTL(DB* db, uint64_t x, const std::string& value,
+                  uint64_t ttl_ms) {
+  std::string key = MakeKey(x);
+  return db->Set(Slice(&key[0], KEY_SIZE),
+                 Slice((char*)value.data(), value.size()), kPersist, ttl_ms);
+}
+
+Status Get(DB* db, uint64_t x, std::string* value) {
+  std::string key = MakeKey(x);
+  return db->Get(Slice(&key[0], KEY_SIZE), value);
+}
+
+}  // namespace
+
+// The wheel hands out the entries that are due, a batch at a time, and
+// keeps those of later turns.
+TEST(TTLTest, ExpiryWheel) {
+  uint64_t now = WallClockMs();
+  ExpiryWheel wheel;
+  for (uint32_t idx = 0; idx < 10; idx++) {
+    wheel.Add(idx, now + idx * EXPIRY_TICK_MS);
+  }
+  uint64_t turn = EXPIRY_WHEEL_SLOTS * EXPIRY_TICK_MS;
+  wheel.Add(10, now + turn);
+
+  std::vector<ExpiryWheel::Entry> due;
+  wheel.Advance(now + 4 * EXPIRY_TICK_MS, 3, &due);
+  EXPECT_EQ(3u, due.size());
+  wheel.Advance(now + 4 * EXPIRY_TICK_MS, 100, &due);
+  ASSERT_EQ(5u, due.size());
+  for (auto& entry : due) {
+    EXPECT_LE(entry.expiry, now + 4 * EXPIRY_TICK_MS);
+  }
+
+  due.clear();
+  wheel.Advance(now + turn - 1, 100, &due);
+  EXPECT_EQ(5u, due.size());
+  due.clear();
+  wheel.Advance(now + turn, 100, &due);
+  ASSERT_EQ(1u, due.size());
+  EXPECT_EQ(10u, due[0].idx);
+}
+
+// Expired keys are not found, whether their values are mirrored, large or
+// plain, and a set without a ttl clears the expiry.
+TEST(TTLTest, Expiry) {
+  std::string db_file_path = "/tmp/ttl";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+
+  std::string small(80, 's'), medium(1000, 'm'), large(100000, 'l');
+  ASSERT_EQ(Ok, SetWithTTL(db, 0, small, 300));
+  ASSERT_EQ(Ok, SetWithTTL(db, 1, medium, 300));
+  ASSERT_EQ(Ok, SetWithTTL(db, 2, large, 300));
+  ASSERT_EQ(Ok, SetWithTTL(db, 3, small, 300));
+  ASSERT_EQ(Ok, SetWithTTL(db, 3, small, 0));
+  ASSERT_EQ(Ok, SetWithTTL(db, 4, small, 3600 * 1000));
+
+  std::string value;
+  for (uint64_t x = 0; x < 2; x++) {
+    ASSERT_EQ(Ok, Get(db, 0, &value));
+    EXPECT_EQ(small, value);
+    ASSERT_EQ(Ok, Get(db, 1, &value));
+    EXPECT_EQ(medium, value);
+    ASSERT_EQ(Ok, Get(db, 2, &value));
+    EXPECT_EQ(large, value);
+  }
+
+  usleep(400 * 1000);
+  EXPECT_EQ(NotFound, Get(db, 0, &value));
+  EXPECT_EQ(NotFound, Get(db, 1, &value));
+  EXPECT_EQ(NotFound, Get(db, 2, &value));
+  std::string key = MakeKey(2);
+  char buf[16];
+  uint64_t read_len;
+  EXPECT_EQ(NotFound,
+            db->Read(Slice(&key[0], KEY_SIZE), 0, buf, sizeof(buf), &read_len));
+  ASSERT_EQ(Ok, Get(db, 3, &value));
+  EXPECT_EQ(small, value);
+  ASSERT_EQ(Ok, Get(db, 4, &value));
+  EXPECT_EQ(small, value);
+
+  // an expired key can be set again
+  ASSERT_EQ(Ok, SetWithTTL(db, 1, small, 0));
+  ASSERT_EQ(Ok, Get(db, 1, &value));
+  EXPECT_EQ(small, value);
+  delete db;
+}
+
+// Expiring keys keep being set while their space is reclaimed, and the
+// expiries outlive a reopen.
+TEST(TTLTest, ReclaimAndReopen) {
+  std::string db_file_path = "/tmp/ttl_reopen";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+
+  std::string value(1000, 'v');
+  const uint64_t num_keys = 1000;
+  for (uint32_t round = 0; round < 5; round++) {
+    for (uint64_t x = 0; x < num_keys; x++) {
+      ASSERT_EQ(Ok, SetWithTTL(db, x, value, 50));
+    }
+    usleep(200 * 1000);
+  }
+  std::string got;
+  for (uint64_t x = 0; x < num_keys; x++) {
+    ASSERT_EQ(NotFound, Get(db, x, &got)) << "key " << x;
+  }
+
+  ASSERT_EQ(Ok, SetWithTTL(db, 0, value, 500));
+  ASSERT_EQ(Ok, SetWithTTL(db, 1, value, 3600 * 1000));
+  ASSERT_EQ(Ok, SetWithTTL(db, 2, value, 0));
+  delete db;
+
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+  for (uint64_t x = 0; x < 3; x++) {
+    ASSERT_EQ(Ok, Get(db, x, &got)) << "key " << x;
+    EXPECT_EQ(value, got);
+  }
+  for (uint64_t x = 3; x < num_keys; x++) {
+    ASSERT_EQ(NotFound, Get(db, x, &got)) << "key " << x;
+  }
+  usleep(600 * 1000);
+  EXPECT_EQ(NotFound, Get(db, 0, &got));
+  ASSERT_EQ(Ok, Get(db, 1, &got));
+  ASSERT_EQ(Ok, Get(db, 2, &got));
+  delete db;
+}
@@ -0,0 +1,96 @@
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/db.h"
+#include "engine/config.h"
+#include "gtest/gtest.h"
+#include "utils.h"
+
+namespace {
+
+// sets the keys x..x + n - 1 of a transaction to value
+Status MultiSet(DB* db, uint64_t x, uint32_t n, const std::string& value) {
+  std::vector<std::string> keys;
+  for (uint32_t i = 0; i < n; i++) keys.push_back(MakeKey(x + i));
+  std::vector<Slice> key_slices, value_slices;
+  for (auto& key : keys) {
+    key_slices.push_back(AsSlice(key));
+    value_slices.push_back(AsSlice(value));
+  }
+  return db->MultiSet(key_slices.data(), value_slices.data(), n);
+}
+
+}  // namespace
+
+// The keys of a transaction are all set, also after a reopen, whether they
+// are new, replaced by plain sets since or hold large values.
+TEST(TxnTest, MultiSet) {
+  std::string db_file_path = "/tmp/txn";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+
+  std::string small(100, 's'), large(100000, 'l'), value;
+  ASSERT_EQ(Ok, MultiSet(db, 0, 10, small));
+  ASSERT_EQ(Ok, MultiSet(db, 5, 10, large));
+  ASSERT_EQ(Ok, db->Set(AsSlice(MakeKey(14)), AsSlice(small)));
+  for (uint64_t x = 0; x < 15; x++) {
+    ASSERT_EQ(Ok, db->Get(AsSlice(MakeKey(x)), &value)) << "key " << x;
+    EXPECT_EQ(x < 5 || x == 14 ? small : large, value) << "key " << x;
+  }
+
+  // a key given twice gets its last value
+  std::string first = MakeKey(20), second = MakeKey(21);
+  Slice keys[3] = {AsSlice(first), AsSlice(second), AsSlice(first)};
+  Slice values[3] = {AsSlice(large), AsSlice(small), AsSlice(small)};
+  ASSERT_EQ(Ok, db->MultiSet(keys, values, 3));
+  ASSERT_EQ(Ok, db->Get(AsSlice(first), &value));
+  EXPECT_EQ(small, value);
+  EXPECT_EQ(IOError, MultiSet(db, 100, TXN_MAX_KEYS + 1, small));
+  EXPECT_EQ(NotFound, db->Get(AsSlice(MakeKey(100)), &value));
+  delete db;
+
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+  for (uint64_t x = 0; x < 15; x++) {
+    ASSERT_EQ(Ok, db->Get(AsSlice(MakeKey(x)), &value)) << "key " << x;
+    EXPECT_EQ(x < 5 || x == 14 ? small : large, value) << "key " << x;
+  }
+  ASSERT_EQ(Ok, db->Get(AsSlice(first), &value));
+  EXPECT_EQ(small, value);
+  ASSERT_EQ(Ok, db->Get(AsSlice(second), &value));
+  EXPECT_EQ(small, value);
+  delete db;
+}
+
+// Transactions of several threads on the same keys all succeed, racing
+// ones are ordered key by key since they are not isolated.
+TEST(TxnTest, Concurrent) {
+  std::string db_file_path = "/tmp/txn_concurrent";
+  remove(db_file_path.c_str());
+  DB* db;
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+
+  const uint32_t num_threads = 4;
+  const uint32_t num_txns = 200;
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < num_threads; i++) {
+    threads.emplace_back([&, i]() {
+      for (uint32_t j = 0; j < num_txns; j++) {
+        EXPECT_EQ(Ok, MultiSet(db, 0, 8, std::to_string(i)));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  delete db;
+
+  ASSERT_EQ(Ok, DB::CreateOrOpen(db_file_path, &db, nullptr));
+  std::string value;
+  for (uint64_t x = 0; x < 8; x++) {
+    ASSERT_EQ(Ok, db->Get(AsSlice(MakeKey(x)), &value)) << "key " << x;
+    EXPECT_EQ(1u, value.size());
+    EXPECT_LT(value[0] - '0', (int)num_threads);
+  }
+  delete db;
+}
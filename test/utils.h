@@ -3,8 +3,13 @@
 
 #include <stdint.h>
 
+#include <cstring>
+#include <random>
 #include <string>
 
+#include "common/db.h"
+#include "engine/config.h"
+
 template <typename G>
 std::string GenerateRandomString(G& g, uint32_t len) {
   std::uniform_int_distribution<uint8_t> value_dis('a', 'z');
@@ -18,4 +23,15 @@ std::string GenerateRandomString(G& g, uint32_t len) {
   return value;
 }
 
+// the key holding x in its first bytes
+inline std::string MakeKey(uint64_t x) {
+  std::string key(KEY_SIZE, 0);
+  memcpy(&key[0], &x, sizeof(x));
+  return key;
+}
+
+inline Slice AsSlice(const std::string& s) {
+  return Slice((char*)s.data(), s.size());
+}
+
 #endif
\ No newline at end of file